@@ -2,28 +2,40 @@
 
 #include "Character/PBPlayerMovement.h"
 
+#include "Components/AudioComponent.h"
 #include "Components/CapsuleComponent.h"
 #include "Engine/Engine.h"
 #include "Engine/World.h"
 #include "GameFramework/Character.h"
 #include "HAL/IConsoleManager.h"
-#include "Kismet/GameplayStatics.h"
 #include "PhysicalMaterials/PhysicalMaterial.h"
 #include "Sound/SoundCue.h"
 
 #include "Sound/PBMoveStepSound.h"
+#include "Character/PBMovementKernel.h"
 #include "Character/PBPlayerCharacter.h"
 
 static TAutoConsoleVariable<int32> CVarShowPos(TEXT("cl.ShowPos"), 0, TEXT("Show position and movement information.\n"), ECVF_Default);
 
-DECLARE_CYCLE_STAT(TEXT("Char StepUp"), STAT_CharStepUp, STATGROUP_Character);
-DECLARE_CYCLE_STAT(TEXT("Char PhysFalling"), STAT_CharPhysFalling, STATGROUP_Character);
+DECLARE_CYCLE_STAT(TEXT("PB Char CalcVelocity"), STAT_PBCharCalcVelocity, STATGROUP_Character);
+DECLARE_CYCLE_STAT(TEXT("PB Char ApplyVelocityBraking"), STAT_PBCharApplyVelocityBraking, STATGROUP_Character);
+DECLARE_CYCLE_STAT(TEXT("PB Char PlayMoveSound"), STAT_PBCharPlayMoveSound, STATGROUP_Character);
 
 // MAGIC NUMBERS
 const float MAX_STEP_SIDE_Z = 0.08f; // maximum z value for the normal on the vertical side of steps
 const float VERTICAL_SLOPE_NORMAL_Z = 0.001f; // Slope is vertical if Abs(Normal.Z) <= this threshold. Accounts for precision problems that sometimes angle
 											  // normals slightly off horizontal for vertical surface.
 
+static PBMovementKernel::FKernelVector ToKernelVector(const FVector& Vector)
+{
+	return {Vector.X, Vector.Y, Vector.Z};
+}
+
+static FVector FromKernelVector(const PBMovementKernel::FKernelVector& Vector)
+{
+	return FVector(Vector.X, Vector.Y, Vector.Z);
+}
+
 // Purpose: override default player movement
 UPBPlayerMovement::UPBPlayerMovement()
 {
@@ -116,6 +128,126 @@ UPBPlayerMovement::UPBPlayerMovement()
 	NavAgentProps.bCanCrouch = true;
 	NavAgentProps.bCanFly = true;
 	PBCharacter = Cast<APBPlayerCharacter>(GetOwner());
+	// Movement sounds
+	MaxMoveSoundVoices = 4;
+	NextMoveSoundVoice = 0;
+	// Surface
+	FloorFriction = 1.0f;
+	FloorSurface = EPhysicalSurface::SurfaceType_Default;
+	// Dynamic step height
+	DefaultMaxStepHeight = MaxStepHeight;
+	DefaultWalkableFloorZ = GetWalkableFloorZ();
+}
+
+void UPBPlayerMovement::BeginPlay()
+{
+	Super::BeginPlay();
+	// The dynamic step height scales the class defaults, which may have been changed in a Blueprint subclass
+	const UPBPlayerMovement* Defaults = GetClass()->GetDefaultObject<UPBPlayerMovement>();
+	DefaultMaxStepHeight = Defaults->MaxStepHeight;
+	DefaultWalkableFloorZ = Defaults->GetWalkableFloorZ();
+	BuildSurfaceSounds();
+	BuildMoveSoundVoices();
+}
+
+void UPBPlayerMovement::BuildMoveSoundVoices()
+{
+	MoveSoundVoices.Reset();
+	NextMoveSoundVoice = 0;
+
+	// Nothing to hear on a dedicated server, and no voices needed if there are no sounds to play
+	if (GetNetMode() == NM_DedicatedServer || !GetOwner() || !GetOwner()->GetRootComponent())
+	{
+		return;
+	}
+	bool bHasSounds = false;
+	for (const FPBSurfaceSounds& Sounds : SurfaceSounds)
+	{
+		bHasSounds |= Sounds.bValid;
+	}
+	if (!bHasSounds)
+	{
+		return;
+	}
+
+	for (int32 Voice = 0; Voice < FMath::Max(1, MaxMoveSoundVoices); Voice++)
+	{
+		UAudioComponent* AudioComponent = NewObject<UAudioComponent>(GetOwner());
+		AudioComponent->bAutoActivate = false;
+		AudioComponent->bAutoDestroy = false;
+		AudioComponent->SetupAttachment(GetOwner()->GetRootComponent());
+		AudioComponent->RegisterComponent();
+		MoveSoundVoices.Add(AudioComponent);
+	}
+}
+
+void UPBPlayerMovement::PlayMoveSoundCue(USoundCue* Sound, float Volume)
+{
+	if (MoveSoundVoices.Num() == 0)
+	{
+		return;
+	}
+
+	// Take the voice that started playing longest ago, cutting it off if it is still playing
+	UAudioComponent* AudioComponent = MoveSoundVoices[NextMoveSoundVoice];
+	NextMoveSoundVoice = (NextMoveSoundVoice + 1) % MoveSoundVoices.Num();
+
+	AudioComponent->Stop();
+	AudioComponent->SetSound(Sound);
+	AudioComponent->SetVolumeMultiplier(Volume);
+	AudioComponent->Play();
+}
+
+void UPBPlayerMovement::BuildSurfaceSounds()
+{
+	for (int32 Surface = 0; Surface < SurfaceType_Max; Surface++)
+	{
+		FPBSurfaceSounds& Sounds = SurfaceSounds[Surface];
+		Sounds = FPBSurfaceSounds();
+
+		TSubclassOf<UPBMoveStepSound>* GotSound = PBCharacter ? PBCharacter->GetMoveStepSound(TEnumAsByte<EPhysicalSurface>((EPhysicalSurface)Surface)) : nullptr;
+		const UPBMoveStepSound* MoveSound = GotSound && *GotSound ? GotSound->GetDefaultObject() : nullptr;
+		if (!MoveSound)
+		{
+			continue;
+		}
+
+		Sounds.bValid = true;
+		Sounds.StepLeftSounds = MoveSound->GetStepLeftSounds();
+		Sounds.StepRightSounds = MoveSound->GetStepRightSounds();
+		Sounds.JumpSounds = MoveSound->GetJumpSounds();
+		Sounds.LandSounds = MoveSound->GetLandSounds();
+		Sounds.WalkVolume = MoveSound->GetWalkVolume();
+		Sounds.SprintVolume = MoveSound->GetSprintVolume();
+	}
+}
+
+const FPBSurfaceSounds& UPBPlayerMovement::GetSurfaceSounds(EPhysicalSurface Surface) const
+{
+	const FPBSurfaceSounds& Sounds = SurfaceSounds[Surface];
+	return Sounds.bValid ? Sounds : SurfaceSounds[EPhysicalSurface::SurfaceType_Default];
+}
+
+void UPBPlayerMovement::ResolveFloorSurface(const FHitResult& Hit)
+{
+	// Stays on the same material for most of the time we're on the ground, so only resolve it when it changes
+	if (Hit.PhysMaterial == FloorPhysMaterial)
+	{
+		return;
+	}
+	FloorPhysMaterial = Hit.PhysMaterial;
+
+	UPhysicalMaterial* PhysMat = FloorPhysMaterial.Get();
+	if (PhysMat)
+	{
+		FloorFriction = FMath::Min(1.0f, PhysMat->Friction * 1.25f);
+		FloorSurface = PhysMat->SurfaceType;
+	}
+	else
+	{
+		FloorFriction = 1.0f;
+		FloorSurface = EPhysicalSurface::SurfaceType_Default;
+	}
 }
 
 void UPBPlayerMovement::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
@@ -176,15 +308,8 @@ FVector UPBPlayerMovement::HandleSlopeBoosting(const FVector& SlideResult, const
 
 bool UPBPlayerMovement::ShouldCatchAir(const FFindFloorResult& OldFloor, const FFindFloorResult& NewFloor)
 {
-	float SurfaceFriction = 1.0f;
-	if (OldFloor.HitResult.PhysMaterial.IsValid())
-	{
-		UPhysicalMaterial* PhysMat = OldFloor.HitResult.PhysMaterial.Get();
-		if (PhysMat)
-		{
-			SurfaceFriction = FMath::Min(1.0f, PhysMat->Friction * 1.25f);
-		}
-	}
+	ResolveFloorSurface(OldFloor.HitResult);
+	const float SurfaceFriction = FloorFriction;
 
 	float Speed = Velocity.Size2D();
 	float MaxSpeed = SprintSpeed * 1.5f;
@@ -207,59 +332,33 @@ void UPBPlayerMovement::OnMovementModeChanged(EMovementMode PreviousMovementMode
 	// Reset step side if we are changing modes
 	StepSide = false;
 	
-	FHitResult Hit;
 	// did we jump or land
 	bool bJumped = false;
+	EPhysicalSurface Surface = EPhysicalSurface::SurfaceType_Default;
 
 	if (PreviousMovementMode == EMovementMode::MOVE_Walking && MovementMode == EMovementMode::MOVE_Falling)
 	{
-		// Hit = UPBUtil::TraceLineFullCharacter(CharacterOwner->GetCapsuleComponent(), GetWorld(), CharacterOwner);
-		FCollisionQueryParams TraceParams(FName(TEXT("RV_Trace")), true, CharacterOwner);
-		TraceParams.bTraceComplex = CharacterOwner->GetCapsuleComponent()->bTraceComplexOnMove;
-		TraceParams.bReturnPhysicalMaterial = true;
-
-		GetWorld()->SweepSingleByChannel(Hit, CharacterOwner->GetCapsuleComponent()->GetComponentLocation(),
-									  CharacterOwner->GetCapsuleComponent()->GetComponentLocation() - FVector(0.0f, 0.0f, CharacterOwner->GetCapsuleComponent()->GetScaledCapsuleHalfHeight() * 2.0f),
-									  FQuat::Identity, ECC_Visibility,
-									  FCollisionShape::MakeBox(FVector(CharacterOwner->GetCapsuleComponent()->GetScaledCapsuleRadius(), CharacterOwner->GetCapsuleComponent()->GetScaledCapsuleRadius(),
-																	   CharacterOwner->GetCapsuleComponent()->GetScaledCapsuleHalfHeight() * 1.5f)),
-									  TraceParams);
+		// The floor has already been cleared, but FloorSurface was resolved from it earlier this tick
+		Surface = FloorSurface;
 		bJumped = true;
 	}
 	if (PreviousMovementMode == EMovementMode::MOVE_Falling && MovementMode == EMovementMode::MOVE_Walking)
 	{
-		Hit = CurrentFloor.HitResult;
+		ResolveFloorSurface(CurrentFloor.HitResult);
+		Surface = FloorSurface;
 	}
 
-	UPBMoveStepSound* MoveSound = nullptr;
-	TSubclassOf<UPBMoveStepSound>* GotSound = nullptr;
-	if (Hit.PhysMaterial.IsValid())
-	{
-		GotSound = PBCharacter->GetMoveStepSound(Hit.PhysMaterial->SurfaceType);
-	}
-	if (GotSound)
+	const FPBSurfaceSounds& MoveSound = GetSurfaceSounds(Surface);
+	if (MoveSound.bValid)
 	{
-		MoveSound = GotSound->GetDefaultObject();
-	}
-	if (!MoveSound)
-	{
-		if (!PBCharacter->GetMoveStepSound(TEnumAsByte<EPhysicalSurface>(EPhysicalSurface::SurfaceType_Default)))
-		{
-			return;
-		}
-		MoveSound = PBCharacter->GetMoveStepSound(TEnumAsByte<EPhysicalSurface>(EPhysicalSurface::SurfaceType_Default))->GetDefaultObject();
-	}
-
-	if (MoveSound)
-	{
-		float MoveSoundVolume = MoveSound->GetWalkVolume();
+		float MoveSoundVolume = MoveSound.WalkVolume;
 
 		if (IsCrouching())
 		{
 			MoveSoundVolume *= 0.65f;
 		}
 
-		TArray<USoundCue*> MoveSoundCues = bJumped ? MoveSound->GetJumpSounds() : MoveSound->GetLandSounds();
+		const TArray<USoundCue*>& MoveSoundCues = bJumped ? MoveSound.JumpSounds : MoveSound.LandSounds;
 
 		if (MoveSoundCues.Num() < 1)
 		{
@@ -268,12 +367,10 @@ void UPBPlayerMovement::OnMovementModeChanged(EMovementMode PreviousMovementMode
 
 		USoundCue* Sound = MoveSoundCues[FMath::RandRange(0, MoveSoundCues.Num() - 1)];
 
-		Sound->VolumeMultiplier = MoveSoundVolume;
-
 		/*UPBGameplayStatics::PlaySound(Sound, GetCharacterOwner(),
 									  // FVector(0.0f, 0.0f, -GetCharacterOwner()->GetCapsuleComponent()->GetScaledCapsuleHalfHeight()),
 									  EPBSoundCategory::Footstep);*/
-		UGameplayStatics::SpawnSoundAttached(Sound, GetCharacterOwner()->GetRootComponent());
+		PlayMoveSoundCue(Sound, MoveSoundVolume);
 	}
 }
 
@@ -295,47 +392,23 @@ void UPBPlayerMovement::ToggleNoClip()
 
 void UPBPlayerMovement::ApplyVelocityBraking(float DeltaTime, float Friction, float BrakingDeceleration)
 {
+	SCOPE_CYCLE_COUNTER(STAT_PBCharApplyVelocityBraking);
+
 	float Speed = Velocity.Size2D();
 	if (Speed <= 0.1f || !HasValidData() || HasAnimRootMotion() || DeltaTime < MIN_TICK_TIME)
 	{
 		return;
 	}
 
-	const float FrictionFactor = FMath::Max(0.0f, BrakingFrictionFactor);
-	Friction = FMath::Max(0.0f, Friction * FrictionFactor);
-	BrakingDeceleration = FMath::Max(BrakingDeceleration, Speed);
-	BrakingDeceleration = FMath::Max(0.0f, BrakingDeceleration);
-	const bool bZeroFriction = FMath::IsNearlyZero(Friction);
-	const bool bZeroBraking = BrakingDeceleration == 0.0f;
-
-	if (bZeroFriction || bZeroBraking)
-	{
-		return;
-	}
-
-	const FVector OldVel = Velocity;
-
-	// Decelerate to brake to a stop
-	const FVector RevAccel = Friction * BrakingDeceleration * Velocity.GetSafeNormal();
-	Velocity -= RevAccel * DeltaTime;
-
-	// Don't reverse direction
-	if ((Velocity | OldVel) <= 0.0f)
-	{
-		Velocity = FVector::ZeroVector;
-		return;
-	}
-
-	// Clamp to zero if nearly zero, or if below min threshold and braking.
-	const float VSizeSq = Velocity.SizeSquared();
-	if (VSizeSq <= KINDA_SMALL_NUMBER)
-	{
-		Velocity = FVector::ZeroVector;
-	}
+	PBMovementKernel::FKernelVector KernelVelocity = ToKernelVector(Velocity);
+	PBMovementKernel::ApplyBraking(KernelVelocity, Friction, BrakingDeceleration, BrakingFrictionFactor, DeltaTime);
+	Velocity = FromKernelVector(KernelVelocity);
 }
 
 void UPBPlayerMovement::PlayMoveSound(float DeltaTime)
 {
+	SCOPE_CYCLE_COUNTER(STAT_PBCharPlayMoveSound);
+
 	// Count move sound time down if we've got it
 	if (MoveSoundTime > 0)
 	{
@@ -376,41 +449,28 @@ void UPBPlayerMovement::PlayMoveSound(float DeltaTime)
 
 	float MoveSoundVolume = 1.0f;
 
-	UPBMoveStepSound* MoveSound = nullptr;
+	const FPBSurfaceSounds* MoveSound = nullptr;
 
 	if (bOnLadder)
 	{
 		MoveSoundVolume = 0.5f;
 		MoveSoundTime = 450.0f;
-		if (!PBCharacter->GetMoveStepSound(TEnumAsByte<EPhysicalSurface>(EPhysicalSurface::SurfaceType1)))
+		if (!SurfaceSounds[EPhysicalSurface::SurfaceType1].bValid)
 		{
 			return;
 		}
-		MoveSound = PBCharacter->GetMoveStepSound(TEnumAsByte<EPhysicalSurface>(EPhysicalSurface::SurfaceType1))->GetDefaultObject();
+		MoveSound = &SurfaceSounds[EPhysicalSurface::SurfaceType1];
 	}
 	else
 	{
 		MoveSoundTime = bSprinting ? 300.0f : 400.0f;
-		FHitResult Hit = CurrentFloor.HitResult;
-		TSubclassOf<UPBMoveStepSound>* GotSound = nullptr;
-		if (Hit.PhysMaterial.IsValid())
-		{
-			GotSound = PBCharacter->GetMoveStepSound(Hit.PhysMaterial->SurfaceType);
-		}
-		if (GotSound)
+		MoveSound = &GetSurfaceSounds(FloorSurface);
+		if (!MoveSound->bValid)
 		{
-			MoveSound = GotSound->GetDefaultObject();
-		}
-		if (!MoveSound)
-		{
-			if (!PBCharacter->GetMoveStepSound(TEnumAsByte<EPhysicalSurface>(EPhysicalSurface::SurfaceType_Default)))
-			{
-				return;
-			}
-			MoveSound = PBCharacter->GetMoveStepSound(TEnumAsByte<EPhysicalSurface>(EPhysicalSurface::SurfaceType_Default))->GetDefaultObject();
+			return;
 		}
 
-		MoveSoundVolume = bSprinting ? MoveSound->GetSprintVolume() : MoveSound->GetWalkVolume();
+		MoveSoundVolume = bSprinting ? MoveSound->SprintVolume : MoveSound->WalkVolume;
 
 		if (IsCrouching())
 		{
@@ -421,7 +481,7 @@ void UPBPlayerMovement::PlayMoveSound(float DeltaTime)
 
 	if (MoveSound)
 	{
-		TArray<USoundCue*> MoveSoundCues = StepSide ? MoveSound->GetStepLeftSounds() : MoveSound->GetStepRightSounds();
+		const TArray<USoundCue*>& MoveSoundCues = StepSide ? MoveSound->StepLeftSounds : MoveSound->StepRightSounds;
 
 		if (MoveSoundCues.Num() < 1)
 		{
@@ -430,19 +490,38 @@ void UPBPlayerMovement::PlayMoveSound(float DeltaTime)
 
 		USoundCue* Sound = MoveSoundCues[FMath::RandRange(0, MoveSoundCues.Num() - 1)];
 
-		Sound->VolumeMultiplier = MoveSoundVolume;
-
 		/*UPBGameplayStatics::PlaySound(Sound, GetCharacterOwner(),
 									  // FVector(0.0f, 0.0f, -GetCharacterOwner()->GetCapsuleComponent()->GetScaledCapsuleHalfHeight()),
 									  EPBSoundCategory::Footstep);*/
-		UGameplayStatics::SpawnSoundAttached(Sound, GetCharacterOwner()->GetRootComponent());
+		PlayMoveSoundCue(Sound, MoveSoundVolume);
 	}
 
 	StepSide = !StepSide;
 }
 
+PBMovementKernel::FMovementParams UPBPlayerMovement::MakeKernelParams() const
+{
+	PBMovementKernel::FMovementParams Params;
+	Params.Friction = bUseSeparateBrakingFriction ? BrakingFriction : GroundFriction;
+	Params.BrakingDeceleration = BrakingDecelerationWalking;
+	Params.BrakingFrictionFactor = BrakingFrictionFactor;
+	Params.AirSpeedCap = AirSpeedCap;
+	Params.GroundAccelerationMultiplier = GroundAccelerationMultiplier;
+	Params.AirAccelerationMultiplier = AirAccelerationMultiplier;
+	Params.DefaultMaxStepHeight = DefaultMaxStepHeight;
+	Params.DefaultWalkableFloorZ = DefaultWalkableFloorZ;
+	Params.MinStepHeight = MinStepHeight;
+	Params.MaxWalkSpeedCrouched = MaxWalkSpeedCrouched;
+	Params.SpeedMultMin = SpeedMultMin;
+	Params.SpeedMultMax = SpeedMultMax;
+	return Params;
+}
+
 void UPBPlayerMovement::CalcVelocity(float DeltaTime, float Friction, bool bFluid, float BrakingDeceleration)
 {
+	SCOPE_CYCLE_COUNTER(STAT_PBCharCalcVelocity);
+
+	ResolveFloorSurface(CurrentFloor.HitResult);
 	PlayMoveSound(DeltaTime);
 
 	// Do not update velocity when using root motion or when SimulatedProxy -
@@ -492,12 +571,7 @@ void UPBPlayerMovement::CalcVelocity(float DeltaTime, float Friction, bool bFlui
 	const bool bZeroAcceleration = Acceleration.IsNearlyZero();
 	const bool bIsGroundMove = IsMovingOnGround() && bBrakingFrameTolerated;
 
-	float SurfaceFriction = 1.0f;
-	UPhysicalMaterial* PhysMat = CurrentFloor.HitResult.PhysMaterial.Get();
-	if (PhysMat)
-	{
-		SurfaceFriction = FMath::Min(1.0f, PhysMat->Friction * 1.25f);
-	}
+	const float SurfaceFriction = FloorFriction;
 
 	// Apply friction
 	// TODO: HACK: friction applied only once in substepping due to excessive friction, but this is too little for low frame rates
@@ -536,60 +610,35 @@ void UPBPlayerMovement::CalcVelocity(float DeltaTime, float Friction, bool bFlui
 	}
 	else
 	{
+		const PBMovementKernel::FMovementParams KernelParams = MakeKernelParams();
+		PBMovementKernel::FKernelVector KernelVelocity = ToKernelVector(Velocity);
+
 		// Apply input acceleration
 		if (!bZeroAcceleration)
 		{
-			// Clamp acceleration to max speed
-			Acceleration = Acceleration.GetClampedToMaxSize2D(MaxSpeed);
-			// Find veer
-			const FVector AccelDir = Acceleration.GetSafeNormal2D();
-			const float Veer = Velocity.X * AccelDir.X + Velocity.Y * AccelDir.Y;
-			// Get add speed with air speed cap
-			const float AddSpeed = (bIsGroundMove ? Acceleration : Acceleration.GetClampedToMaxSize2D(AirSpeedCap)).Size2D() - Veer;
-			if (AddSpeed > 0.0f)
-			{
-				// Apply acceleration
-				float AccelerationMultiplier = bIsGroundMove ? GroundAccelerationMultiplier : AirAccelerationMultiplier;
-				Acceleration *= AccelerationMultiplier * SurfaceFriction * DeltaTime;
-				Acceleration = Acceleration.GetClampedToMaxSize2D(AddSpeed);
-				Velocity += Acceleration;
-			}
+			PBMovementKernel::FKernelVector KernelAcceleration = ToKernelVector(Acceleration);
+			PBMovementKernel::ApplyAcceleration(KernelVelocity, KernelAcceleration, MaxSpeed, SurfaceFriction, bIsGroundMove, KernelParams, DeltaTime);
+			Acceleration = FromKernelVector(KernelAcceleration);
 		}
 
 		// Apply additional requested acceleration
 		if (!bZeroRequestedAcceleration)
 		{
-			Velocity += RequestedAcceleration * DeltaTime;
+			KernelVelocity.X += RequestedAcceleration.X * DeltaTime;
+			KernelVelocity.Y += RequestedAcceleration.Y * DeltaTime;
+			KernelVelocity.Z += RequestedAcceleration.Z * DeltaTime;
 		}
 
-		Velocity = Velocity.GetClampedToMaxSize2D(13470.4f);
-
-		float SpeedSq = Velocity.SizeSquared2D();
+		PBMovementKernel::ClampHorizontalSpeed(KernelVelocity, KernelParams);
+		Velocity = FromKernelVector(KernelVelocity);
 
 		// Dynamic step height code for allowing sliding on a slope when at a high speed
-		if (SpeedSq <= MaxWalkSpeedCrouched * MaxWalkSpeedCrouched)
-		{
-			// If we're crouching or not sliding, just use max
-			MaxStepHeight = GetClass()->GetDefaultObject<UPBPlayerMovement>()->MaxStepHeight;
-			SetWalkableFloorZ(GetClass()->GetDefaultObject<UPBPlayerMovement>()->GetWalkableFloorZ());
-		}
-		else
+		float WalkableFloorZ;
+		PBMovementKernel::ComputeStepHeight(KernelVelocity, SurfaceFriction, IsFalling(), KernelParams, MaxStepHeight, WalkableFloorZ);
+		// Setting it also works out the walkable angle, so only do that when it changes
+		if (WalkableFloorZ != GetWalkableFloorZ())
 		{
-			// Scale step/ramp height down the faster we go
-			float Speed = FMath::Sqrt(SpeedSq);
-			float SpeedScale = (Speed - SpeedMultMin) / (SpeedMultMax - SpeedMultMin);
-			// float SpeedMultiplier = UPBUtil::Clamp01(SpeedScale);
-			float SpeedMultiplier = FMath::Clamp(SpeedScale, 0.0f, 1.0f);
-			SpeedMultiplier *= SpeedMultiplier;
-			if (!IsFalling())
-			{
-				// If we're on ground, factor in friction.
-				SpeedMultiplier = FMath::Max((1.0f - SurfaceFriction) * SpeedMultiplier, 0.0f);
-			}
-			MaxStepHeight = FMath::Clamp(GetClass()->GetDefaultObject<UPBPlayerMovement>()->MaxStepHeight * (1.0f - SpeedMultiplier), MinStepHeight,
-										 GetClass()->GetDefaultObject<UPBPlayerMovement>()->MaxStepHeight);
-			SetWalkableFloorZ(FMath::Clamp(GetClass()->GetDefaultObject<UPBPlayerMovement>()->GetWalkableFloorZ() - (0.5f * (0.4f - SpeedMultiplier)),
-										   GetClass()->GetDefaultObject<UPBPlayerMovement>()->GetWalkableFloorZ(), 0.9848f));
+			SetWalkableFloorZ(WalkableFloorZ);
 		}
 	}
 
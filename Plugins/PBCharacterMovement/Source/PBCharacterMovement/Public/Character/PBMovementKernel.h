@@ -0,0 +1,425 @@
+// Copyright 2017-2019 Project Borealis
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#define PB_MOVEMENT_KERNEL_AVX2 1
+#else
+#define PB_MOVEMENT_KERNEL_AVX2 0
+#endif
+
+#if PB_MOVEMENT_KERNEL_AVX2 || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PB_MOVEMENT_KERNEL_SSE 1
+#else
+#define PB_MOVEMENT_KERNEL_SSE 0
+#endif
+
+#if PB_MOVEMENT_KERNEL_SSE
+#include <immintrin.h>
+#endif
+
+/**
+ * The Source-style velocity math of UPBPlayerMovement, without any engine types.
+ *
+ * UPBPlayerMovement calls the scalar functions from CalcVelocity and ApplyVelocityBraking. StepBatch runs the same math for many
+ * characters at once, stored as a structure of arrays, 8 at a time with AVX2 and 4 at a time with SSE, whichever the compiler targets.
+ * Every path is the same template instantiated for a different lane width, so with floating point contraction disabled a character
+ * comes out of StepBatch exactly as it comes out of the scalar functions. Where the compiler may fuse a multiply and an add into an
+ * FMA (-ffp-contract), the scalar functions can differ from the batch in the last bits. Only this header is needed to build it,
+ * which is how Tests/ checks and benchmarks it outside of the engine, with contraction off.
+ */
+namespace PBMovementKernel
+{
+// Same values as the engine's KINDA_SMALL_NUMBER and SMALL_NUMBER
+constexpr float KindaSmallNumber = 1.e-4f;
+constexpr float SmallNumber = 1.e-8f;
+
+struct FKernelVector
+{
+	float X;
+	float Y;
+	float Z;
+};
+
+/** Tuning of the movement, shared by every character in a batch */
+struct FMovementParams
+{
+	/** Braking friction before the surface friction is applied (GroundFriction, or BrakingFriction if it is used separately) */
+	float Friction = 4.0f;
+	float BrakingDeceleration = 190.5f;
+	float BrakingFrictionFactor = 1.0f;
+	float AirSpeedCap = 57.15f;
+	float GroundAccelerationMultiplier = 10.0f;
+	float AirAccelerationMultiplier = 10.0f;
+	/** Horizontal speed is never allowed past this */
+	float MaxHorizontalSpeed = 13470.4f;
+
+	/** Step height and walkable floor Z of the class defaults, used at low speeds */
+	float DefaultMaxStepHeight = 34.29f;
+	float DefaultWalkableFloorZ = 0.7f;
+	float MinStepHeight = 7.5f;
+	/** At or below this speed the defaults are used */
+	float MaxWalkSpeedCrouched = 120.65f;
+	/** The step height scales down between these speeds */
+	float SpeedMultMin = 1036.32f;
+	float SpeedMultMax = 1524.0f;
+};
+
+/** Per character flags of FCharacterBatch */
+namespace ECharacterFlags
+{
+enum Type : uint32_t
+{
+	/** On the ground, accelerating with the ground multiplier and no air speed cap */
+	GroundMove = 1 << 0,
+	/** Apply ground friction this step */
+	ApplyBraking = 1 << 1,
+	/** Falling, so surface friction doesn't affect the step height */
+	Falling = 1 << 2,
+};
+} // namespace ECharacterFlags
+
+/** Characters stored as a structure of arrays, each Num long */
+struct FCharacterBatch
+{
+	int32_t Num = 0;
+	float* VelocityX = nullptr;
+	float* VelocityY = nullptr;
+	float* VelocityZ = nullptr;
+	float* AccelerationX = nullptr;
+	float* AccelerationY = nullptr;
+	float* AccelerationZ = nullptr;
+	const float* MaxSpeed = nullptr;
+	const float* SurfaceFriction = nullptr;
+	const uint32_t* Flags = nullptr;
+	/** Written with the step height and walkable floor Z for the new velocity */
+	float* MaxStepHeight = nullptr;
+	float* WalkableFloorZ = nullptr;
+};
+
+/** One character at a time, with plain floats and bools */
+struct FScalarLanes
+{
+	using FFloat = float;
+	using FMask = bool;
+	static constexpr int32_t Width = 1;
+
+	static FFloat Load(const float* Src) { return *Src; }
+	static void Store(float* Dst, FFloat Value) { *Dst = Value; }
+	static FFloat Set(float Value) { return Value; }
+	static FFloat Add(FFloat A, FFloat B) { return A + B; }
+	static FFloat Sub(FFloat A, FFloat B) { return A - B; }
+	static FFloat Mul(FFloat A, FFloat B) { return A * B; }
+	static FFloat Div(FFloat A, FFloat B) { return A / B; }
+	static FFloat Sqrt(FFloat A) { return std::sqrt(A); }
+	// Same operand order as minps and maxps, which return the second operand unless the comparison holds
+	static FFloat Min(FFloat A, FFloat B) { return A < B ? A : B; }
+	static FFloat Max(FFloat A, FFloat B) { return A > B ? A : B; }
+	static FFloat Abs(FFloat A) { return std::fabs(A); }
+	static FMask Le(FFloat A, FFloat B) { return A <= B; }
+	static FMask Lt(FFloat A, FFloat B) { return A < B; }
+	static FMask Gt(FFloat A, FFloat B) { return A > B; }
+	static FMask And(FMask A, FMask B) { return A && B; }
+	static FMask Not(FMask A) { return !A; }
+	static FFloat Select(FMask Mask, FFloat A, FFloat B) { return Mask ? A : B; }
+	static bool Any(FMask Mask) { return Mask; }
+	static FMask LoadFlag(const uint32_t* Flags, uint32_t Flag) { return (*Flags & Flag) != 0; }
+};
+
+#if PB_MOVEMENT_KERNEL_SSE
+struct FSSELanes
+{
+	using FFloat = __m128;
+	using FMask = __m128;
+	static constexpr int32_t Width = 4;
+
+	static FFloat Load(const float* Src) { return _mm_loadu_ps(Src); }
+	static void Store(float* Dst, FFloat Value) { _mm_storeu_ps(Dst, Value); }
+	static FFloat Set(float Value) { return _mm_set1_ps(Value); }
+	static FFloat Add(FFloat A, FFloat B) { return _mm_add_ps(A, B); }
+	static FFloat Sub(FFloat A, FFloat B) { return _mm_sub_ps(A, B); }
+	static FFloat Mul(FFloat A, FFloat B) { return _mm_mul_ps(A, B); }
+	static FFloat Div(FFloat A, FFloat B) { return _mm_div_ps(A, B); }
+	static FFloat Sqrt(FFloat A) { return _mm_sqrt_ps(A); }
+	static FFloat Min(FFloat A, FFloat B) { return _mm_min_ps(A, B); }
+	static FFloat Max(FFloat A, FFloat B) { return _mm_max_ps(A, B); }
+	static FFloat Abs(FFloat A) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), A); }
+	static FMask Le(FFloat A, FFloat B) { return _mm_cmple_ps(A, B); }
+	static FMask Lt(FFloat A, FFloat B) { return _mm_cmplt_ps(A, B); }
+	static FMask Gt(FFloat A, FFloat B) { return _mm_cmpgt_ps(A, B); }
+	static FMask And(FMask A, FMask B) { return _mm_and_ps(A, B); }
+	static FMask Not(FMask A) { return _mm_xor_ps(A, _mm_castsi128_ps(_mm_set1_epi32(-1))); }
+	static FFloat Select(FMask Mask, FFloat A, FFloat B) { return _mm_or_ps(_mm_and_ps(Mask, A), _mm_andnot_ps(Mask, B)); }
+	static bool Any(FMask Mask) { return _mm_movemask_ps(Mask) != 0; }
+	static FMask LoadFlag(const uint32_t* Flags, uint32_t Flag)
+	{
+		const __m128i Bit = _mm_set1_epi32((int32_t)Flag);
+		const __m128i Masked = _mm_and_si128(_mm_loadu_si128((const __m128i*)Flags), Bit);
+		return _mm_castsi128_ps(_mm_cmpeq_epi32(Masked, Bit));
+	}
+};
+#endif
+
+#if PB_MOVEMENT_KERNEL_AVX2
+struct FAVX2Lanes
+{
+	using FFloat = __m256;
+	using FMask = __m256;
+	static constexpr int32_t Width = 8;
+
+	static FFloat Load(const float* Src) { return _mm256_loadu_ps(Src); }
+	static void Store(float* Dst, FFloat Value) { _mm256_storeu_ps(Dst, Value); }
+	static FFloat Set(float Value) { return _mm256_set1_ps(Value); }
+	static FFloat Add(FFloat A, FFloat B) { return _mm256_add_ps(A, B); }
+	static FFloat Sub(FFloat A, FFloat B) { return _mm256_sub_ps(A, B); }
+	static FFloat Mul(FFloat A, FFloat B) { return _mm256_mul_ps(A, B); }
+	static FFloat Div(FFloat A, FFloat B) { return _mm256_div_ps(A, B); }
+	static FFloat Sqrt(FFloat A) { return _mm256_sqrt_ps(A); }
+	static FFloat Min(FFloat A, FFloat B) { return _mm256_min_ps(A, B); }
+	static FFloat Max(FFloat A, FFloat B) { return _mm256_max_ps(A, B); }
+	static FFloat Abs(FFloat A) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), A); }
+	static FMask Le(FFloat A, FFloat B) { return _mm256_cmp_ps(A, B, _CMP_LE_OQ); }
+	static FMask Lt(FFloat A, FFloat B) { return _mm256_cmp_ps(A, B, _CMP_LT_OQ); }
+	static FMask Gt(FFloat A, FFloat B) { return _mm256_cmp_ps(A, B, _CMP_GT_OQ); }
+	static FMask And(FMask A, FMask B) { return _mm256_and_ps(A, B); }
+	static FMask Not(FMask A) { return _mm256_xor_ps(A, _mm256_castsi256_ps(_mm256_set1_epi32(-1))); }
+	static FFloat Select(FMask Mask, FFloat A, FFloat B) { return _mm256_blendv_ps(B, A, Mask); }
+	static bool Any(FMask Mask) { return _mm256_movemask_ps(Mask) != 0; }
+	static FMask LoadFlag(const uint32_t* Flags, uint32_t Flag)
+	{
+		const __m256i Bit = _mm256_set1_epi32((int32_t)Flag);
+		const __m256i Masked = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)Flags), Bit);
+		return _mm256_castsi256_ps(_mm256_cmpeq_epi32(Masked, Bit));
+	}
+};
+#endif
+
+/** FVector::GetClampedToMaxSize2D for the X and Y of a vector. Z is left alone. */
+template <typename L>
+inline void ClampToMaxSize2DLanes(typename L::FFloat& X, typename L::FFloat& Y, typename L::FFloat MaxSize)
+{
+	using F = typename L::FFloat;
+	using M = typename L::FMask;
+
+	const F SizeSq = L::Add(L::Mul(X, X), L::Mul(Y, Y));
+	const M Zeroed = L::Lt(MaxSize, L::Set(KindaSmallNumber));
+	const M Over = L::Gt(SizeSq, L::Mul(MaxSize, MaxSize));
+	const F Scale = L::Mul(MaxSize, L::Div(L::Set(1.0f), L::Sqrt(SizeSq)));
+	X = L::Select(Zeroed, L::Set(0.0f), L::Select(Over, L::Mul(X, Scale), X));
+	Y = L::Select(Zeroed, L::Set(0.0f), L::Select(Over, L::Mul(Y, Scale), Y));
+}
+
+/** Decelerate the velocity of the active lanes with friction, without reversing it. See UPBPlayerMovement::ApplyVelocityBraking. */
+template <typename L>
+inline void BrakeLanes(typename L::FFloat& VX, typename L::FFloat& VY, typename L::FFloat& VZ, typename L::FMask Active, typename L::FFloat Friction,
+	float BrakingDeceleration, float BrakingFrictionFactor, float DeltaTime)
+{
+	using F = typename L::FFloat;
+	using M = typename L::FMask;
+
+	const F Zero = L::Set(0.0f);
+	const F Speed = L::Sqrt(L::Add(L::Mul(VX, VX), L::Mul(VY, VY)));
+	const F FrictionFactor = L::Set(BrakingFrictionFactor > 0.0f ? BrakingFrictionFactor : 0.0f);
+	const F ScaledFriction = L::Max(L::Mul(Friction, FrictionFactor), Zero);
+	// Never less than the speed, which is above 0.1 in every lane that brakes, so the deceleration can't be zero
+	const F Deceleration = L::Max(L::Max(L::Set(BrakingDeceleration), Speed), Zero);
+	Active = L::And(Active, L::Gt(Speed, L::Set(0.1f)));
+	Active = L::And(Active, L::Gt(ScaledFriction, L::Set(SmallNumber)));
+	if (!L::Any(Active))
+	{
+		return;
+	}
+
+	const F InvSize = L::Div(L::Set(1.0f), L::Sqrt(L::Add(L::Add(L::Mul(VX, VX), L::Mul(VY, VY)), L::Mul(VZ, VZ))));
+	const F Brake = L::Mul(ScaledFriction, Deceleration);
+	const F Time = L::Set(DeltaTime);
+	F NewX = L::Sub(VX, L::Mul(L::Mul(Brake, L::Mul(VX, InvSize)), Time));
+	F NewY = L::Sub(VY, L::Mul(L::Mul(Brake, L::Mul(VY, InvSize)), Time));
+	F NewZ = L::Sub(VZ, L::Mul(L::Mul(Brake, L::Mul(VZ, InvSize)), Time));
+
+	// Don't reverse direction, and clamp to zero if nearly zero
+	const F Dot = L::Add(L::Add(L::Mul(NewX, VX), L::Mul(NewY, VY)), L::Mul(NewZ, VZ));
+	const F NewSizeSq = L::Add(L::Add(L::Mul(NewX, NewX), L::Mul(NewY, NewY)), L::Mul(NewZ, NewZ));
+	const M Stop = L::Not(L::And(L::Gt(Dot, Zero), L::Gt(NewSizeSq, L::Set(KindaSmallNumber))));
+	VX = L::Select(Active, L::Select(Stop, Zero, NewX), VX);
+	VY = L::Select(Active, L::Select(Stop, Zero, NewY), VY);
+	VZ = L::Select(Active, L::Select(Stop, Zero, NewZ), VZ);
+}
+
+/**
+ * Add the input acceleration to the velocity, with the air speed cap when off the ground. See UPBPlayerMovement::CalcVelocity.
+ * The acceleration is left clamped to MaxSpeed, and scaled to what was added if anything was.
+ */
+template <typename L>
+inline void AccelerateLanes(typename L::FFloat& VX, typename L::FFloat& VY, typename L::FFloat& VZ, typename L::FFloat& AX, typename L::FFloat& AY,
+	typename L::FFloat& AZ, typename L::FFloat MaxSpeed, typename L::FFloat SurfaceFriction, typename L::FMask GroundMove, const FMovementParams& Params,
+	float DeltaTime)
+{
+	using F = typename L::FFloat;
+	using M = typename L::FMask;
+
+	const F Zero = L::Set(0.0f);
+	const F Tolerance = L::Set(KindaSmallNumber);
+	const M Active = L::Not(L::And(L::And(L::Le(L::Abs(AX), Tolerance), L::Le(L::Abs(AY), Tolerance)), L::Le(L::Abs(AZ), Tolerance)));
+	if (!L::Any(Active))
+	{
+		return;
+	}
+
+	// Clamp acceleration to max speed
+	F ClampedX = AX;
+	F ClampedY = AY;
+	ClampToMaxSize2DLanes<L>(ClampedX, ClampedY, MaxSpeed);
+
+	// Find veer
+	const F SizeSq = L::Add(L::Mul(ClampedX, ClampedX), L::Mul(ClampedY, ClampedY));
+	const M HasDirection = L::Not(L::Lt(SizeSq, L::Set(SmallNumber)));
+	const F InvSize = L::Div(L::Set(1.0f), L::Sqrt(SizeSq));
+	const F DirX = L::Select(HasDirection, L::Mul(ClampedX, InvSize), Zero);
+	const F DirY = L::Select(HasDirection, L::Mul(ClampedY, InvSize), Zero);
+	const F Veer = L::Add(L::Mul(VX, DirX), L::Mul(VY, DirY));
+
+	// Get add speed with air speed cap
+	F CappedX = ClampedX;
+	F CappedY = ClampedY;
+	ClampToMaxSize2DLanes<L>(CappedX, CappedY, L::Set(Params.AirSpeedCap));
+	CappedX = L::Select(GroundMove, ClampedX, CappedX);
+	CappedY = L::Select(GroundMove, ClampedY, CappedY);
+	const F AddSpeed = L::Sub(L::Sqrt(L::Add(L::Mul(CappedX, CappedX), L::Mul(CappedY, CappedY))), Veer);
+	const M Accelerate = L::And(Active, L::Gt(AddSpeed, Zero));
+
+	// Apply acceleration
+	const F Multiplier = L::Select(GroundMove, L::Set(Params.GroundAccelerationMultiplier), L::Set(Params.AirAccelerationMultiplier));
+	const F Scale = L::Mul(L::Mul(Multiplier, SurfaceFriction), L::Set(DeltaTime));
+	F AddX = L::Mul(ClampedX, Scale);
+	F AddY = L::Mul(ClampedY, Scale);
+	const F AddZ = L::Mul(AZ, Scale);
+	ClampToMaxSize2DLanes<L>(AddX, AddY, AddSpeed);
+
+	VX = L::Select(Accelerate, L::Add(VX, AddX), VX);
+	VY = L::Select(Accelerate, L::Add(VY, AddY), VY);
+	VZ = L::Select(Accelerate, L::Add(VZ, AddZ), VZ);
+	AX = L::Select(Accelerate, AddX, L::Select(Active, ClampedX, AX));
+	AY = L::Select(Accelerate, AddY, L::Select(Active, ClampedY, AY));
+	AZ = L::Select(Accelerate, AddZ, AZ);
+}
+
+/** Dynamic step height, for allowing sliding on a slope when at a high speed. See UPBPlayerMovement::CalcVelocity. */
+template <typename L>
+inline void StepHeightLanes(typename L::FFloat VX, typename L::FFloat VY, typename L::FFloat SurfaceFriction, typename L::FMask Falling,
+	const FMovementParams& Params, typename L::FFloat& OutMaxStepHeight, typename L::FFloat& OutWalkableFloorZ)
+{
+	using F = typename L::FFloat;
+	using M = typename L::FMask;
+
+	const F Zero = L::Set(0.0f);
+	const F One = L::Set(1.0f);
+	const F DefaultStepHeight = L::Set(Params.DefaultMaxStepHeight);
+	const F DefaultFloorZ = L::Set(Params.DefaultWalkableFloorZ);
+
+	// If we're crouching or not sliding, just use max
+	const F SpeedSq = L::Add(L::Mul(VX, VX), L::Mul(VY, VY));
+	const M Slow = L::Le(SpeedSq, L::Set(Params.MaxWalkSpeedCrouched * Params.MaxWalkSpeedCrouched));
+
+	// Scale step/ramp height down the faster we go
+	const F SpeedScale = L::Div(L::Sub(L::Sqrt(SpeedSq), L::Set(Params.SpeedMultMin)), L::Set(Params.SpeedMultMax - Params.SpeedMultMin));
+	F SpeedMultiplier = L::Min(L::Max(SpeedScale, Zero), One);
+	SpeedMultiplier = L::Mul(SpeedMultiplier, SpeedMultiplier);
+	// If we're on ground, factor in friction.
+	SpeedMultiplier = L::Select(Falling, SpeedMultiplier, L::Max(L::Mul(L::Sub(One, SurfaceFriction), SpeedMultiplier), Zero));
+
+	const F StepHeight = L::Min(L::Max(L::Mul(DefaultStepHeight, L::Sub(One, SpeedMultiplier)), L::Set(Params.MinStepHeight)), DefaultStepHeight);
+	const F FloorZ = L::Min(L::Max(L::Sub(DefaultFloorZ, L::Mul(L::Set(0.5f), L::Sub(L::Set(0.4f), SpeedMultiplier))), DefaultFloorZ), L::Set(0.9848f));
+	OutMaxStepHeight = L::Select(Slow, DefaultStepHeight, StepHeight);
+	OutWalkableFloorZ = L::Select(Slow, DefaultFloorZ, FloorZ);
+}
+
+/** Brake, accelerate, cap the speed and find the step height for Width characters of the batch, starting at Index */
+template <typename L>
+inline void StepBatchLanes(const FCharacterBatch& Batch, const FMovementParams& Params, float DeltaTime, int32_t Index)
+{
+	using F = typename L::FFloat;
+	using M = typename L::FMask;
+
+	F VX = L::Load(Batch.VelocityX + Index);
+	F VY = L::Load(Batch.VelocityY + Index);
+	F VZ = L::Load(Batch.VelocityZ + Index);
+	F AX = L::Load(Batch.AccelerationX + Index);
+	F AY = L::Load(Batch.AccelerationY + Index);
+	F AZ = L::Load(Batch.AccelerationZ + Index);
+	const F MaxSpeed = L::Load(Batch.MaxSpeed + Index);
+	const F SurfaceFriction = L::Load(Batch.SurfaceFriction + Index);
+	const M GroundMove = L::LoadFlag(Batch.Flags + Index, ECharacterFlags::GroundMove);
+	const M Braking = L::LoadFlag(Batch.Flags + Index, ECharacterFlags::ApplyBraking);
+	const M Falling = L::LoadFlag(Batch.Flags + Index, ECharacterFlags::Falling);
+
+	BrakeLanes<L>(VX, VY, VZ, Braking, L::Mul(L::Set(Params.Friction), SurfaceFriction), Params.BrakingDeceleration, Params.BrakingFrictionFactor, DeltaTime);
+	AccelerateLanes<L>(VX, VY, VZ, AX, AY, AZ, MaxSpeed, SurfaceFriction, GroundMove, Params, DeltaTime);
+	ClampToMaxSize2DLanes<L>(VX, VY, L::Set(Params.MaxHorizontalSpeed));
+
+	F StepHeight;
+	F FloorZ;
+	StepHeightLanes<L>(VX, VY, SurfaceFriction, Falling, Params, StepHeight, FloorZ);
+
+	L::Store(Batch.VelocityX + Index, VX);
+	L::Store(Batch.VelocityY + Index, VY);
+	L::Store(Batch.VelocityZ + Index, VZ);
+	L::Store(Batch.AccelerationX + Index, AX);
+	L::Store(Batch.AccelerationY + Index, AY);
+	L::Store(Batch.AccelerationZ + Index, AZ);
+	L::Store(Batch.MaxStepHeight + Index, StepHeight);
+	L::Store(Batch.WalkableFloorZ + Index, FloorZ);
+}
+
+/** Step every character of the batch with the widest lanes available, finishing the remainder one at a time */
+inline void StepBatch(const FCharacterBatch& Batch, const FMovementParams& Params, float DeltaTime)
+{
+	int32_t Index = 0;
+#if PB_MOVEMENT_KERNEL_AVX2
+	for (; Index + FAVX2Lanes::Width <= Batch.Num; Index += FAVX2Lanes::Width)
+	{
+		StepBatchLanes<FAVX2Lanes>(Batch, Params, DeltaTime, Index);
+	}
+#endif
+#if PB_MOVEMENT_KERNEL_SSE
+	for (; Index + FSSELanes::Width <= Batch.Num; Index += FSSELanes::Width)
+	{
+		StepBatchLanes<FSSELanes>(Batch, Params, DeltaTime, Index);
+	}
+#endif
+	for (; Index < Batch.Num; Index++)
+	{
+		StepBatchLanes<FScalarLanes>(Batch, Params, DeltaTime, Index);
+	}
+}
+
+/** Apply friction to the velocity of a single character. Friction already includes the surface friction. */
+inline void ApplyBraking(FKernelVector& Velocity, float Friction, float BrakingDeceleration, float BrakingFrictionFactor, float DeltaTime)
+{
+	BrakeLanes<FScalarLanes>(Velocity.X, Velocity.Y, Velocity.Z, true, Friction, BrakingDeceleration, BrakingFrictionFactor, DeltaTime);
+}
+
+/** Add the input acceleration of a single character to its velocity */
+inline void ApplyAcceleration(FKernelVector& Velocity, FKernelVector& Acceleration, float MaxSpeed, float SurfaceFriction, bool bIsGroundMove,
+	const FMovementParams& Params, float DeltaTime)
+{
+	AccelerateLanes<FScalarLanes>(Velocity.X, Velocity.Y, Velocity.Z, Acceleration.X, Acceleration.Y, Acceleration.Z, MaxSpeed, SurfaceFriction, bIsGroundMove,
+		Params, DeltaTime);
+}
+
+/** Clamp the horizontal speed of a single character to MaxHorizontalSpeed */
+inline void ClampHorizontalSpeed(FKernelVector& Velocity, const FMovementParams& Params)
+{
+	ClampToMaxSize2DLanes<FScalarLanes>(Velocity.X, Velocity.Y, Params.MaxHorizontalSpeed);
+}
+
+/** Find the step height and walkable floor Z of a single character for its velocity */
+inline void ComputeStepHeight(const FKernelVector& Velocity, float SurfaceFriction, bool bFalling, const FMovementParams& Params, float& OutMaxStepHeight,
+	float& OutWalkableFloorZ)
+{
+	StepHeightLanes<FScalarLanes>(Velocity.X, Velocity.Y, SurfaceFriction, bFalling, Params, OutMaxStepHeight, OutWalkableFloorZ);
+}
+} // namespace PBMovementKernel
@@ -4,8 +4,11 @@
 
 #include "CoreMinimal.h"
 
+#include "Engine/EngineTypes.h"
 #include "GameFramework/CharacterMovementComponent.h"
 
+#include "Character/PBMovementKernel.h"
+
 #include "PBPlayerMovement.generated.h"
 
 // Crouch Timings (in seconds)
@@ -14,7 +17,38 @@
 #define MOVEMENT_DEFAULT_UNCROUCHTIME 0.2f
 #define MOVEMENT_DEFAULT_UNCROUCHJUMPTIME 0.8f
 
+class UAudioComponent;
 class USoundCue;
+class UPhysicalMaterial;
+
+/** The move step sounds of a physical surface, resolved once so that playing them doesn't look anything up */
+USTRUCT()
+struct PBCHARACTERMOVEMENT_API FPBSurfaceSounds
+{
+	GENERATED_BODY()
+
+	/** If the character has move step sounds for this surface */
+	UPROPERTY()
+	bool bValid = false;
+
+	UPROPERTY()
+	TArray<USoundCue*> StepLeftSounds;
+
+	UPROPERTY()
+	TArray<USoundCue*> StepRightSounds;
+
+	UPROPERTY()
+	TArray<USoundCue*> JumpSounds;
+
+	UPROPERTY()
+	TArray<USoundCue*> LandSounds;
+
+	UPROPERTY()
+	float WalkVolume = 0.0f;
+
+	UPROPERTY()
+	float SprintVolume = 0.0f;
+};
 
 UCLASS()
 class PBCHARACTERMOVEMENT_API UPBPlayerMovement : public UCharacterMovementComponent
@@ -92,6 +126,36 @@ protected:
 
 	bool bAppliedFriction;
 
+	/** MaxStepHeight of the class defaults, which the dynamic step height scales down from */
+	float DefaultMaxStepHeight;
+
+	/** Walkable floor Z of the class defaults, which the dynamic step height scales up from */
+	float DefaultWalkableFloorZ;
+
+	/** The most movement sounds this character plays at once. Starting another one cuts off the oldest. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Character Movement: Sounds", meta = (ClampMin = "1", UIMin = "1"))
+	int32 MaxMoveSoundVoices;
+
+	/** Audio components movement sounds are played on, reused round-robin. Created on BeginPlay. */
+	UPROPERTY(Transient)
+	TArray<UAudioComponent*> MoveSoundVoices;
+
+	/** The voice the next movement sound is played on */
+	int32 NextMoveSoundVoice;
+
+	/** Move step sounds of the owning character, indexed by EPhysicalSurface. Built on BeginPlay. */
+	UPROPERTY(Transient)
+	FPBSurfaceSounds SurfaceSounds[SurfaceType_Max];
+
+	/** The physical material the floor surface was last resolved from */
+	TWeakObjectPtr<UPhysicalMaterial> FloorPhysMaterial;
+
+	/** Surface friction of the floor, scaling acceleration and braking */
+	float FloorFriction;
+
+	/** Surface type of the floor, as of the last time it was resolved */
+	TEnumAsByte<EPhysicalSurface> FloorSurface;
+
 public:
 	/** Print pos and vel (Source: cl_showpos) */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Character Movement (General Settings)")
@@ -103,6 +167,8 @@ public:
 
 	UPBPlayerMovement();
 
+	virtual void BeginPlay() override;
+
 	// Overrides for Source-like movement
 	void TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 	virtual void CalcVelocity(float DeltaTime, float Friction, bool bFluid, float BrakingDeceleration) override;
@@ -136,4 +202,22 @@ public:
 private:
 	/** Plays sound effect according to movement and surface */
 	void PlayMoveSound(float DeltaTime);
+
+	/** Resolves the move step sounds of every surface from the owning character */
+	void BuildSurfaceSounds();
+
+	/** Creates the audio components movement sounds are played on, if there are any sounds to play */
+	void BuildMoveSoundVoices();
+
+	/** Plays a movement sound at the given volume on the next voice */
+	void PlayMoveSoundCue(USoundCue* Sound, float Volume);
+
+	/** Get the move step sounds of a surface, or of the default surface if it has none */
+	const FPBSurfaceSounds& GetSurfaceSounds(EPhysicalSurface Surface) const;
+
+	/** Gathers the movement tuning for PBMovementKernel. Friction and braking deceleration are the ones for walking. */
+	PBMovementKernel::FMovementParams MakeKernelParams() const;
+
+	/** Updates FloorFriction and FloorSurface for the physical material of the hit, if it changed since the last call */
+	void ResolveFloorSurface(const FHitResult& Hit);
 };
@@ -0,0 +1,148 @@
+// Copyright 2017-2019 Project Borealis
+
+// Times stepping many characters with the scalar functions of PBMovementKernel, one at a time like the component does, against StepBatch.
+// Usage: PBMovementKernelBenchmark [Characters] [Steps]
+
+#include "Character/PBMovementKernel.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace PBMovementKernel;
+
+namespace
+{
+struct FCharacters
+{
+	std::vector<float> VelocityX, VelocityY, VelocityZ, AccelerationX, AccelerationY, AccelerationZ;
+	std::vector<float> MaxSpeed, SurfaceFriction, MaxStepHeight, WalkableFloorZ;
+	std::vector<uint32_t> Flags;
+
+	explicit FCharacters(int32_t Num)
+		: VelocityX(Num), VelocityY(Num), VelocityZ(Num), AccelerationX(Num), AccelerationY(Num), AccelerationZ(Num), MaxSpeed(Num),
+		  SurfaceFriction(Num), MaxStepHeight(Num), WalkableFloorZ(Num), Flags(Num)
+	{
+		std::mt19937 Engine(1234);
+		std::uniform_real_distribution<float> Unit(-1.0f, 1.0f);
+		for (int32_t Index = 0; Index < Num; Index++)
+		{
+			VelocityX[Index] = Unit(Engine) * 600.0f;
+			VelocityY[Index] = Unit(Engine) * 600.0f;
+			VelocityZ[Index] = 0.0f;
+			MaxSpeed[Index] = Index % 3 == 0 ? 609.6f : 361.9f;
+			SurfaceFriction[Index] = 1.0f;
+			Flags[Index] = Index % 8 == 0 ? ECharacterFlags::Falling : (ECharacterFlags::GroundMove | ECharacterFlags::ApplyBraking);
+		}
+	}
+
+	/** New input every step, so the batch can't settle into the early outs */
+	void SetInput(int32_t Step)
+	{
+		for (size_t Index = 0; Index < AccelerationX.size(); Index++)
+		{
+			const bool bForward = ((Index + Step / 30) & 1) != 0;
+			AccelerationX[Index] = bForward ? 857.25f : 0.0f;
+			AccelerationY[Index] = bForward ? 0.0f : 857.25f;
+			AccelerationZ[Index] = 0.0f;
+		}
+	}
+
+	FCharacterBatch MakeBatch()
+	{
+		FCharacterBatch Batch;
+		Batch.Num = (int32_t)VelocityX.size();
+		Batch.VelocityX = VelocityX.data();
+		Batch.VelocityY = VelocityY.data();
+		Batch.VelocityZ = VelocityZ.data();
+		Batch.AccelerationX = AccelerationX.data();
+		Batch.AccelerationY = AccelerationY.data();
+		Batch.AccelerationZ = AccelerationZ.data();
+		Batch.MaxSpeed = MaxSpeed.data();
+		Batch.SurfaceFriction = SurfaceFriction.data();
+		Batch.Flags = Flags.data();
+		Batch.MaxStepHeight = MaxStepHeight.data();
+		Batch.WalkableFloorZ = WalkableFloorZ.data();
+		return Batch;
+	}
+};
+
+/** Characters as the component keeps them, one struct per character */
+struct FCharacter
+{
+	FKernelVector Velocity;
+	FKernelVector Acceleration;
+	float MaxSpeed;
+	float SurfaceFriction;
+	uint32_t Flags;
+	float MaxStepHeight;
+	float WalkableFloorZ;
+};
+
+template <typename FFunction>
+double TimeNanosecondsPerCharacter(int32_t Num, int32_t Steps, FFunction&& Function)
+{
+	const auto Start = std::chrono::steady_clock::now();
+	for (int32_t Step = 0; Step < Steps; Step++)
+	{
+		Function(Step);
+	}
+	const auto End = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(End - Start).count() / ((double)Num * Steps);
+}
+} // namespace
+
+int main(int ArgC, char** ArgV)
+{
+	const int32_t Num = ArgC > 1 ? std::atoi(ArgV[1]) : 4096;
+	const int32_t Steps = ArgC > 2 ? std::atoi(ArgV[2]) : 2000;
+	const FMovementParams Params;
+	const float DeltaTime = 1.0f / 60.0f;
+
+	FCharacters Source(Num);
+	std::vector<FCharacter> Characters(Num);
+	for (int32_t Index = 0; Index < Num; Index++)
+	{
+		Characters[Index] = {{Source.VelocityX[Index], Source.VelocityY[Index], Source.VelocityZ[Index]}, {0.0f, 0.0f, 0.0f}, Source.MaxSpeed[Index],
+			Source.SurfaceFriction[Index], Source.Flags[Index], 0.0f, 0.0f};
+	}
+
+	const double Scalar = TimeNanosecondsPerCharacter(Num, Steps, [&](int32_t Step) {
+		Source.SetInput(Step);
+		for (int32_t Index = 0; Index < Num; Index++)
+		{
+			FCharacter& Character = Characters[Index];
+			Character.Acceleration = {Source.AccelerationX[Index], Source.AccelerationY[Index], Source.AccelerationZ[Index]};
+			if (Character.Flags & ECharacterFlags::ApplyBraking)
+			{
+				ApplyBraking(Character.Velocity, Params.Friction * Character.SurfaceFriction, Params.BrakingDeceleration, Params.BrakingFrictionFactor, DeltaTime);
+			}
+			ApplyAcceleration(Character.Velocity, Character.Acceleration, Character.MaxSpeed, Character.SurfaceFriction,
+				(Character.Flags & ECharacterFlags::GroundMove) != 0, Params, DeltaTime);
+			ClampHorizontalSpeed(Character.Velocity, Params);
+			ComputeStepHeight(Character.Velocity, Character.SurfaceFriction, (Character.Flags & ECharacterFlags::Falling) != 0, Params,
+				Character.MaxStepHeight, Character.WalkableFloorZ);
+		}
+	});
+
+	FCharacterBatch Batch = Source.MakeBatch();
+	const double Batched = TimeNanosecondsPerCharacter(Num, Steps, [&](int32_t Step) {
+		Source.SetInput(Step);
+		StepBatch(Batch, Params, DeltaTime);
+	});
+
+	// Keep the results alive so the steps can't be optimized out
+	double Checksum = 0.0;
+	for (int32_t Index = 0; Index < Num; Index++)
+	{
+		Checksum += Characters[Index].Velocity.X + Source.VelocityX[Index];
+	}
+
+	std::printf("%d characters, %d steps, %s lanes\n", Num, Steps, PB_MOVEMENT_KERNEL_AVX2 ? "AVX2" : PB_MOVEMENT_KERNEL_SSE ? "SSE" : "scalar");
+	std::printf("  scalar: %8.2f ns per character step\n", Scalar);
+	std::printf("  batch:  %8.2f ns per character step (%.2fx)\n", Batched, Scalar / Batched);
+	std::printf("  checksum %f\n", Checksum);
+	return 0;
+}
@@ -0,0 +1,397 @@
+// Copyright 2017-2019 Project Borealis
+
+// Checks PBMovementKernel against the math UPBPlayerMovement ran before it was moved into the kernel, and the batch against the scalar functions.
+
+#include "Character/PBMovementKernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace PBMovementKernel;
+
+namespace
+{
+int32_t Failures = 0;
+
+#define CHECK(Condition) \
+	do \
+	{ \
+		if (!(Condition)) \
+		{ \
+			std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #Condition); \
+			Failures++; \
+		} \
+	} while (0)
+
+bool NearlyEqual(float A, float B, float Tolerance = 1.e-4f)
+{
+	return std::fabs(A - B) <= Tolerance * std::max(1.0f, std::max(std::fabs(A), std::fabs(B)));
+}
+
+bool NearlyEqual(const FKernelVector& A, const FKernelVector& B)
+{
+	return NearlyEqual(A.X, B.X) && NearlyEqual(A.Y, B.Y) && NearlyEqual(A.Z, B.Z);
+}
+
+bool SameBits(float A, float B)
+{
+	return A == B || (std::isnan(A) && std::isnan(B));
+}
+
+/** The FVector functions the component used, as the engine implements them */
+struct FReferenceVector
+{
+	float X, Y, Z;
+
+	float Size2D() const { return std::sqrt(X * X + Y * Y); }
+	float SizeSquared() const { return X * X + Y * Y + Z * Z; }
+
+	FReferenceVector GetSafeNormal() const
+	{
+		const float SquareSum = SizeSquared();
+		if (SquareSum < SmallNumber)
+		{
+			return {0.0f, 0.0f, 0.0f};
+		}
+		const float Scale = 1.0f / std::sqrt(SquareSum);
+		return {X * Scale, Y * Scale, Z * Scale};
+	}
+
+	FReferenceVector GetSafeNormal2D() const
+	{
+		const float SquareSum = X * X + Y * Y;
+		if (SquareSum < SmallNumber)
+		{
+			return {0.0f, 0.0f, 0.0f};
+		}
+		const float Scale = 1.0f / std::sqrt(SquareSum);
+		return {X * Scale, Y * Scale, 0.0f};
+	}
+
+	FReferenceVector GetClampedToMaxSize2D(float MaxSize) const
+	{
+		if (MaxSize < KindaSmallNumber)
+		{
+			return {0.0f, 0.0f, Z};
+		}
+		const float VSq2D = X * X + Y * Y;
+		if (VSq2D > MaxSize * MaxSize)
+		{
+			const float Scale = MaxSize * (1.0f / std::sqrt(VSq2D));
+			return {X * Scale, Y * Scale, Z};
+		}
+		return *this;
+	}
+
+	bool IsNearlyZero() const { return std::fabs(X) <= KindaSmallNumber && std::fabs(Y) <= KindaSmallNumber && std::fabs(Z) <= KindaSmallNumber; }
+};
+
+FReferenceVector ToReference(const FKernelVector& Vector)
+{
+	return {Vector.X, Vector.Y, Vector.Z};
+}
+
+FKernelVector FromReference(const FReferenceVector& Vector)
+{
+	return {Vector.X, Vector.Y, Vector.Z};
+}
+
+/** UPBPlayerMovement::ApplyVelocityBraking before the kernel */
+void ReferenceBraking(FReferenceVector& Velocity, float DeltaTime, float Friction, float BrakingDeceleration, float BrakingFrictionFactor)
+{
+	const float Speed = Velocity.Size2D();
+	if (Speed <= 0.1f)
+	{
+		return;
+	}
+
+	const float FrictionFactor = std::max(0.0f, BrakingFrictionFactor);
+	Friction = std::max(0.0f, Friction * FrictionFactor);
+	BrakingDeceleration = std::max(BrakingDeceleration, Speed);
+	BrakingDeceleration = std::max(0.0f, BrakingDeceleration);
+	if (std::fabs(Friction) <= SmallNumber || BrakingDeceleration == 0.0f)
+	{
+		return;
+	}
+
+	const FReferenceVector OldVel = Velocity;
+	const FReferenceVector Normal = Velocity.GetSafeNormal();
+	const float Brake = Friction * BrakingDeceleration;
+	Velocity = {Velocity.X - Brake * Normal.X * DeltaTime, Velocity.Y - Brake * Normal.Y * DeltaTime, Velocity.Z - Brake * Normal.Z * DeltaTime};
+
+	if (Velocity.X * OldVel.X + Velocity.Y * OldVel.Y + Velocity.Z * OldVel.Z <= 0.0f)
+	{
+		Velocity = {0.0f, 0.0f, 0.0f};
+		return;
+	}
+	if (Velocity.SizeSquared() <= KindaSmallNumber)
+	{
+		Velocity = {0.0f, 0.0f, 0.0f};
+	}
+}
+
+/** The input acceleration of UPBPlayerMovement::CalcVelocity before the kernel */
+void ReferenceAcceleration(FReferenceVector& Velocity, FReferenceVector& Acceleration, float MaxSpeed, float SurfaceFriction, bool bIsGroundMove,
+	const FMovementParams& Params, float DeltaTime)
+{
+	if (Acceleration.IsNearlyZero())
+	{
+		return;
+	}
+	Acceleration = Acceleration.GetClampedToMaxSize2D(MaxSpeed);
+	const FReferenceVector AccelDir = Acceleration.GetSafeNormal2D();
+	const float Veer = Velocity.X * AccelDir.X + Velocity.Y * AccelDir.Y;
+	const float AddSpeed = (bIsGroundMove ? Acceleration : Acceleration.GetClampedToMaxSize2D(Params.AirSpeedCap)).Size2D() - Veer;
+	if (AddSpeed > 0.0f)
+	{
+		const float AccelerationMultiplier = bIsGroundMove ? Params.GroundAccelerationMultiplier : Params.AirAccelerationMultiplier;
+		const float Scale = AccelerationMultiplier * SurfaceFriction * DeltaTime;
+		Acceleration = {Acceleration.X * Scale, Acceleration.Y * Scale, Acceleration.Z * Scale};
+		Acceleration = Acceleration.GetClampedToMaxSize2D(AddSpeed);
+		Velocity = {Velocity.X + Acceleration.X, Velocity.Y + Acceleration.Y, Velocity.Z + Acceleration.Z};
+	}
+}
+
+/** The dynamic step height of UPBPlayerMovement::CalcVelocity before the kernel */
+void ReferenceStepHeight(const FReferenceVector& Velocity, float SurfaceFriction, bool bFalling, const FMovementParams& Params, float& OutMaxStepHeight,
+	float& OutWalkableFloorZ)
+{
+	const float SpeedSq = Velocity.X * Velocity.X + Velocity.Y * Velocity.Y;
+	if (SpeedSq <= Params.MaxWalkSpeedCrouched * Params.MaxWalkSpeedCrouched)
+	{
+		OutMaxStepHeight = Params.DefaultMaxStepHeight;
+		OutWalkableFloorZ = Params.DefaultWalkableFloorZ;
+		return;
+	}
+	const float Speed = std::sqrt(SpeedSq);
+	const float SpeedScale = (Speed - Params.SpeedMultMin) / (Params.SpeedMultMax - Params.SpeedMultMin);
+	float SpeedMultiplier = std::min(std::max(SpeedScale, 0.0f), 1.0f);
+	SpeedMultiplier *= SpeedMultiplier;
+	if (!bFalling)
+	{
+		SpeedMultiplier = std::max((1.0f - SurfaceFriction) * SpeedMultiplier, 0.0f);
+	}
+	OutMaxStepHeight = std::min(std::max(Params.DefaultMaxStepHeight * (1.0f - SpeedMultiplier), Params.MinStepHeight), Params.DefaultMaxStepHeight);
+	OutWalkableFloorZ =
+		std::min(std::max(Params.DefaultWalkableFloorZ - (0.5f * (0.4f - SpeedMultiplier)), Params.DefaultWalkableFloorZ), 0.9848f);
+}
+
+struct FRandom
+{
+	std::mt19937 Engine{1234};
+
+	float Range(float Min, float Max) { return std::uniform_real_distribution<float>(Min, Max)(Engine); }
+	bool Chance(float Probability) { return Range(0.0f, 1.0f) < Probability; }
+
+	FKernelVector Vector(float Size)
+	{
+		// Some exactly zero and tiny components, to hit the early outs
+		if (Chance(0.1f))
+		{
+			return {0.0f, 0.0f, Chance(0.5f) ? 0.0f : Range(-Size, Size)};
+		}
+		if (Chance(0.05f))
+		{
+			return {Range(-1.e-5f, 1.e-5f), Range(-1.e-5f, 1.e-5f), 0.0f};
+		}
+		return {Range(-Size, Size), Range(-Size, Size), Chance(0.5f) ? 0.0f : Range(-Size, Size)};
+	}
+};
+
+void TestBrakingMatchesReference()
+{
+	FRandom Random;
+	for (int32_t Iteration = 0; Iteration < 10000; Iteration++)
+	{
+		FKernelVector Velocity = Random.Vector(1500.0f);
+		const float DeltaTime = Random.Range(0.001f, 0.1f);
+		const float Friction = Random.Chance(0.1f) ? 0.0f : Random.Range(0.0f, 8.0f);
+		const float Deceleration = Random.Range(0.0f, 400.0f);
+		const float FrictionFactor = Random.Range(-0.5f, 2.0f);
+
+		FReferenceVector Expected = ToReference(Velocity);
+		ReferenceBraking(Expected, DeltaTime, Friction, Deceleration, FrictionFactor);
+		ApplyBraking(Velocity, Friction, Deceleration, FrictionFactor, DeltaTime);
+		CHECK(NearlyEqual(Velocity, FromReference(Expected)));
+	}
+}
+
+void TestBrakingStopsWithoutReversing()
+{
+	FKernelVector Velocity = {100.0f, 0.0f, 0.0f};
+	ApplyBraking(Velocity, 100.0f, 190.5f, 1.0f, 0.1f);
+	CHECK(Velocity.X == 0.0f && Velocity.Y == 0.0f && Velocity.Z == 0.0f);
+
+	Velocity = {300.0f, 400.0f, 0.0f};
+	ApplyBraking(Velocity, 4.0f, 190.5f, 1.0f, 1.0f / 60.0f);
+	// Braking at the speed itself, since it is above the braking deceleration: 500 * 4 / 60 slower, in the same direction
+	CHECK(NearlyEqual(std::sqrt(Velocity.X * Velocity.X + Velocity.Y * Velocity.Y), 500.0f - 500.0f * 4.0f / 60.0f));
+	CHECK(NearlyEqual(Velocity.X / Velocity.Y, 0.75f));
+}
+
+void TestAccelerationMatchesReference()
+{
+	FRandom Random;
+	const FMovementParams Params;
+	for (int32_t Iteration = 0; Iteration < 10000; Iteration++)
+	{
+		FKernelVector Velocity = Random.Vector(1500.0f);
+		FKernelVector Acceleration = Random.Vector(2000.0f);
+		const float MaxSpeed = Random.Chance(0.05f) ? 0.0f : Random.Range(0.0f, 700.0f);
+		const float SurfaceFriction = Random.Range(0.0f, 1.0f);
+		const bool bIsGroundMove = Random.Chance(0.5f);
+		const float DeltaTime = Random.Range(0.001f, 0.1f);
+
+		FReferenceVector ExpectedVelocity = ToReference(Velocity);
+		FReferenceVector ExpectedAcceleration = ToReference(Acceleration);
+		ReferenceAcceleration(ExpectedVelocity, ExpectedAcceleration, MaxSpeed, SurfaceFriction, bIsGroundMove, Params, DeltaTime);
+		ApplyAcceleration(Velocity, Acceleration, MaxSpeed, SurfaceFriction, bIsGroundMove, Params, DeltaTime);
+		CHECK(NearlyEqual(Velocity, FromReference(ExpectedVelocity)));
+		CHECK(NearlyEqual(Acceleration, FromReference(ExpectedAcceleration)));
+	}
+}
+
+void TestAirSpeedCap()
+{
+	const FMovementParams Params;
+	// Strafing sideways in the air gains speed towards the strafe direction only up to the air speed cap
+	FKernelVector Velocity = {600.0f, 0.0f, 0.0f};
+	for (int32_t Frame = 0; Frame < 600; Frame++)
+	{
+		FKernelVector Acceleration = {0.0f, 857.25f, 0.0f};
+		ApplyAcceleration(Velocity, Acceleration, 361.9f, 1.0f, false, Params, 1.0f / 60.0f);
+	}
+	CHECK(Velocity.X == 600.0f);
+	CHECK(NearlyEqual(Velocity.Y, Params.AirSpeedCap));
+
+	// On the ground the same input accelerates up to the max speed
+	Velocity = {0.0f, 0.0f, 0.0f};
+	for (int32_t Frame = 0; Frame < 600; Frame++)
+	{
+		FKernelVector Acceleration = {0.0f, 857.25f, 0.0f};
+		ApplyAcceleration(Velocity, Acceleration, 361.9f, 1.0f, true, Params, 1.0f / 60.0f);
+	}
+	CHECK(NearlyEqual(Velocity.Y, 361.9f));
+}
+
+void TestStepHeightMatchesReference()
+{
+	FRandom Random;
+	FMovementParams Params;
+	for (int32_t Iteration = 0; Iteration < 10000; Iteration++)
+	{
+		const FKernelVector Velocity = Random.Vector(2000.0f);
+		const float SurfaceFriction = Random.Range(0.0f, 1.0f);
+		const bool bFalling = Random.Chance(0.5f);
+
+		float ExpectedStepHeight;
+		float ExpectedFloorZ;
+		ReferenceStepHeight(ToReference(Velocity), SurfaceFriction, bFalling, Params, ExpectedStepHeight, ExpectedFloorZ);
+		float StepHeight;
+		float FloorZ;
+		ComputeStepHeight(Velocity, SurfaceFriction, bFalling, Params, StepHeight, FloorZ);
+		CHECK(NearlyEqual(StepHeight, ExpectedStepHeight));
+		CHECK(NearlyEqual(FloorZ, ExpectedFloorZ));
+	}
+
+	// Fast enough to slide, on a slippery floor the step height drops to the minimum
+	float StepHeight;
+	float FloorZ;
+	ComputeStepHeight({Params.SpeedMultMax, 0.0f, 0.0f}, 0.0f, false, Params, StepHeight, FloorZ);
+	CHECK(StepHeight == Params.MinStepHeight);
+	CHECK(NearlyEqual(FloorZ, 0.9848f));
+	// And with full friction it doesn't change at all
+	ComputeStepHeight({Params.SpeedMultMax, 0.0f, 0.0f}, 1.0f, false, Params, StepHeight, FloorZ);
+	CHECK(StepHeight == Params.DefaultMaxStepHeight);
+}
+
+void TestBatchMatchesScalar()
+{
+	FRandom Random;
+	const FMovementParams Params;
+	const float DeltaTime = 1.0f / 60.0f;
+	// Not a multiple of any lane width, so the remainder runs one at a time
+	const int32_t Num = 1003;
+
+	std::vector<float> VelocityX(Num), VelocityY(Num), VelocityZ(Num), AccelerationX(Num), AccelerationY(Num), AccelerationZ(Num);
+	std::vector<float> MaxSpeed(Num), SurfaceFriction(Num), MaxStepHeight(Num), WalkableFloorZ(Num);
+	std::vector<uint32_t> Flags(Num);
+	for (int32_t Index = 0; Index < Num; Index++)
+	{
+		const FKernelVector Velocity = Random.Vector(1500.0f);
+		const FKernelVector Acceleration = Random.Vector(2000.0f);
+		VelocityX[Index] = Velocity.X;
+		VelocityY[Index] = Velocity.Y;
+		VelocityZ[Index] = Velocity.Z;
+		AccelerationX[Index] = Acceleration.X;
+		AccelerationY[Index] = Acceleration.Y;
+		AccelerationZ[Index] = Acceleration.Z;
+		MaxSpeed[Index] = Random.Range(100.0f, 700.0f);
+		SurfaceFriction[Index] = Random.Range(0.0f, 1.0f);
+		const bool bGround = Random.Chance(0.7f);
+		Flags[Index] = bGround ? (ECharacterFlags::GroundMove | (Random.Chance(0.9f) ? ECharacterFlags::ApplyBraking : 0u)) : ECharacterFlags::Falling;
+	}
+
+	FCharacterBatch Batch;
+	Batch.Num = Num;
+	Batch.VelocityX = VelocityX.data();
+	Batch.VelocityY = VelocityY.data();
+	Batch.VelocityZ = VelocityZ.data();
+	Batch.AccelerationX = AccelerationX.data();
+	Batch.AccelerationY = AccelerationY.data();
+	Batch.AccelerationZ = AccelerationZ.data();
+	Batch.MaxSpeed = MaxSpeed.data();
+	Batch.SurfaceFriction = SurfaceFriction.data();
+	Batch.Flags = Flags.data();
+	Batch.MaxStepHeight = MaxStepHeight.data();
+	Batch.WalkableFloorZ = WalkableFloorZ.data();
+
+	// Step every character on its own with the scalar functions, the way the component does
+	std::vector<FKernelVector> ExpectedVelocity(Num), ExpectedAcceleration(Num);
+	std::vector<float> ExpectedStepHeight(Num), ExpectedFloorZ(Num);
+	for (int32_t Index = 0; Index < Num; Index++)
+	{
+		FKernelVector Velocity = {VelocityX[Index], VelocityY[Index], VelocityZ[Index]};
+		FKernelVector Acceleration = {AccelerationX[Index], AccelerationY[Index], AccelerationZ[Index]};
+		if (Flags[Index] & ECharacterFlags::ApplyBraking)
+		{
+			ApplyBraking(Velocity, Params.Friction * SurfaceFriction[Index], Params.BrakingDeceleration, Params.BrakingFrictionFactor, DeltaTime);
+		}
+		ApplyAcceleration(Velocity, Acceleration, MaxSpeed[Index], SurfaceFriction[Index], (Flags[Index] & ECharacterFlags::GroundMove) != 0, Params, DeltaTime);
+		ClampHorizontalSpeed(Velocity, Params);
+		ComputeStepHeight(Velocity, SurfaceFriction[Index], (Flags[Index] & ECharacterFlags::Falling) != 0, Params, ExpectedStepHeight[Index], ExpectedFloorZ[Index]);
+		ExpectedVelocity[Index] = Velocity;
+		ExpectedAcceleration[Index] = Acceleration;
+	}
+
+	StepBatch(Batch, Params, DeltaTime);
+
+	int32_t Mismatches = 0;
+	for (int32_t Index = 0; Index < Num; Index++)
+	{
+		const bool bSame = SameBits(VelocityX[Index], ExpectedVelocity[Index].X) && SameBits(VelocityY[Index], ExpectedVelocity[Index].Y) &&
+			SameBits(VelocityZ[Index], ExpectedVelocity[Index].Z) && SameBits(AccelerationX[Index], ExpectedAcceleration[Index].X) &&
+			SameBits(AccelerationY[Index], ExpectedAcceleration[Index].Y) && SameBits(AccelerationZ[Index], ExpectedAcceleration[Index].Z) &&
+			SameBits(MaxStepHeight[Index], ExpectedStepHeight[Index]) && SameBits(WalkableFloorZ[Index], ExpectedFloorZ[Index]);
+		Mismatches += bSame ? 0 : 1;
+	}
+	CHECK(Mismatches == 0);
+}
+} // namespace
+
+int main()
+{
+	TestBrakingMatchesReference();
+	TestBrakingStopsWithoutReversing();
+	TestAccelerationMatchesReference();
+	TestAirSpeedCap();
+	TestStepHeightMatchesReference();
+	TestBatchMatchesScalar();
+
+	std::printf("PBMovementKernel (%s): %d failure%s\n", PB_MOVEMENT_KERNEL_AVX2 ? "AVX2" : PB_MOVEMENT_KERNEL_SSE ? "SSE" : "scalar", Failures,
+		Failures == 1 ? "" : "s");
+	return Failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "MovementBenchmark.h"
+#include "Misc/CommandLine.h"
+#include "Misc/Parse.h"
+
+FMovementBenchmarkRecorder* FMovementBenchmarkRecorder::Active = nullptr;
+bool FMovementBenchmarkMalloc::bInstalled = false;
+thread_local uint64 FMovementBenchmarkMalloc::ThreadAllocations = 0;
+volatile int64 FMovementBenchmarkMalloc::LiveBytes = 0;
+
+void FMovementBenchmarkRecorder::Start() {
+	check(IsInGameThread());
+	check(Active == nullptr || Active == this);
+	Active = this;
+}
+
+void FMovementBenchmarkRecorder::Stop() {
+	check(IsInGameThread());
+	if (Active == this) {
+		Active = nullptr;
+	}
+}
+
+void FMovementBenchmarkRecorder::AddSample(FName Scope, uint64 Cycles, uint64 InAllocations) {
+	Allocations.FindOrAdd(Scope) += InAllocations;
+	Samples.FindOrAdd(Scope).Add(Cycles);
+}
+
+TArray<TPair<FName, FMovementBenchmarkRecorder::FSummary>> FMovementBenchmarkRecorder::Summarize() const {
+	TArray<TPair<FName, FSummary>> Result;
+
+	for (const TPair<FName, TArray<uint64>>& Scope : Samples) {
+		if (Scope.Value.Num() == 0) {
+			continue;
+		}
+
+		TArray<uint64> Sorted = Scope.Value;
+		Sorted.Sort();
+		// Nearest-rank percentile.
+		auto Percentile = [&Sorted](double P) {
+			const int32 Rank = FMath::Clamp(FMath::CeilToInt(P * Sorted.Num()) - 1, 0, Sorted.Num() - 1);
+			return FPlatformTime::ToMilliseconds64(Sorted[Rank]) * 1000.0;
+		};
+
+		uint64 Total = 0;
+		for (uint64 Cycles : Sorted) {
+			Total += Cycles;
+		}
+
+		FSummary Summary;
+		Summary.Count = Sorted.Num();
+		Summary.Mean = FPlatformTime::ToMilliseconds64(Total) * 1000.0 / Sorted.Num();
+		Summary.P50 = Percentile(0.5);
+		Summary.P99 = Percentile(0.99);
+		Summary.P999 = Percentile(0.999);
+		Summary.Max = FPlatformTime::ToMilliseconds64(Sorted.Last()) * 1000.0;
+		Summary.Allocations = Allocations.FindRef(Scope.Key);
+		Result.Emplace(Scope.Key, Summary);
+	}
+
+	Result.Sort([](const TPair<FName, FSummary>& A, const TPair<FName, FSummary>& B) { return A.Key.LexicalLess(B.Key); });
+	return Result;
+}
+
+void FMovementBenchmarkMalloc::Install() {
+	check(IsInGameThread());
+	if (!bInstalled) {
+		// Worker threads may already be allocating. The proxy is fully built before it is published, and frees of blocks allocated
+		// before the swap only skew LiveBytes by a constant, which readings compared with each other don't see.
+		FMalloc* Proxy = new FMovementBenchmarkMalloc(GMalloc);
+		FPlatformAtomics::InterlockedExchangePtr((void**)&GMalloc, Proxy);
+		bInstalled = true;
+	}
+}
+
+void FMovementBenchmarkMalloc::InstallIfRequested() {
+	const TCHAR* CommandLine = FCommandLine::Get();
+	FString Commandlet;
+	if (FParse::Value(CommandLine, TEXT("run="), Commandlet) && Commandlet == TEXT("MovementBenchmark")
+		&& (FParse::Param(CommandLine, TEXT("CountAllocations")) || FParse::Param(CommandLine, TEXT("NPC")))) {
+		Install();
+	}
+}
+
+void FMovementBenchmarkMalloc::TrackLiveBytes(void* Allocation, int64 Sign) {
+	// The inner allocator either always knows its sizes or never does, so allocations and frees always balance.
+	SIZE_T Size = 0;
+	if (Allocation && Inner->GetAllocationSize(Allocation, Size)) {
+		FPlatformAtomics::InterlockedAdd(&LiveBytes, Sign * (int64)Size);
+	}
+}
+
+void* FMovementBenchmarkMalloc::Malloc(SIZE_T Count, uint32 Alignment) {
+	ThreadAllocations++;
+	void* Result = Inner->Malloc(Count, Alignment);
+	TrackLiveBytes(Result, 1);
+	return Result;
+}
+
+void* FMovementBenchmarkMalloc::TryMalloc(SIZE_T Count, uint32 Alignment) {
+	ThreadAllocations++;
+	void* Result = Inner->TryMalloc(Count, Alignment);
+	TrackLiveBytes(Result, 1);
+	return Result;
+}
+
+void* FMovementBenchmarkMalloc::Realloc(void* Original, SIZE_T Count, uint32 Alignment) {
+	// Shrinking to nothing is a free, anything else may have to allocate.
+	if (Count > 0) {
+		ThreadAllocations++;
+	}
+	TrackLiveBytes(Original, -1);
+	void* Result = Inner->Realloc(Original, Count, Alignment);
+	TrackLiveBytes(Result, 1);
+	return Result;
+}
+
+void* FMovementBenchmarkMalloc::TryRealloc(void* Original, SIZE_T Count, uint32 Alignment) {
+	if (Count > 0) {
+		ThreadAllocations++;
+	}
+	TrackLiveBytes(Original, -1);
+	void* Result = Inner->TryRealloc(Original, Count, Alignment);
+	// A failed realloc leaves the original allocation as it was.
+	TrackLiveBytes(Result ? Result : (Count > 0 ? Original : nullptr), 1);
+	return Result;
+}
+
+void FMovementBenchmarkMalloc::Free(void* Original) {
+	TrackLiveBytes(Original, -1);
+	Inner->Free(Original);
+}
@@ -0,0 +1,122 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/PlatformTime.h"
+#include "HAL/MemoryBase.h"
+
+/**
+* Collects timing samples from STEALTH_BENCHMARK_SCOPE() while the movement benchmark is running.
+*
+* Only one recorder can be active at a time. While none is, every scope reduces to a single null check, so they can
+* stay in the movement hot path in shipping code.
+*/
+class CYBERSTEALTH2021_API FMovementBenchmarkRecorder {
+public:
+	/** Summary of all samples recorded for a single scope, in microseconds. */
+	struct FSummary {
+		int32 Count = 0;
+		double Mean = 0.0;
+		double P50 = 0.0;
+		double P99 = 0.0;
+		double P999 = 0.0;
+		double Max = 0.0;
+		// Heap allocations made inside the scope on the thread that ran it, only counted while FMovementBenchmarkMalloc is installed.
+		uint64 Allocations = 0;
+	};
+
+	static FMovementBenchmarkRecorder* GetActive() { return Active; }
+
+	/** Make this the active recorder, so that samples are collected into it. */
+	void Start();
+	/** Stop collecting samples. The samples recorded so far are kept. */
+	void Stop();
+
+	void AddSample(FName Scope, uint64 Cycles, uint64 Allocations = 0);
+
+	/** Get the summary of every scope that recorded at least one sample, sorted by name. */
+	TArray<TPair<FName, FSummary>> Summarize() const;
+
+private:
+	static FMovementBenchmarkRecorder* Active;
+
+	// Raw samples in CPU cycles, keyed by scope name.
+	TMap<FName, TArray<uint64>> Samples;
+	TMap<FName, uint64> Allocations;
+};
+
+/**
+* Proxy for GMalloc that counts the allocations each thread makes, so that the benchmark can report how many allocations every
+* scope makes, and the bytes allocated through it that are still live, so that it can measure what a character costs. Installed while
+* the game module starts up, when the command line runs the benchmark commandlet with -CountAllocations or -NPC, and never removed
+* again. That is before any world or movement exists, so none of what the benchmark measures can be allocated through the old GMalloc.
+*/
+class CYBERSTEALTH2021_API FMovementBenchmarkMalloc : public FMalloc {
+public:
+	explicit FMovementBenchmarkMalloc(FMalloc* InInner) : Inner(InInner) {}
+
+	/** Replace GMalloc with a counting proxy, if it isn't one already. Only safe during startup, see InstallIfRequested(). */
+	static void Install();
+	/** Install the proxy if the command line asks the benchmark commandlet for allocation counts or NPC memory. */
+	static void InstallIfRequested();
+	static bool IsInstalled() { return bInstalled; }
+	/** Allocations made on the calling thread since the proxy was installed. */
+	static uint64 GetThreadAllocations() { return ThreadAllocations; }
+	/**
+	* Bytes allocated on any thread since the proxy was installed and not freed yet, as sized by the inner allocator. Only compare two
+	* readings with each other. Stays 0 if the inner allocator can't report allocation sizes.
+	*/
+	static int64 GetLiveBytes() { return FPlatformAtomics::AtomicRead(&LiveBytes); }
+
+	virtual void* Malloc(SIZE_T Count, uint32 Alignment) override;
+	virtual void* TryMalloc(SIZE_T Count, uint32 Alignment) override;
+	virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override;
+	virtual void* TryRealloc(void* Original, SIZE_T Count, uint32 Alignment) override;
+	virtual void Free(void* Original) override;
+	virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override { return Inner->QuantizeSize(Count, Alignment); }
+	virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return Inner->GetAllocationSize(Original, SizeOut); }
+	virtual void Trim(bool bTrimThreadCaches) override { Inner->Trim(bTrimThreadCaches); }
+	virtual void SetupTLSCachesOnCurrentThread() override { Inner->SetupTLSCachesOnCurrentThread(); }
+	virtual void ClearAndDisableTLSCachesOnCurrentThread() override { Inner->ClearAndDisableTLSCachesOnCurrentThread(); }
+	virtual void InitializeStatsMetadata() override { Inner->InitializeStatsMetadata(); }
+	virtual void UpdateStats() override { Inner->UpdateStats(); }
+	virtual void GetAllocatorStats(FGenericMemoryStats& OutStats) override { Inner->GetAllocatorStats(OutStats); }
+	virtual void DumpAllocatorStats(FOutputDevice& Ar) override { Inner->DumpAllocatorStats(Ar); }
+	virtual bool IsInternallyThreadSafe() const override { return Inner->IsInternallyThreadSafe(); }
+	virtual bool ValidateHeap() override { return Inner->ValidateHeap(); }
+	virtual const TCHAR* GetDescriptiveName() override { return Inner->GetDescriptiveName(); }
+
+private:
+	FMalloc* Inner;
+	static bool bInstalled;
+	static thread_local uint64 ThreadAllocations;
+	static volatile int64 LiveBytes;
+
+	/** Adds the size of the given allocation to LiveBytes, or subtracts it with Sign -1. */
+	void TrackLiveBytes(void* Allocation, int64 Sign);
+};
+
+/** Records the time spent in its scope to the active benchmark recorder. Use through STEALTH_BENCHMARK_SCOPE(). */
+struct FMovementBenchmarkScope {
+	FMovementBenchmarkScope(FName InScope)
+		: Recorder(FMovementBenchmarkRecorder::GetActive()), Scope(InScope),
+		StartAllocations(Recorder ? FMovementBenchmarkMalloc::GetThreadAllocations() : 0), StartCycles(Recorder ? FPlatformTime::Cycles64() : 0) {}
+
+	~FMovementBenchmarkScope() {
+		if (Recorder) {
+			const uint64 Cycles = FPlatformTime::Cycles64() - StartCycles;
+			Recorder->AddSample(Scope, Cycles, FMovementBenchmarkMalloc::GetThreadAllocations() - StartAllocations);
+		}
+	}
+
+private:
+	FMovementBenchmarkRecorder* Recorder;
+	FName Scope;
+	uint64 StartAllocations;
+	uint64 StartCycles;
+};
+
+#define STEALTH_BENCHMARK_SCOPE(Name) \
+	static const FName PREPROCESSOR_JOIN(BenchmarkScopeName_, __LINE__)(TEXT(Name)); \
+	FMovementBenchmarkScope PREPROCESSOR_JOIN(BenchmarkScope_, __LINE__)(PREPROCESSOR_JOIN(BenchmarkScopeName_, __LINE__))
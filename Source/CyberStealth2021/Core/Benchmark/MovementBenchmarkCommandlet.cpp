@@ -0,0 +1,348 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "MovementBenchmarkCommandlet.h"
+#include "MovementBenchmark.h"
+#include "MovementInputRecording.h"
+#include "Core/Player/StealthPlayerCharacter.h"
+#include "Core/Player/StealthPlayerMovement.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "Engine/LevelStreaming.h"
+#include "EngineUtils.h"
+#include "GameFramework/PlayerStart.h"
+#include "GameFramework/WorldSettings.h"
+#include "Dom/JsonObject.h"
+#include "Serialization/JsonSerializer.h"
+#include "Serialization/JsonWriter.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "HAL/IConsoleManager.h"
+#include "Async/TaskGraphInterfaces.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogMovementBenchmark, Log, All);
+
+UMovementBenchmarkCommandlet::UMovementBenchmarkCommandlet() {
+	IsClient = false;
+	IsEditor = true;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UMovementBenchmarkCommandlet::Main(const FString& Params) {
+	FParse::Value(*Params, TEXT("Map="), MapName);
+	FParse::Value(*Params, TEXT("Character="), CharacterClassName);
+	FParse::Value(*Params, TEXT("Characters="), NumCharacters);
+	FParse::Value(*Params, TEXT("Frames="), NumFrames);
+	FParse::Value(*Params, TEXT("Warmup="), NumWarmupFrames);
+	FParse::Value(*Params, TEXT("DeltaTime="), DeltaTime);
+	bNPCMode = FParse::Param(*Params, TEXT("NPC"));
+	bParallelProbes = FParse::Param(*Params, TEXT("ParallelProbes"));
+	if (IConsoleVariable* ParallelProbesVar = IConsoleManager::Get().FindConsoleVariable(TEXT("stealth.ParallelProbes"))) {
+		ParallelProbesVar->Set(bParallelProbes ? 1 : 0);
+	}
+	FParse::Value(*Params, TEXT("Replay="), ReplayPath);
+	bCountAllocations = FParse::Param(*Params, TEXT("CountAllocations"));
+	bRecordMemoryBudget = bNPCMode && FParse::Param(*Params, TEXT("RecordMemoryBudget"));
+	// The memory of each NPC is measured with the proxy's live bytes. The game module installs it from the same switches at startup.
+	if ((bCountAllocations || bNPCMode) && !FMovementBenchmarkMalloc::IsInstalled()) {
+		UE_LOG(LogMovementBenchmark, Error, TEXT("The allocation counter wasn't installed at startup, -CountAllocations and -NPC must be on the command line"));
+		return 1;
+	}
+	if (!FParse::Value(*Params, TEXT("Output="), OutputPath)) {
+		OutputPath = FPaths::ProjectSavedDir() / TEXT("Benchmarks") / TEXT("MovementBenchmark.json");
+	}
+
+	FMovementInputReplay Replay;
+	if (!ReplayPath.IsEmpty()) {
+		if (!Replay.Open(ReplayPath)) {
+			return 1;
+		}
+		NumFrames = FMath::Max(Replay.GetNumFrames() - NumWarmupFrames, 0);
+	}
+
+	UClass* CharacterClass = LoadClass<AStealthPlayerCharacter>(nullptr, *CharacterClassName);
+	if (!CharacterClass) {
+		UE_LOG(LogMovementBenchmark, Error, TEXT("Failed to load character class %s"), *CharacterClassName);
+		return 1;
+	}
+
+	UWorld* World = LoadWorld();
+	if (!World) {
+		UE_LOG(LogMovementBenchmark, Error, TEXT("Failed to load map %s"), *MapName);
+		return 1;
+	}
+
+	TArray<FScriptedCharacter> Characters;
+	// Physical memory moves in whole pages and with every other allocation in the process, so count only what the spawned characters
+	// still hold on to through the allocator.
+	const int64 MemoryBeforeSpawn = FMovementBenchmarkMalloc::GetLiveBytes();
+	SpawnCharacters(World, CharacterClass, Characters);
+	const int64 MemoryPerCharacter = Characters.Num() > 0 ? (FMovementBenchmarkMalloc::GetLiveBytes() - MemoryBeforeSpawn) / Characters.Num() : 0;
+	UE_LOG(LogMovementBenchmark, Display, TEXT("Spawned %d characters in %s, running %d frames"), Characters.Num(), *MapName, NumFrames);
+
+	TArray<AStealthPlayerCharacter*> ReplayCharacters;
+	for (const FScriptedCharacter& Scripted : Characters) {
+		ReplayCharacters.Add(Scripted.Character);
+	}
+
+	FMovementBenchmarkRecorder Recorder;
+	float Time = 0.0f;
+	double SimulatedSeconds = 0.0;
+	double WallSeconds = 0.0;
+	int32 Frame = 0;
+	for (; Frame < NumWarmupFrames + NumFrames; Frame++) {
+		if (Frame == NumWarmupFrames) {
+			Recorder.Start();
+			WallSeconds = FPlatformTime::Seconds();
+		}
+
+		// The engine loop isn't running, so advance the frame counter ourselves. The movement query cache and async probes depend on it.
+		GFrameCounter++;
+		float FrameDeltaTime = DeltaTime;
+		if (ReplayPath.IsEmpty()) {
+			for (FScriptedCharacter& Scripted : Characters) {
+				ApplyScriptedInput(Scripted, Time);
+			}
+		}
+		else if (!Replay.ApplyNextFrame(ReplayCharacters, FrameDeltaTime)) {
+			break;
+		}
+
+		{
+			STEALTH_BENCHMARK_SCOPE("WorldTick");
+			World->Tick(LEVELTICK_All, FrameDeltaTime);
+		}
+		Time += FrameDeltaTime;
+		if (Frame >= NumWarmupFrames) {
+			SimulatedSeconds += FrameDeltaTime;
+		}
+	}
+	WallSeconds = FPlatformTime::Seconds() - WallSeconds;
+	Recorder.Stop();
+	const int32 NumSimulatedFrames = FMath::Max(Frame - NumWarmupFrames, 0);
+
+	UE_LOG(LogMovementBenchmark, Display, TEXT("Simulated %.1f seconds in %.1f seconds"), SimulatedSeconds, WallSeconds);
+	if (bRecordMemoryBudget) {
+		RecordMemoryBudget(MemoryPerCharacter);
+	}
+	const bool bWithinBudget = !bNPCMode || CheckNPCBudget(Recorder, MemoryPerCharacter);
+	const bool bWroteResults = WriteResults(Recorder, Characters.Num(), NumSimulatedFrames, SimulatedSeconds, WallSeconds, MemoryPerCharacter, bWithinBudget);
+
+	GEngine->DestroyWorldContext(World);
+	World->DestroyWorld(false);
+	return bWroteResults && bWithinBudget ? 0 : 1;
+}
+
+UWorld* UMovementBenchmarkCommandlet::LoadWorld() const {
+	UPackage* MapPackage = LoadPackage(nullptr, *MapName, LOAD_None);
+	UWorld* World = MapPackage ? UWorld::FindWorldInPackage(MapPackage) : nullptr;
+	if (!World) {
+		return nullptr;
+	}
+
+	World->WorldType = EWorldType::Game;
+	FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+	WorldContext.SetCurrentWorld(World);
+	World->AddToRoot();
+
+	if (!World->bIsWorldInitialized) {
+		UWorld::InitializationValues IVS;
+		IVS.RequiresHitProxies(false);
+		IVS.ShouldSimulatePhysics(true);
+		IVS.EnableTraceCollision(true);
+		IVS.CreateNavigation(false);
+		IVS.CreateAISystem(false);
+		IVS.AllowAudioPlayback(false);
+		IVS.CreatePhysicsScene(true);
+		World->InitWorld(IVS);
+	}
+	World->UpdateWorldComponents(true, false);
+
+	for (ULevelStreaming* StreamingLevel : World->GetStreamingLevels()) {
+		StreamingLevel->SetShouldBeLoaded(true);
+		StreamingLevel->SetShouldBeVisible(true);
+	}
+	World->FlushLevelStreaming(EFlushLevelStreamingType::Full);
+
+	// There is no game mode to start play in a commandlet, so begin play on the actors directly.
+	World->InitializeActorsForPlay(FURL());
+	World->GetWorldSettings()->NotifyBeginPlay();
+	return World;
+}
+
+void UMovementBenchmarkCommandlet::SpawnCharacters(UWorld* World, UClass* CharacterClass, TArray<FScriptedCharacter>& OutCharacters) const {
+	FTransform Origin(FVector(0.0f, 0.0f, 200.0f));
+	for (TActorIterator<APlayerStart> It(World); It; ++It) {
+		Origin = It->GetActorTransform();
+		break;
+	}
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButAlwaysSpawn;
+
+	// Spread the characters out on a square grid around the start, far enough apart that they don't spawn inside each other.
+	const int32 GridSize = FMath::CeilToInt(FMath::Sqrt((float)NumCharacters));
+	const float Spacing = 150.0f;
+	for (int32 i = 0; i < NumCharacters; i++) {
+		const FVector Offset(((i % GridSize) - GridSize / 2) * Spacing, ((i / GridSize) - GridSize / 2) * Spacing, 0.0f);
+		const FTransform SpawnTransform(Origin.Rotator(), Origin.TransformPosition(Offset));
+
+		AStealthPlayerCharacter* Character = World->SpawnActor<AStealthPlayerCharacter>(CharacterClass, SpawnTransform, SpawnParams);
+		if (!Character) {
+			continue;
+		}
+		// Nobody possesses the benchmark characters, so the movement component has to be told to simulate anyway.
+		Character->GetStealthMovementComp()->bRunPhysicsWithNoController = true;
+		Character->GetStealthMovementComp()->SetNPCMode(bNPCMode);
+
+		FScriptedCharacter& Scripted = OutCharacters.AddDefaulted_GetRef();
+		Scripted.Character = Character;
+		Scripted.Pattern = (EInputPattern)(i % (int32)EInputPattern::Count);
+		Scripted.Phase = (i / (int32)EInputPattern::Count) * 0.37f;
+	}
+}
+
+void UMovementBenchmarkCommandlet::ApplyScriptedInput(FScriptedCharacter& Scripted, float Time) const {
+	AStealthPlayerCharacter* Character = Scripted.Character;
+	// Every pattern repeats every 4 seconds.
+	const float t = FMath::Fmod(Time + Scripted.Phase, 4.0f);
+
+	// Keep turning slowly so that the characters wander around the map instead of running off of it.
+	Character->AddActorWorldRotation(FRotator(0.0f, 30.0f * DeltaTime, 0.0f));
+	Character->AddMovementInput(Character->GetActorForwardVector(), Scripted.Pattern == EInputPattern::Lean ? 0.5f : 1.0f);
+
+	switch (Scripted.Pattern) {
+	case EInputPattern::Sprint:
+		Character->Sprint();
+		break;
+	case EInputPattern::Slide:
+		// Sprint up to speed, then crouch into a slide and stand back up.
+		if (t < 2.5f) {
+			Character->Sprint();
+		}
+		else {
+			Character->StopSprinting();
+		}
+		if (t >= 1.5f && t < 2.5f) {
+			Character->Crouch(false);
+		}
+		else {
+			Character->UnCrouch(false);
+		}
+		break;
+	case EInputPattern::Crouch:
+		if (t < 2.0f) {
+			Character->Crouch(false);
+		}
+		else {
+			Character->UnCrouch(false);
+		}
+		break;
+	case EInputPattern::JumpClimb:
+		// Jump twice per cycle, climbing whatever is in front of the character.
+		if (t < 0.1f || (t >= 2.0f && t < 2.1f)) {
+			Character->Jump();
+		}
+		else {
+			Character->StopJumping();
+		}
+		break;
+	case EInputPattern::Lean: {
+		const float LeanDirection = t < 1.5f ? -1.0f : (t >= 2.0f && t < 3.5f ? 1.0f : 0.0f);
+		if (LeanDirection != Scripted.LeanDirection) {
+			Scripted.LeanDirection = LeanDirection;
+			Character->GetStealthMovementComp()->RequestLean(40.0f * LeanDirection, -5.0f * FMath::Abs(LeanDirection), 10.0f * LeanDirection, 8.0f);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+bool UMovementBenchmarkCommandlet::CheckNPCBudget(const FMovementBenchmarkRecorder& Recorder, int64 MemoryPerCharacter) const {
+	bool bWithinBudget = true;
+	for (const TPair<FName, FMovementBenchmarkRecorder::FSummary>& Scope : Recorder.Summarize()) {
+		if (Scope.Key == TEXT("UStealthPlayerMovement::TickComponent") && Scope.Value.Mean > UStealthPlayerMovement::NPCTickBudgetMicroseconds) {
+			UE_LOG(LogMovementBenchmark, Error, TEXT("Average NPC movement tick took %.2fus, the budget is %.2fus"),
+				Scope.Value.Mean, UStealthPlayerMovement::NPCTickBudgetMicroseconds);
+			bWithinBudget = false;
+		}
+	}
+	if (NPCMemoryBudgetBytes <= 0) {
+		UE_LOG(LogMovementBenchmark, Warning, TEXT("Each NPC uses %lld bytes. No memory budget has been recorded yet, run with -NPC -RecordMemoryBudget to set one"),
+			MemoryPerCharacter);
+	}
+	else if (MemoryPerCharacter > NPCMemoryBudgetBytes) {
+		UE_LOG(LogMovementBenchmark, Error, TEXT("Each NPC uses %lld bytes, the budget is %d bytes"), MemoryPerCharacter, NPCMemoryBudgetBytes);
+		bWithinBudget = false;
+	}
+	return bWithinBudget;
+}
+
+void UMovementBenchmarkCommandlet::RecordMemoryBudget(int64 MemoryPerCharacter) {
+	if (MemoryPerCharacter <= 0) {
+		UE_LOG(LogMovementBenchmark, Error, TEXT("Can't record a memory budget, the allocator doesn't report allocation sizes"));
+		return;
+	}
+	// Rounded up to whole kilobytes, so that the budget reads as a plain number in the config.
+	NPCMemoryBudgetBytes = FMath::DivideAndRoundUp((int32)(MemoryPerCharacter * (1.0f + MemoryBudgetHeadroom)), 1024) * 1024;
+	UpdateDefaultConfigFile();
+	UE_LOG(LogMovementBenchmark, Display, TEXT("Each NPC uses %lld bytes, recorded a budget of %d bytes"), MemoryPerCharacter, NPCMemoryBudgetBytes);
+}
+
+bool UMovementBenchmarkCommandlet::WriteResults(const FMovementBenchmarkRecorder& Recorder, int32 NumSpawned, int32 NumSimulatedFrames,
+	double SimulatedSeconds, double WallSeconds, int64 MemoryPerCharacter, bool bWithinBudget) const {
+	TSharedRef<FJsonObject> Root = MakeShared<FJsonObject>();
+	Root->SetStringField(TEXT("map"), MapName);
+	Root->SetNumberField(TEXT("characters"), NumSpawned);
+	Root->SetNumberField(TEXT("frames"), NumSimulatedFrames);
+	if (ReplayPath.IsEmpty()) {
+		Root->SetNumberField(TEXT("deltaTime"), DeltaTime);
+	}
+	else {
+		Root->SetStringField(TEXT("replay"), ReplayPath);
+	}
+	Root->SetNumberField(TEXT("simulatedSeconds"), SimulatedSeconds);
+	Root->SetNumberField(TEXT("wallSeconds"), WallSeconds);
+	Root->SetBoolField(TEXT("npcMode"), bNPCMode);
+	Root->SetBoolField(TEXT("parallelProbes"), bParallelProbes);
+	Root->SetBoolField(TEXT("countAllocations"), bCountAllocations);
+	Root->SetNumberField(TEXT("workerThreads"), FTaskGraphInterface::Get().GetNumWorkerThreads());
+	Root->SetNumberField(TEXT("memoryPerCharacterBytes"), MemoryPerCharacter);
+	if (bNPCMode) {
+		Root->SetNumberField(TEXT("npcTickBudgetUs"), UStealthPlayerMovement::NPCTickBudgetMicroseconds);
+		Root->SetNumberField(TEXT("npcMemoryBudgetBytes"), NPCMemoryBudgetBytes);
+		Root->SetBoolField(TEXT("withinBudget"), bWithinBudget);
+	}
+
+	// Every timing is in microseconds.
+	TSharedRef<FJsonObject> Timings = MakeShared<FJsonObject>();
+	for (const TPair<FName, FMovementBenchmarkRecorder::FSummary>& Scope : Recorder.Summarize()) {
+		TSharedRef<FJsonObject> Summary = MakeShared<FJsonObject>();
+		Summary->SetNumberField(TEXT("count"), Scope.Value.Count);
+		Summary->SetNumberField(TEXT("mean"), Scope.Value.Mean);
+		Summary->SetNumberField(TEXT("p50"), Scope.Value.P50);
+		Summary->SetNumberField(TEXT("p99"), Scope.Value.P99);
+		Summary->SetNumberField(TEXT("p99.9"), Scope.Value.P999);
+		Summary->SetNumberField(TEXT("max"), Scope.Value.Max);
+		if (bCountAllocations) {
+			Summary->SetNumberField(TEXT("allocations"), Scope.Value.Allocations);
+			Summary->SetNumberField(TEXT("allocationsPerSample"), (double)Scope.Value.Allocations / Scope.Value.Count);
+		}
+		Timings->SetObjectField(Scope.Key.ToString(), Summary);
+	}
+	Root->SetObjectField(TEXT("timingsUs"), Timings);
+
+	FString Json;
+	TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&Json);
+	FJsonSerializer::Serialize(Root, Writer);
+	if (!FFileHelper::SaveStringToFile(Json, *OutputPath)) {
+		UE_LOG(LogMovementBenchmark, Error, TEXT("Failed to write results to %s"), *OutputPath);
+		return false;
+	}
+
+	UE_LOG(LogMovementBenchmark, Display, TEXT("Wrote results to %s"), *OutputPath);
+	return true;
+}
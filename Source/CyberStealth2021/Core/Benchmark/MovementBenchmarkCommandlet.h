@@ -0,0 +1,96 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "MovementBenchmarkCommandlet.generated.h"
+
+class AStealthPlayerCharacter;
+class FMovementBenchmarkRecorder;
+
+/**
+* Headless benchmark of UStealthPlayerMovement with many characters at once.
+*
+* Loads a map, spawns a number of player characters without controllers, and drives each of them with one of a set of scripted
+* input patterns (sprinting, sliding, crouching, jumping to climb and leaning). The world is ticked at a fixed time step as fast as
+* possible, and the time spent in every STEALTH_BENCHMARK_SCOPE() is written out as a JSON file.
+*
+* With -NPC the characters run in NPC mode, and the average movement tick time and the memory used per character are checked against
+* UStealthPlayerMovement::NPCTickBudgetMicroseconds and this commandlet's NPCMemoryBudgetBytes. The commandlet fails if either is
+* over budget. The budgets are sized for -Characters=200. The memory of each character is what it still holds through
+* FMovementBenchmarkMalloc once spawned. NPCMemoryBudgetBytes is measured rather than picked: run with -NPC -RecordMemoryBudget to store the measurement,
+* plus MemoryBudgetHeadroom, in DefaultGame.ini. Until then the memory is only reported.
+*
+* With -ParallelProbes the probes of all characters are evaluated together on task graph workers (stealth.ParallelProbes). Compare the
+* WorldTick timing of runs with and without it, and with -Characters raised, to see how game thread time scales with the worker count
+* written to the results.
+*
+* With -CountAllocations every scope also reports the heap allocations made inside of it. StealthStateMachine::Transition covers each
+* change of movement state, which should never allocate.
+*
+* With -Replay the characters are all driven by a recording made with stealth.RecordInput instead of the scripted patterns, and the world
+* is ticked with the delta times it was recorded with. -Frames and -DeltaTime are ignored then. Replaying the same recording on two
+* builds compares their tick cost on identical input.
+*
+* Usage: UE4Editor-Cmd CyberStealth2021.uproject -run=MovementBenchmark -nullrhi [-Map=/Game/OpenSource/Maps/TestMap] [-Characters=64]
+*        [-Frames=3600] [-Warmup=120] [-DeltaTime=0.0166667] [-Character=/Game/Path/To/Blueprint.Blueprint_C] [-Output=Path/To/Results.json] [-NPC] [-ParallelProbes]
+*        [-Replay=Path/To/Recording.stmr] [-CountAllocations] [-RecordMemoryBudget]
+*/
+UCLASS(config = Game)
+class CYBERSTEALTH2021_API UMovementBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UMovementBenchmarkCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+private:
+	enum class EInputPattern : uint8 {
+		Sprint,
+		Slide,
+		Crouch,
+		JumpClimb,
+		Lean,
+		Count
+	};
+
+	struct FScriptedCharacter {
+		AStealthPlayerCharacter* Character = nullptr;
+		EInputPattern Pattern = EInputPattern::Sprint;
+		// Offset into the pattern, so that characters running the same pattern don't all act on the same frame.
+		float Phase = 0.0f;
+		float LeanDirection = 0.0f;
+	};
+
+	FString MapName = TEXT("/Game/OpenSource/Maps/TestMap");
+	FString CharacterClassName = TEXT("/Game/OpenSource/Core/Player/StealthPlayerCharacterBP.StealthPlayerCharacterBP_C");
+	int32 NumCharacters = 64;
+	int32 NumFrames = 3600;
+	int32 NumWarmupFrames = 120;
+	float DeltaTime = 1.0f / 60.0f;
+	FString OutputPath;
+	bool bNPCMode = false;
+	bool bParallelProbes = false;
+	FString ReplayPath;
+	bool bCountAllocations = false;
+	bool bRecordMemoryBudget = false;
+
+	/** Memory allowed per NPC character, including its actor and all of its components. 0 until recorded with -RecordMemoryBudget. */
+	UPROPERTY(Config)
+	int32 NPCMemoryBudgetBytes = 0;
+	/** How far above the measurement -RecordMemoryBudget sets the budget, so that it only fails on real growth. */
+	static constexpr float MemoryBudgetHeadroom = 0.1f;
+
+	UWorld* LoadWorld() const;
+	void SpawnCharacters(UWorld* World, UClass* CharacterClass, TArray<FScriptedCharacter>& OutCharacters) const;
+	void ApplyScriptedInput(FScriptedCharacter& Scripted, float Time) const;
+	bool WriteResults(const FMovementBenchmarkRecorder& Recorder, int32 NumSpawned, int32 NumSimulatedFrames, double SimulatedSeconds, double WallSeconds,
+		int64 MemoryPerCharacter, bool bWithinBudget) const;
+	/** Check the results of an NPC run against the NPC tick budget in UStealthPlayerMovement and NPCMemoryBudgetBytes. */
+	bool CheckNPCBudget(const FMovementBenchmarkRecorder& Recorder, int64 MemoryPerCharacter) const;
+	/** Store the measured memory per NPC, plus headroom, as NPCMemoryBudgetBytes in DefaultGame.ini. */
+	void RecordMemoryBudget(int64 MemoryPerCharacter);
+};
@@ -0,0 +1,331 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "MovementInputRecording.h"
+#include "Core/Player/StealthPlayerCharacter.h"
+#include "Core/Player/StealthPlayerMovement.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/Paths.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogMovementInputRecording, Log, All);
+
+FMovementInputRecorder* FMovementInputRecorder::Active = nullptr;
+
+namespace {
+	// Delta times are stored in units of 10 microseconds, and movement input in units of 1/16384 so that diagonals still fit.
+	constexpr float DeltaTimeUnit = 0.00001f;
+	constexpr float MoveUnit = 1.0f / 16384.0f;
+
+	int32 GetPayloadFloats(EMovementInput Input) {
+		switch (Input) {
+		case EMovementInput::LookX:
+		case EMovementInput::LookY:
+			return 1;
+		case EMovementInput::Lean:
+			return 4;
+		default:
+			return 0;
+		}
+	}
+
+	TUniquePtr<FMovementInputRecorder> ConsoleRecorder;
+
+	void StartConsoleRecording(const TArray<FString>& Args, UWorld* World) {
+		APlayerController* PlayerController = World ? World->GetFirstPlayerController() : nullptr;
+		AStealthPlayerCharacter* Character = PlayerController ? Cast<AStealthPlayerCharacter>(PlayerController->GetPawn()) : nullptr;
+		if (!Character) {
+			UE_LOG(LogMovementInputRecording, Warning, TEXT("stealth.RecordInput needs a local AStealthPlayerCharacter to record"));
+			return;
+		}
+
+		const FString Path = Args.Num() > 0 ? Args[0]
+			: FPaths::ProjectSavedDir() / TEXT("Recordings") / FString::Printf(TEXT("Input-%s.stmr"), *FDateTime::Now().ToString());
+		TUniquePtr<FMovementInputRecorder> Recorder = MakeUnique<FMovementInputRecorder>();
+		if (Recorder->Start(Character, Path)) {
+			ConsoleRecorder = MoveTemp(Recorder);
+		}
+	}
+
+	void StopConsoleRecording() {
+		if (ConsoleRecorder) {
+			ConsoleRecorder->Stop();
+			ConsoleRecorder.Reset();
+		}
+	}
+
+	FAutoConsoleCommandWithWorldAndArgs RecordInputCommand(
+		TEXT("stealth.RecordInput"),
+		TEXT("Record the input of the local player character to a file, by default in Saved/Recordings. Replay it with the MovementBenchmark commandlet and -Replay=File."),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&StartConsoleRecording));
+
+	FAutoConsoleCommand StopRecordingInputCommand(
+		TEXT("stealth.StopRecordingInput"),
+		TEXT("Finish the recording started with stealth.RecordInput."),
+		FConsoleCommandDelegate::CreateStatic(&StopConsoleRecording));
+}
+
+FMovementInputRecorder::~FMovementInputRecorder() {
+	Stop();
+}
+
+FMovementInputRecorder* FMovementInputRecorder::GetActiveFor(AStealthPlayerCharacter* Character) {
+	// Input the movement component gives the character while it ticks is part of the simulation, not of the player's input.
+	if (Active && Active->Character.Get() == Character && !Character->GetStealthMovementComp()->IsInMovementTick()) {
+		return Active;
+	}
+	return nullptr;
+}
+
+bool FMovementInputRecorder::Start(AStealthPlayerCharacter* InCharacter, const FString& InPath) {
+	check(IsInGameThread());
+	if (Active) {
+		UE_LOG(LogMovementInputRecording, Warning, TEXT("Can't record to %s, already recording to %s"), *InPath, *Active->Path);
+		return false;
+	}
+
+	Writer.Reset(IFileManager::Get().CreateFileWriter(*InPath));
+	if (!Writer) {
+		UE_LOG(LogMovementInputRecording, Error, TEXT("Failed to create %s"), *InPath);
+		return false;
+	}
+
+	Character = InCharacter;
+	Path = InPath;
+	Header = FMovementRecordingHeader();
+	Header.XMouseSensitivity = Character->XMouseSensitivity;
+	Header.YMouseSensitivity = Character->YMouseSensitivity;
+	if (APlayerController* PlayerController = Cast<APlayerController>(Character->GetController())) {
+		Header.YawScale = PlayerController->InputYawScale;
+		Header.PitchScale = PlayerController->InputPitchScale;
+	}
+	// The header is written again with the final counts when the recording stops.
+	Writer->Serialize(&Header, sizeof(Header));
+
+	FrameEvents.Reset();
+	FrameMovementInput = FVector::ZeroVector;
+	LastMoveX = 0;
+	LastMoveY = 0;
+	LastLookX = 0.0f;
+	LastLookY = 0.0f;
+	Active = this;
+	UE_LOG(LogMovementInputRecording, Display, TEXT("Recording input of %s to %s"), *Character->GetName(), *Path);
+	return true;
+}
+
+int32 FMovementInputRecorder::Stop() {
+	if (!Writer) {
+		return 0;
+	}
+
+	Writer->Seek(0);
+	Writer->Serialize(&Header, sizeof(Header));
+	Writer->Close();
+	Writer.Reset();
+	if (Active == this) {
+		Active = nullptr;
+	}
+
+	UE_LOG(LogMovementInputRecording, Display, TEXT("Recorded %u frames in %u bytes to %s"), Header.NumFrames, Header.StreamSize + (uint32)sizeof(Header), *Path);
+	Character.Reset();
+	return Header.NumFrames;
+}
+
+void FMovementInputRecorder::Record(EMovementInput Input) {
+	WriteEvent(Input);
+}
+
+void FMovementInputRecorder::Record(EMovementInput Input, float Value) {
+	// Axes are reported every frame, but only need to be written when they change.
+	float& LastValue = Input == EMovementInput::LookX ? LastLookX : LastLookY;
+	if (Value != LastValue) {
+		LastValue = Value;
+		WriteEvent(Input, &Value, sizeof(Value));
+	}
+}
+
+void FMovementInputRecorder::RecordLean(float HorzOffsetAmount, float VertOffsetAmount, float CameraRotation, float TransitionSpeed) {
+	const float Values[4] = { HorzOffsetAmount, VertOffsetAmount, CameraRotation, TransitionSpeed };
+	WriteEvent(EMovementInput::Lean, Values, sizeof(Values));
+}
+
+void FMovementInputRecorder::RecordMovementInput(const FVector& WorldInput) {
+	FrameMovementInput += WorldInput;
+}
+
+void FMovementInputRecorder::EndFrame(float DeltaTime) {
+	// Movement input is stored relative to the character, so that it can be replayed into characters that face any direction.
+	const FVector LocalInput = Character->GetActorTransform().InverseTransformVectorNoScale(FrameMovementInput);
+	FrameMovementInput = FVector::ZeroVector;
+	const int16 MoveXY[2] = {
+		(int16)FMath::Clamp(FMath::RoundToInt(LocalInput.X / MoveUnit), -32767, 32767),
+		(int16)FMath::Clamp(FMath::RoundToInt(LocalInput.Y / MoveUnit), -32767, 32767)
+	};
+	if (MoveXY[0] != LastMoveX || MoveXY[1] != LastMoveY) {
+		LastMoveX = MoveXY[0];
+		LastMoveY = MoveXY[1];
+		WriteEvent(EMovementInput::Move, MoveXY, sizeof(MoveXY));
+	}
+
+	uint8 FrameEvent[3];
+	FrameEvent[0] = (uint8)EMovementInput::Frame;
+	const uint16 DeltaUnits = (uint16)FMath::Clamp(FMath::RoundToInt(DeltaTime / DeltaTimeUnit), 0, (int32)MAX_uint16);
+	FMemory::Memcpy(&FrameEvent[1], &DeltaUnits, sizeof(DeltaUnits));
+	Writer->Serialize(FrameEvent, sizeof(FrameEvent));
+	Writer->Serialize(FrameEvents.GetData(), FrameEvents.Num());
+
+	Header.NumFrames++;
+	Header.StreamSize += sizeof(FrameEvent) + FrameEvents.Num();
+	FrameEvents.Reset();
+}
+
+void FMovementInputRecorder::WriteEvent(EMovementInput Input, const void* Payload, int32 PayloadSize) {
+	FrameEvents.Add((uint8)Input);
+	FrameEvents.Append((const uint8*)Payload, PayloadSize);
+}
+
+FMovementInputReplay::~FMovementInputReplay() {
+	Close();
+}
+
+bool FMovementInputReplay::Open(const FString& Path) {
+	Close();
+	MappedFile = FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Path);
+	MappedRegion = MappedFile ? MappedFile->MapRegion(0, MappedFile->GetFileSize()) : nullptr;
+	if (!MappedRegion || MappedRegion->GetMappedSize() < sizeof(FMovementRecordingHeader)) {
+		UE_LOG(LogMovementInputRecording, Error, TEXT("Failed to map %s"), *Path);
+		Close();
+		return false;
+	}
+
+	FMemory::Memcpy(&Header, MappedRegion->GetMappedPtr(), sizeof(Header));
+	if (Header.Magic != FMovementRecordingHeader::RecordingMagic || Header.Version != FMovementRecordingHeader::RecordingVersion
+		|| Header.HeaderSize + (int64)Header.StreamSize > MappedRegion->GetMappedSize()) {
+		UE_LOG(LogMovementInputRecording, Error, TEXT("%s is not a movement input recording this build can read"), *Path);
+		Close();
+		return false;
+	}
+
+	Cursor = MappedRegion->GetMappedPtr() + Header.HeaderSize;
+	End = Cursor + Header.StreamSize;
+	return true;
+}
+
+void FMovementInputReplay::Close() {
+	delete MappedRegion;
+	MappedRegion = nullptr;
+	delete MappedFile;
+	MappedFile = nullptr;
+	Cursor = nullptr;
+	End = nullptr;
+	Frame = 0;
+	Move = FVector2D::ZeroVector;
+	LookX = 0.0f;
+	LookY = 0.0f;
+}
+
+template<typename T>
+bool FMovementInputReplay::Read(T& OutValue) {
+	if (Cursor + sizeof(T) > End) {
+		Cursor = End;
+		return false;
+	}
+	// The stream is packed, so values aren't aligned.
+	FMemory::Memcpy(&OutValue, Cursor, sizeof(T));
+	Cursor += sizeof(T);
+	return true;
+}
+
+bool FMovementInputReplay::ApplyNextFrame(TArrayView<AStealthPlayerCharacter* const> Characters, float& OutDeltaTime) {
+	uint8 Input = 0;
+	uint16 DeltaUnits = 0;
+	if (!Read(Input) || Input != (uint8)EMovementInput::Frame || !Read(DeltaUnits)) {
+		Cursor = End;
+		return false;
+	}
+	OutDeltaTime = DeltaUnits * DeltaTimeUnit;
+
+	while (Cursor < End && *Cursor != (uint8)EMovementInput::Frame) {
+		Read(Input);
+		if (Input >= (uint8)EMovementInput::Count) {
+			UE_LOG(LogMovementInputRecording, Error, TEXT("Unknown input %u in frame %d, stopping the replay"), Input, Frame);
+			Cursor = End;
+			return false;
+		}
+
+		if (Input == (uint8)EMovementInput::Move) {
+			int16 MoveXY[2];
+			Read(MoveXY);
+			Move = FVector2D(MoveXY[0] * MoveUnit, MoveXY[1] * MoveUnit);
+			continue;
+		}
+
+		float Values[4] = {};
+		for (int32 i = 0; i < GetPayloadFloats((EMovementInput)Input); i++) {
+			Read(Values[i]);
+		}
+		if (Input == (uint8)EMovementInput::LookX) {
+			LookX = Values[0];
+		}
+		else if (Input == (uint8)EMovementInput::LookY) {
+			LookY = Values[0];
+		}
+		else {
+			for (AStealthPlayerCharacter* Character : Characters) {
+				ApplyEvent(Character, (EMovementInput)Input, Values);
+			}
+		}
+	}
+
+	for (AStealthPlayerCharacter* Character : Characters) {
+		ApplyHeldInput(Character);
+	}
+	Frame++;
+	return true;
+}
+
+void FMovementInputReplay::ApplyHeldInput(AStealthPlayerCharacter* Character) const {
+	if (Character->IsLocallyControlled() && Character->IsPlayerControlled()) {
+		Character->LookX(LookX);
+		Character->LookY(LookY);
+	}
+	else if (LookX != 0.0f) {
+		Character->AddActorWorldRotation(FRotator(0.0f, LookX * Header.XMouseSensitivity * Header.YawScale, 0.0f));
+	}
+
+	if (!Move.IsZero()) {
+		Character->AddMovementInput(Character->GetActorTransform().TransformVectorNoScale(FVector(Move, 0.0f)));
+	}
+}
+
+void FMovementInputReplay::ApplyEvent(AStealthPlayerCharacter* Character, EMovementInput Input, const float* Values) const {
+	switch (Input) {
+	case EMovementInput::Sprint:
+		Character->Sprint();
+		break;
+	case EMovementInput::StopSprinting:
+		Character->StopSprinting();
+		break;
+	case EMovementInput::Crouch:
+		Character->Crouch(false);
+		break;
+	case EMovementInput::UnCrouch:
+		Character->UnCrouch(false);
+		break;
+	case EMovementInput::Jump:
+		Character->Jump();
+		break;
+	case EMovementInput::StopJumping:
+		Character->StopJumping();
+		break;
+	case EMovementInput::Lean:
+		Character->GetStealthMovementComp()->RequestLean(Values[0], Values[1], Values[2], Values[3]);
+		break;
+	default:
+		break;
+	}
+}
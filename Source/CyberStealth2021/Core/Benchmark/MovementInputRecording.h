@@ -0,0 +1,144 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/WeakObjectPtrTemplates.h"
+
+class AStealthPlayerCharacter;
+class FArchive;
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+/** Every kind of input that reaches AStealthPlayerCharacter, as stored in a movement input recording. */
+enum class EMovementInput : uint8 {
+	// Starts the next frame. Followed by the frame's delta time in units of 10 microseconds, as a uint16.
+	Frame,
+	// Movement input of the frame in the character's local space, followed by X and Y as int16 in units of 1/16384.
+	Move,
+	// Followed by the new value of the axis as a float. The value is held until the next event of the same kind.
+	LookX,
+	LookY,
+	Sprint,
+	StopSprinting,
+	Crouch,
+	UnCrouch,
+	Jump,
+	StopJumping,
+	// Followed by the four arguments of UStealthPlayerMovement::RequestLean() as floats.
+	Lean,
+	Count
+};
+
+/**
+* On-disk layout of a movement input recording. The header is followed by a stream of events, each a single EMovementInput byte
+* followed by its payload. Every frame starts with a Frame event, and axes are only written on the frames they change, so a frame
+* without any change of input costs 3 bytes.
+*/
+struct FMovementRecordingHeader {
+	static constexpr uint32 RecordingMagic = 0x524D5453; // "STMR"
+	static constexpr uint16 RecordingVersion = 1;
+
+	uint32 Magic = RecordingMagic;
+	uint16 Version = RecordingVersion;
+	uint16 HeaderSize = sizeof(FMovementRecordingHeader);
+	uint32 NumFrames = 0;
+	uint32 StreamSize = 0;
+	// Controller yaw and pitch scale and mouse sensitivity of the recorded character, to turn characters without a player controller.
+	float YawScale = 1.0f;
+	float PitchScale = 1.0f;
+	float XMouseSensitivity = 1.0f;
+	float YMouseSensitivity = 1.0f;
+};
+
+/**
+* Records every input that reaches a single AStealthPlayerCharacter into a compact binary file, tagged by frame.
+*
+* Only one recorder can be active at a time, and the character reports its input to it through Record(). Inputs that the movement
+* component makes on its own while it ticks, such as uncrouching at the end of a slide, are not recorded since replaying them would
+* make them happen twice. Start one from the console with stealth.RecordInput [File], and finish it with stealth.StopRecordingInput.
+*/
+class CYBERSTEALTH2021_API FMovementInputRecorder {
+public:
+	~FMovementInputRecorder();
+
+	static FMovementInputRecorder* GetActive() { return Active; }
+	/** Get the active recorder if it is recording Character, or null. */
+	static FMovementInputRecorder* GetActiveFor(AStealthPlayerCharacter* Character);
+
+	/** Start recording the input of Character into the file at Path. Fails if the file can't be created or another recording is running. */
+	bool Start(AStealthPlayerCharacter* Character, const FString& Path);
+	/** Finish the file and stop recording. Returns the number of frames that were recorded. */
+	int32 Stop();
+
+	void Record(EMovementInput Input);
+	void Record(EMovementInput Input, float Value);
+	void RecordLean(float HorzOffsetAmount, float VertOffsetAmount, float CameraRotation, float TransitionSpeed);
+	/** Accumulate movement input that the character was given this frame, in world space. */
+	void RecordMovementInput(const FVector& WorldInput);
+
+	/** Called from the recorded character's tick, once its input for the frame is complete. Writes the frame out. */
+	void EndFrame(float DeltaTime);
+
+private:
+	static FMovementInputRecorder* Active;
+
+	TWeakObjectPtr<AStealthPlayerCharacter> Character;
+	TUniquePtr<FArchive> Writer;
+	FString Path;
+	FMovementRecordingHeader Header;
+
+	// Events of the frame that is being recorded. They are written out behind its Frame event by EndFrame().
+	TArray<uint8> FrameEvents;
+	FVector FrameMovementInput = FVector::ZeroVector;
+	int16 LastMoveX = 0;
+	int16 LastMoveY = 0;
+	float LastLookX = 0.0f;
+	float LastLookY = 0.0f;
+
+	void WriteEvent(EMovementInput Input, const void* Payload = nullptr, int32 PayloadSize = 0);
+};
+
+/**
+* Memory-maps a movement input recording and feeds it back into any number of characters, one frame at a time.
+*
+* Every character is given the same input. Characters that aren't controlled by a local player can't take controller input, so their
+* yaw is turned directly and their pitch is ignored. Jumping, sprinting, crouching and leaning don't need a controller.
+*/
+class CYBERSTEALTH2021_API FMovementInputReplay {
+public:
+	~FMovementInputReplay();
+
+	/** Map the recording at Path. Fails if it can't be opened or isn't a recording of a version that can be read. */
+	bool Open(const FString& Path);
+	void Close();
+
+	int32 GetNumFrames() const { return Header.NumFrames; }
+	/** Number of frames that have been applied so far. */
+	int32 GetFrame() const { return Frame; }
+	bool IsFinished() const { return Cursor >= End; }
+
+	/**
+	* Apply the input of the next frame to every character in Characters, and return the delta time it was recorded with.
+	* Held axes are applied again on every frame. Returns false once the recording has no frames left.
+	*/
+	bool ApplyNextFrame(TArrayView<AStealthPlayerCharacter* const> Characters, float& OutDeltaTime);
+
+private:
+	IMappedFileHandle* MappedFile = nullptr;
+	IMappedFileRegion* MappedRegion = nullptr;
+	FMovementRecordingHeader Header;
+	const uint8* Cursor = nullptr;
+	const uint8* End = nullptr;
+	int32 Frame = 0;
+
+	// Axes as they were last recorded.
+	FVector2D Move = FVector2D::ZeroVector;
+	float LookX = 0.0f;
+	float LookY = 0.0f;
+
+	template<typename T>
+	bool Read(T& OutValue);
+	void ApplyHeldInput(AStealthPlayerCharacter* Character) const;
+	void ApplyEvent(AStealthPlayerCharacter* Character, EMovementInput Input, const float* Values) const;
+};
@@ -0,0 +1,237 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "BakeLedgeIndexCommandlet.h"
+#include "Core/Player/StealthPlayerCharacter.h"
+#include "Core/Player/StealthPlayerMovement.h"
+#include "Components/CapsuleComponent.h"
+#include "Engine/World.h"
+#include "Engine/Level.h"
+#include "Engine/LevelBounds.h"
+#include "Engine/LevelStreaming.h"
+#include "GameFramework/Actor.h"
+#include "Misc/PackageName.h"
+#include "UObject/Package.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogLedgeIndex, Log, All);
+
+UBakeLedgeIndexCommandlet::UBakeLedgeIndexCommandlet() {
+	IsClient = false;
+	IsEditor = true;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UBakeLedgeIndexCommandlet::Main(const FString& Params) {
+	FString MapName;
+	if (!FParse::Value(*Params, TEXT("Map="), MapName)) {
+		UE_LOG(LogLedgeIndex, Error, TEXT("No map specified. Usage: -run=BakeLedgeIndex -Map=/Game/Path/To/Map [-CharacterClass=/Game/Path/To/BP.BP_C] [-Spacing=8] [-CellSize=256]"));
+		return 1;
+	}
+	FParse::Value(*Params, TEXT("CharacterClass="), CharacterClassName);
+	FParse::Value(*Params, TEXT("Spacing="), SampleSpacing);
+	FParse::Value(*Params, TEXT("CellSize="), CellSize);
+
+	// Bake with the defaults of the character that is actually played, since its blueprint can override any of the C++ ones.
+	UClass* CharacterClass = LoadClass<AStealthPlayerCharacter>(nullptr, *CharacterClassName);
+	if (!CharacterClass) {
+		UE_LOG(LogLedgeIndex, Error, TEXT("Failed to load character class %s"), *CharacterClassName);
+		return 1;
+	}
+	const AStealthPlayerCharacter* PlayerDefaults = CharacterClass->GetDefaultObject<AStealthPlayerCharacter>();
+	const UStealthPlayerMovement* MovementDefaults = Cast<UStealthPlayerMovement>(PlayerDefaults->GetCharacterMovement());
+	if (!MovementDefaults) {
+		UE_LOG(LogLedgeIndex, Error, TEXT("Character class %s doesn't use UStealthPlayerMovement"), *CharacterClassName);
+		return 1;
+	}
+	CapsuleRadius = PlayerDefaults->GetCapsuleComponent()->GetUnscaledCapsuleRadius();
+	CapsuleHalfHeight = PlayerDefaults->StandingHeight;
+	MaxStepHeight = MovementDefaults->MaxStepHeight;
+	WalkableFloorZ = MovementDefaults->GetWalkableFloorZ();
+	// Anything lower than a full crouch can't be climbed onto, no matter how the player jumped.
+	MinClearance = MovementDefaults->CrouchedHalfHeight * 2.0f;
+
+	UPackage* MapPackage = LoadPackage(nullptr, *MapName, LOAD_None);
+	UWorld* World = MapPackage ? UWorld::FindWorldInPackage(MapPackage) : nullptr;
+	if (!World) {
+		UE_LOG(LogLedgeIndex, Error, TEXT("Failed to load map %s"), *MapName);
+		return 1;
+	}
+
+	World->WorldType = EWorldType::Editor;
+	World->AddToRoot();
+	if (!World->bIsWorldInitialized) {
+		UWorld::InitializationValues IVS;
+		IVS.RequiresHitProxies(false);
+		IVS.ShouldSimulatePhysics(false);
+		IVS.EnableTraceCollision(true);
+		IVS.CreateNavigation(false);
+		IVS.CreateAISystem(false);
+		IVS.AllowAudioPlayback(false);
+		IVS.CreatePhysicsScene(true);
+		World->InitWorld(IVS);
+	}
+	World->UpdateWorldComponents(true, false);
+
+	// Bake every sub-level together, so ledges along the seams between levels are still found.
+	for (ULevelStreaming* StreamingLevel : World->GetStreamingLevels()) {
+		StreamingLevel->SetShouldBeLoaded(true);
+		StreamingLevel->SetShouldBeVisible(true);
+	}
+	World->FlushLevelStreaming(EFlushLevelStreamingType::Full);
+
+	int32 NumFailed = 0;
+	for (ULevel* Level : World->GetLevels()) {
+		FBox Bounds = ALevelBounds::CalculateLevelBounds(Level);
+		if (!Bounds.IsValid) {
+			continue;
+		}
+
+		TArray<FLedgeRecord> Records;
+		BakeLevel(World, Level, Bounds, Records);
+		UE_LOG(LogLedgeIndex, Display, TEXT("Baked %d ledge points in %s"), Records.Num(), *Level->GetOutermost()->GetName());
+		if (!SaveIndex(Level, Bounds, MoveTemp(Records))) {
+			NumFailed++;
+		}
+	}
+
+	World->RemoveFromRoot();
+	World->DestroyWorld(false);
+	return NumFailed == 0 ? 0 : 1;
+}
+
+void UBakeLedgeIndexCommandlet::GetWalkableSurfaces(UWorld* World, float X, float Y, const FBox& Bounds, TArray<FSurfaceSample>& OutSurfaces) const {
+	OutSurfaces.Reset();
+	FVector Start(X, Y, Bounds.Max.Z + 1.0f);
+	const FVector End(X, Y, Bounds.Min.Z - 1.0f);
+
+	// Walk down through the column one surface at a time, since a multi trace only reports the first hit per component.
+	FHitResult Hit;
+	for (int32 i = 0; i < 64 && World->LineTraceSingleByObjectType(Hit, Start, End, FCollisionObjectQueryParams::AllStaticObjects); i++) {
+		if (Hit.ImpactNormal.Z >= WalkableFloorZ) {
+			OutSurfaces.Add({ Hit.ImpactPoint, Hit.GetActor() ? Hit.GetActor()->GetLevel() : nullptr });
+		}
+		Start.Z = Hit.ImpactPoint.Z - 1.0f;
+	}
+}
+
+bool UBakeLedgeIndexCommandlet::MakeRecord(UWorld* World, const FVector& Location, const FVector& Normal, FLedgeRecord& OutRecord) const {
+	// How much space is there above the ledge?
+	FHitResult Hit;
+	const float MaxCheck = CapsuleHalfHeight * 4.0f;
+	float Clearance = FLedgeRecord::MaxClearance;
+	if (World->LineTraceSingleByChannel(Hit, Location + FVector(0.0f, 0.0f, 1.0f), Location + FVector(0.0f, 0.0f, MaxCheck), ECollisionChannel::ECC_Visibility)) {
+		Clearance = Hit.Distance;
+	}
+	if (Clearance < MinClearance) {
+		return false;
+	}
+
+	// The same capsule tests TestForValidLedges() runs, done once here so the runtime only needs to confirm them.
+	FCollisionShape CapsuleCheck = FCollisionShape::MakeCapsule(CapsuleRadius, CapsuleHalfHeight);
+	FVector RoomStart = Location;
+	RoomStart.Z += CapsuleHalfHeight + 2.0f;
+	float StepUpHeight = 0.0f;
+	if (World->SweepSingleByChannel(Hit, RoomStart, RoomStart, FQuat::Identity, ECollisionChannel::ECC_Visibility, CapsuleCheck)) {
+		if (RoomStart.Z - CapsuleHalfHeight - Hit.ImpactPoint.Z > MaxStepHeight) {
+			return false;
+		}
+		StepUpHeight = FMath::Max(1.0f, Hit.ImpactPoint.Z - (RoomStart.Z - CapsuleHalfHeight));
+		FVector EdgeCaseStart = RoomStart + FVector(0.0f, 0.0f, StepUpHeight);
+		if (World->SweepSingleByChannel(Hit, EdgeCaseStart, EdgeCaseStart, FQuat::Identity, ECollisionChannel::ECC_Visibility, CapsuleCheck)) {
+			return false;
+		}
+	}
+
+	OutRecord.Location = Location;
+	OutRecord.NormalYaw = FRotator::CompressAxisToShort(Normal.Rotation().Yaw);
+	OutRecord.ClearanceHeight = (uint16)FMath::Min(FMath::CeilToFloat(Clearance), (float)FLedgeRecord::MaxClearance);
+	OutRecord.StepUpHeight = (uint8)FMath::Min(FMath::CeilToFloat(StepUpHeight), 255.0f);
+	return true;
+}
+
+void UBakeLedgeIndexCommandlet::BakeLevel(UWorld* World, ULevel* Level, const FBox& Bounds, TArray<FLedgeRecord>& OutRecords) const {
+	const int32 NumX = FMath::CeilToInt(Bounds.GetSize().X / SampleSpacing) + 1;
+	const int32 NumY = FMath::CeilToInt(Bounds.GetSize().Y / SampleSpacing) + 1;
+	const FVector2D Directions[] = { FVector2D(1.0f, 0.0f), FVector2D(-1.0f, 0.0f), FVector2D(0.0f, 1.0f), FVector2D(0.0f, -1.0f) };
+
+	// Keep three rows of samples around, the one being tested and its neighbours on either side.
+	TArray<TArray<FSurfaceSample>> Rows[3];
+	auto SampleRow = [&](int32 Y, TArray<TArray<FSurfaceSample>>& OutRow) {
+		OutRow.SetNum(NumX);
+		for (int32 X = 0; X < NumX; X++) {
+			if (Y < 0 || Y >= NumY) {
+				OutRow[X].Reset();
+				continue;
+			}
+			GetWalkableSurfaces(World, Bounds.Min.X + X * SampleSpacing, Bounds.Min.Y + Y * SampleSpacing, Bounds, OutRow[X]);
+		}
+	};
+	SampleRow(-1, Rows[0]);
+	SampleRow(0, Rows[1]);
+
+	for (int32 Y = 0; Y < NumY; Y++) {
+		SampleRow(Y + 1, Rows[2]);
+
+		for (int32 X = 0; X < NumX; X++) {
+			for (const FSurfaceSample& Surface : Rows[1][X]) {
+				if (Surface.Level != Level) {
+					continue;
+				}
+
+				for (const FVector2D& Direction : Directions) {
+					const int32 NeighbourX = X + (int32)Direction.X;
+					const TArray<TArray<FSurfaceSample>>& NeighbourRow = Rows[1 + (int32)Direction.Y];
+					if (NeighbourX < 0 || NeighbourX >= NumX) {
+						continue;
+					}
+
+					// If the neighbour has a floor within step height, the player would just walk over this edge.
+					bool bNeighbourIsStep = false;
+					for (const FSurfaceSample& Neighbour : NeighbourRow[NeighbourX]) {
+						if (FMath::Abs(Neighbour.Location.Z - Surface.Location.Z) <= MaxStepHeight) {
+							bNeighbourIsStep = true;
+							break;
+						}
+					}
+					if (bNeighbourIsStep) {
+						continue;
+					}
+
+					// Otherwise it's a ledge, as long as the neighbour is a drop rather than the inside of a wall.
+					FVector NeighbourPoint(Surface.Location.X + Direction.X * SampleSpacing, Surface.Location.Y + Direction.Y * SampleSpacing, Surface.Location.Z + 1.0f);
+					if (World->OverlapAnyTestByObjectType(NeighbourPoint, FQuat::Identity, FCollisionObjectQueryParams::AllStaticObjects, FCollisionShape::MakeSphere(0.5f))) {
+						continue;
+					}
+
+					FLedgeRecord Record;
+					if (MakeRecord(World, Surface.Location, FVector(Direction.X, Direction.Y, 0.0f), Record)) {
+						OutRecords.Add(Record);
+						// One record per surface point is enough, the runtime only needs its position.
+						break;
+					}
+				}
+			}
+		}
+
+		Swap(Rows[0], Rows[1]);
+		Swap(Rows[1], Rows[2]);
+	}
+}
+
+bool UBakeLedgeIndexCommandlet::SaveIndex(ULevel* Level, const FBox& Bounds, TArray<FLedgeRecord>&& Records) const {
+	const FString PackageName = ULedgeIndex::GetIndexPackageName(Level->GetOutermost()->GetName());
+	UPackage* Package = CreatePackage(*PackageName);
+	Package->FullyLoad();
+
+	ULedgeIndex* Index = NewObject<ULedgeIndex>(Package, *FPackageName::GetShortName(PackageName), RF_Public | RF_Standalone);
+	Index->Build(MoveTemp(Records), Bounds, CellSize, SampleSpacing);
+	Package->MarkPackageDirty();
+
+	const FString Filename = FPackageName::LongPackageNameToFilename(PackageName, FPackageName::GetAssetPackageExtension());
+	if (!UPackage::SavePackage(Package, Index, RF_Public | RF_Standalone, *Filename)) {
+		UE_LOG(LogLedgeIndex, Error, TEXT("Failed to save ledge index to %s"), *Filename);
+		return false;
+	}
+	return true;
+}
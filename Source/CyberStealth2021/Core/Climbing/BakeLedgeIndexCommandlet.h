@@ -0,0 +1,59 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "LedgeIndex.h"
+#include "BakeLedgeIndexCommandlet.generated.h"
+
+class ULevel;
+
+/**
+* Bakes every climbable ledge in a map into a ULedgeIndex per level.
+*
+* The commandlet loads the map and all of its sub-levels, then samples the static collision on a regular XY grid. At every grid
+* point it walks down through each walkable surface, and treats a surface as a ledge if a neighbouring grid point has no floor 
+* within step height of it. For each ledge it records the free space above it and whether the step-up edge case from 
+* UStealthPlayerMovement::TestForValidLedges() applies, using the same capsule tests. The index of each level is saved next to 
+* its BuiltData package.
+*
+* Usage: UE4Editor-Cmd CyberStealth2021.uproject -run=BakeLedgeIndex -Map=/Game/OpenSource/Maps/TestMap
+*     [-CharacterClass=/Game/OpenSource/Core/Player/StealthPlayerCharacterBP.StealthPlayerCharacterBP_C] [-Spacing=8] [-CellSize=256]
+*/
+UCLASS()
+class CYBERSTEALTH2021_API UBakeLedgeIndexCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UBakeLedgeIndexCommandlet();
+	virtual int32 Main(const FString& Params) override;
+
+private:
+	FString CharacterClassName = TEXT("/Game/OpenSource/Core/Player/StealthPlayerCharacterBP.StealthPlayerCharacterBP_C");
+	float SampleSpacing = 8.0f;
+	float CellSize = 256.0f;
+
+	// Taken from the defaults of the character class and its movement component, so the bake matches what the runtime ledge test would accept.
+	float CapsuleRadius = 0.0f;
+	float CapsuleHalfHeight = 0.0f;
+	float MaxStepHeight = 0.0f;
+	float WalkableFloorZ = 0.0f;
+
+	float MinClearance = 0.0f;
+
+	struct FSurfaceSample {
+		FVector Location;
+		const ULevel* Level;
+	};
+
+	/** Collects every walkable surface at the given XY position, from the top down. */
+	void GetWalkableSurfaces(UWorld* World, float X, float Y, const FBox& Bounds, TArray<FSurfaceSample>& OutSurfaces) const;
+
+	/** Runs the clearance and capsule tests for a candidate ledge. Returns false if the player could never stand on it. */
+	bool MakeRecord(UWorld* World, const FVector& Location, const FVector& Normal, FLedgeRecord& OutRecord) const;
+
+	void BakeLevel(UWorld* World, ULevel* Level, const FBox& Bounds, TArray<FLedgeRecord>& OutRecords) const;
+	bool SaveIndex(ULevel* Level, const FBox& Bounds, TArray<FLedgeRecord>&& Records) const;
+};
@@ -0,0 +1,64 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "LedgeIndex.h"
+#include "Engine/World.h"
+#include "Algo/BinarySearch.h"
+
+const TCHAR* ULedgeIndex::PackageSuffix = TEXT("_LedgeIndex");
+
+FString ULedgeIndex::GetIndexPackageName(const FString& LevelPackageName) {
+	return UWorld::RemovePIEPrefix(LevelPackageName) + PackageSuffix;
+}
+
+const FPrimaryAssetType ULedgeIndex::PrimaryAssetType = TEXT("LedgeIndex");
+
+FPrimaryAssetId ULedgeIndex::GetPrimaryAssetId() const {
+	// The index is named after its package, which is named after its level, so the name is unique per level.
+	return FPrimaryAssetId(PrimaryAssetType, GetFName());
+}
+
+void ULedgeIndex::Build(TArray<FLedgeRecord>&& InRecords, const FBox& InBounds, float InCellSize, float InSampleSpacing) {
+	CellSize = InCellSize;
+	SampleSpacing = InSampleSpacing;
+	Records = MoveTemp(InRecords);
+	Bounds = InBounds;
+	Cells.Reset();
+
+	Records.Sort([this](const FLedgeRecord& A, const FLedgeRecord& B) {
+		return GetCellKey(GetCellCoord(A.Location.X), GetCellCoord(A.Location.Y)) < GetCellKey(GetCellCoord(B.Location.X), GetCellCoord(B.Location.Y));
+	});
+
+	for (int32 i = 0; i < Records.Num(); i++) {
+		int64 Key = GetCellKey(GetCellCoord(Records[i].Location.X), GetCellCoord(Records[i].Location.Y));
+		if (Cells.Num() == 0 || Cells.Last().Key != Key) {
+			FLedgeCell& Cell = Cells.AddDefaulted_GetRef();
+			Cell.Key = Key;
+			Cell.FirstRecord = i;
+		}
+		Cells.Last().NumRecords++;
+	}
+}
+
+void ULedgeIndex::Query(const FBox& QueryBox, TArray<const FLedgeRecord*>& OutRecords) const {
+	const int32 MinX = GetCellCoord(QueryBox.Min.X);
+	const int32 MaxX = GetCellCoord(QueryBox.Max.X);
+	const int32 MinY = GetCellCoord(QueryBox.Min.Y);
+	const int32 MaxY = GetCellCoord(QueryBox.Max.Y);
+
+	for (int32 X = MinX; X <= MaxX; X++) {
+		for (int32 Y = MinY; Y <= MaxY; Y++) {
+			int32 CellIndex = Algo::BinarySearchBy(Cells, GetCellKey(X, Y), &FLedgeCell::Key);
+			if (CellIndex == INDEX_NONE) {
+				continue;
+			}
+
+			const FLedgeCell& Cell = Cells[CellIndex];
+			for (int32 i = Cell.FirstRecord; i < Cell.FirstRecord + Cell.NumRecords; i++) {
+				if (QueryBox.IsInside(Records[i].Location)) {
+					OutRecords.Add(&Records[i]);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,116 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Object.h"
+#include "LedgeIndex.generated.h"
+
+/** A single climbable ledge point, baked by UBakeLedgeIndexCommandlet. */
+USTRUCT()
+struct FLedgeRecord {
+	GENERATED_BODY()
+
+	// Point on the top surface of the ledge, right behind its edge. This is where the ledge scan would have hit it.
+	UPROPERTY()
+	FVector Location = FVector::ZeroVector;
+
+	// Yaw of the horizontal normal pointing away from the ledge, towards the side the player climbs up from. Packed with FRotator::CompressAxisToShort.
+	UPROPERTY()
+	uint16 NormalYaw = 0;
+
+	// Free vertical space above Location, in whole units. Capped at MaxClearance.
+	UPROPERTY()
+	uint16 ClearanceHeight = 0;
+
+	// If non-zero, a standing capsule placed on the ledge touches something low enough to step over, and has to be raised by this many units to fit.
+	// This is the "step-up" edge case from UStealthPlayerMovement::TestForValidLedges().
+	UPROPERTY()
+	uint8 StepUpHeight = 0;
+
+	static constexpr uint16 MaxClearance = TNumericLimits<uint16>::Max();
+
+	FVector GetNormal() const { return FRotator(0.0f, FRotator::DecompressAxisFromShort(NormalYaw), 0.0f).Vector(); }
+	bool IsStepUpEdgeCase() const { return StepUpHeight != 0; }
+};
+
+/** A run of records in ULedgeIndex::Records that all fall inside the same grid cell. */
+USTRUCT()
+struct FLedgeCell {
+	GENERATED_BODY()
+
+	UPROPERTY()
+	int64 Key = 0;
+	UPROPERTY()
+	int32 FirstRecord = 0;
+	UPROPERTY()
+	int32 NumRecords = 0;
+};
+
+/**
+* Baked spatial index of every climbable ledge in a single level.
+*
+* The index is a 2D uniform grid over the level. Records are sorted by the cell they fall into, and Cells is sorted by cell key,
+* so a lookup is a binary search per cell and a linear walk over a contiguous block of records.
+* One of these is saved next to each level's BuiltData package by the BakeLedgeIndex commandlet, and streamed in and out
+* alongside its level by ULedgeIndexSubsystem.
+*
+* Nothing references an index directly, since it is only ever loaded by name. It is a primary asset instead, and the
+* asset manager rule for its type in DefaultGame.ini is what gets it cooked.
+*/
+UCLASS()
+class CYBERSTEALTH2021_API ULedgeIndex : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	/** Suffix appended to a level's package name to get the package its index is saved into, like "_BuiltData" for the lighting data. */
+	static const TCHAR* PackageSuffix;
+
+	/** Get the package name the ledge index for the level in the given package is saved to. PIE prefixes are stripped. */
+	static FString GetIndexPackageName(const FString& LevelPackageName);
+
+	/** Primary asset type of every ledge index, as registered with the asset manager in DefaultGame.ini. */
+	static const FPrimaryAssetType PrimaryAssetType;
+
+	virtual FPrimaryAssetId GetPrimaryAssetId() const override;
+
+	/**
+	* Replaces the contents of the index with the given records.
+	*
+	* @param InRecords - All the ledges in the level, in any order.
+	* @param InBounds - The area that was baked. Lookups inside it are authoritative, even if they find nothing.
+	* @param InCellSize - Size of a grid cell, in units. Should be larger than the area usually queried at once.
+	* @param InSampleSpacing - The distance between the points the level was sampled at when baking.
+	*/
+	void Build(TArray<FLedgeRecord>&& InRecords, const FBox& InBounds, float InCellSize, float InSampleSpacing);
+
+	/**
+	* Finds every ledge inside the given box.
+	*
+	* @param QueryBox - World space box to search.
+	* @param OutRecords - Filled with pointers to the matching records. Not cleared first.
+	*/
+	void Query(const FBox& QueryBox, TArray<const FLedgeRecord*>& OutRecords) const;
+
+	/** True if the index was baked over the given point, so a lack of results there really means there are no ledges. */
+	bool Covers(const FVector& Location) const { return Bounds.IsValid && Bounds.IsInsideXY(Location); }
+
+	float GetSampleSpacing() const { return SampleSpacing; }
+	int32 GetNumRecords() const { return Records.Num(); }
+
+private:
+	UPROPERTY()
+	TArray<FLedgeRecord> Records;
+	UPROPERTY()
+	TArray<FLedgeCell> Cells;
+	UPROPERTY()
+	FBox Bounds = FBox(ForceInit);
+	UPROPERTY()
+	float CellSize = 256.0f;
+	UPROPERTY()
+	float SampleSpacing = 8.0f;
+
+	int64 GetCellKey(int32 X, int32 Y) const { return (int64)(((uint64)(uint32)X << 32) | (uint32)Y); }
+	int32 GetCellCoord(float Value) const { return FMath::FloorToInt(Value / CellSize); }
+};
@@ -0,0 +1,99 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "LedgeIndexSubsystem.h"
+#include "LedgeIndex.h"
+#include "Engine/World.h"
+#include "Engine/Level.h"
+#include "Misc/PackageName.h"
+#include "UObject/Package.h"
+
+bool ULedgeIndexSubsystem::ShouldCreateSubsystem(UObject* Outer) const {
+	UWorld* World = Cast<UWorld>(Outer);
+	return World && World->IsGameWorld();
+}
+
+void ULedgeIndexSubsystem::Initialize(FSubsystemCollectionBase& Collection) {
+	Super::Initialize(Collection);
+	LevelAddedHandle = FWorldDelegates::LevelAddedToWorld.AddUObject(this, &ULedgeIndexSubsystem::OnLevelAdded);
+	LevelRemovedHandle = FWorldDelegates::LevelRemovedFromWorld.AddUObject(this, &ULedgeIndexSubsystem::OnLevelRemoved);
+
+	// The persistent level is never "added" to the world, so pick it up right away.
+	if (GetWorld()->PersistentLevel) {
+		LoadIndexForLevel(GetWorld()->PersistentLevel);
+	}
+}
+
+void ULedgeIndexSubsystem::Deinitialize() {
+	FWorldDelegates::LevelAddedToWorld.Remove(LevelAddedHandle);
+	FWorldDelegates::LevelRemovedFromWorld.Remove(LevelRemovedHandle);
+	LoadedIndices.Empty();
+	IndexReferences.Empty();
+	Super::Deinitialize();
+}
+
+bool ULedgeIndexSubsystem::IsCovered(const FVector& Location) const {
+	for (const FLoadedIndex& Loaded : LoadedIndices) {
+		if (Loaded.Index->Covers(Location)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void ULedgeIndexSubsystem::Query(const FBox& QueryBox, TArray<const FLedgeRecord*>& OutRecords) const {
+	OutRecords.Reset();
+	for (const FLoadedIndex& Loaded : LoadedIndices) {
+		if (Loaded.Index->Covers(QueryBox.GetCenter())) {
+			// A baked record can be up to one sample away from the real edge it stands for.
+			const float SampleSpacing = Loaded.Index->GetSampleSpacing();
+			Loaded.Index->Query(QueryBox.ExpandBy(FVector(SampleSpacing, SampleSpacing, 0.0f)), OutRecords);
+		}
+	}
+}
+
+void ULedgeIndexSubsystem::LoadIndexForLevel(ULevel* Level) {
+	const FString IndexPackageName = ULedgeIndex::GetIndexPackageName(Level->GetOutermost()->GetName());
+	if (!FPackageName::DoesPackageExist(IndexPackageName)) {
+		return;
+	}
+
+	LoadPackageAsync(IndexPackageName, FLoadPackageAsyncDelegate::CreateUObject(this, &ULedgeIndexSubsystem::OnIndexPackageLoaded, TWeakObjectPtr<ULevel>(Level)));
+}
+
+void ULedgeIndexSubsystem::OnLevelAdded(ULevel* Level, UWorld* World) {
+	if (World == GetWorld() && Level) {
+		LoadIndexForLevel(Level);
+	}
+}
+
+void ULedgeIndexSubsystem::OnLevelRemoved(ULevel* Level, UWorld* World) {
+	if (World != GetWorld()) {
+		return;
+	}
+
+	// A null level means every level is being removed from the world.
+	for (int32 i = LoadedIndices.Num() - 1; i >= 0; i--) {
+		if (!Level || !LoadedIndices[i].Level.IsValid() || LoadedIndices[i].Level.Get() == Level) {
+			IndexReferences.Remove(LoadedIndices[i].Index);
+			LoadedIndices.RemoveAtSwap(i);
+		}
+	}
+}
+
+void ULedgeIndexSubsystem::OnIndexPackageLoaded(const FName& PackageName, UPackage* LoadedPackage, EAsyncLoadingResult::Type Result, TWeakObjectPtr<ULevel> Level) {
+	// The level may have been streamed back out while its index was loading.
+	if (Result != EAsyncLoadingResult::Succeeded || !LoadedPackage || !Level.IsValid()) {
+		return;
+	}
+
+	ULedgeIndex* Index = FindObject<ULedgeIndex>(LoadedPackage, *FPackageName::GetShortName(PackageName));
+	if (!Index) {
+		return;
+	}
+
+	FLoadedIndex& Loaded = LoadedIndices.AddDefaulted_GetRef();
+	Loaded.Level = Level;
+	Loaded.Index = Index;
+	IndexReferences.Add(Index);
+}
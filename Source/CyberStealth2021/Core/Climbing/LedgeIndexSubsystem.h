@@ -0,0 +1,61 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "UObject/UObjectGlobals.h"
+#include "LedgeIndexSubsystem.generated.h"
+
+class ULedgeIndex;
+class ULevel;
+struct FLedgeRecord;
+
+/**
+* Keeps the baked ULedgeIndex of every loaded level in memory, so that ledge detection can look ledges up instead of tracing for them.
+*
+* Indices are loaded asynchronously whenever their level is added to the world, and dropped again when it is removed,
+* so they are streamed in and out along with their sub-levels. Levels that were never baked simply have no index, and
+* callers should fall back to tracing there.
+*/
+UCLASS()
+class CYBERSTEALTH2021_API ULedgeIndexSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	/** True if a loaded index covers the given location, meaning Query() is authoritative there. */
+	bool IsCovered(const FVector& Location) const;
+
+	/**
+	* Finds every baked ledge inside the given box, across all loaded levels.
+	*
+	* The box is widened by each index's sample spacing, since that's how far a baked record can be from the edge it stands for.
+	*
+	* @param OutRecords - Cleared and filled with the matching records. They stay valid until the next level streaming change.
+	*/
+	void Query(const FBox& QueryBox, TArray<const FLedgeRecord*>& OutRecords) const;
+
+private:
+	struct FLoadedIndex {
+		TWeakObjectPtr<ULevel> Level;
+		ULedgeIndex* Index = nullptr;
+	};
+	TArray<FLoadedIndex> LoadedIndices;
+
+	// Holds a reference to every loaded index so they aren't garbage collected while their level is loaded.
+	UPROPERTY(Transient)
+	TArray<ULedgeIndex*> IndexReferences;
+
+	FDelegateHandle LevelAddedHandle;
+	FDelegateHandle LevelRemovedHandle;
+
+	void LoadIndexForLevel(ULevel* Level);
+	void OnLevelAdded(ULevel* Level, UWorld* World);
+	void OnLevelRemoved(ULevel* Level, UWorld* World);
+	void OnIndexPackageLoaded(const FName& PackageName, UPackage* LoadedPackage, EAsyncLoadingResult::Type Result, TWeakObjectPtr<ULevel> Level);
+};
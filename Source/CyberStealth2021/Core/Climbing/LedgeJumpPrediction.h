@@ -0,0 +1,97 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/PrimitiveComponent.h"
+
+/**
+* The predicted arc of a jump from liftoff to apex, and every piece of static geometry the ledge scan could touch along it.
+*
+* Built once right after the liftoff step by UStealthPlayerMovement::PredictJumpLedges() with a single overlap over the whole arc, so
+* that TestForValidLedges() only has to test the ledge scan against the cached components each frame, rather than sweeping the
+* scene again. Times are on the component's movement clock, so fixed steps advance the arc exactly as they advance the player.
+*
+* The box around the arc is widened by as far as air control can push the player along any one direction before the apex, so
+* steering and looking around mid-air stay inside it. The prediction is only rebuilt if the ledge scan leaves the box anyway,
+* for example after bumping into a wall or air strafing.
+*/
+struct FLedgeJumpPrediction {
+	bool bValid = false;
+
+	// Movement clock time, capsule location and velocity at the point the arc was predicted from.
+	float StartTime = 0.0f;
+	FVector StartLocation = FVector::ZeroVector;
+	FVector StartVelocity = FVector::ZeroVector;
+	float GravityZ = 0.0f;
+	// Seconds from StartTime until the apex, after which ledges can no longer be grabbed.
+	float ApexTime = 0.0f;
+
+	// The box the candidates were gathered from.
+	FVector BoxCenter = FVector::ZeroVector;
+	FVector BoxExtent = FVector::ZeroVector;
+	FQuat BoxRotation = FQuat::Identity;
+
+	// Every static component found along the arc, highest first, with the bounds it had then. Static geometry doesn't move, so
+	// the bounds are kept to skip components without touching them, and the union to skip frames where the scan hits none.
+	TArray<TWeakObjectPtr<UPrimitiveComponent>> Candidates;
+	TArray<FBox> CandidateBounds;
+	FBox AllCandidateBounds = FBox(ForceInit);
+
+	void Reset() {
+		bValid = false;
+		Candidates.Reset();
+		CandidateBounds.Reset();
+		AllCandidateBounds = FBox(ForceInit);
+	}
+
+	/**
+	* Predicts the arc from the given state, and the box around it that the ledge scan can reach before the apex.
+	*
+	* @param Reach - How far from the capsule the ledge scan can reach horizontally, facing any direction.
+	* @param ScanTop - Height of the top of the ledge scan above the capsule's center.
+	* @param ScanBottom - Height of the bottom of the ledge scan above the capsule's center, usually negative.
+	* @param AirSpeedCap - Most speed air control can add along any one direction, see UPBPlayerMovement.
+	* @return False if the player is no longer rising, in which case there is nothing left to predict.
+	*/
+	bool Build(float Time, const FVector& Location, const FVector& Velocity, float InGravityZ, float Reach, float ScanTop, float ScanBottom, float AirSpeedCap) {
+		Reset();
+		if (InGravityZ >= 0.0f || Velocity.Z <= 0.0f) {
+			return false;
+		}
+
+		StartTime = Time;
+		StartLocation = Location;
+		StartVelocity = Velocity;
+		GravityZ = InGravityZ;
+		ApexTime = StartVelocity.Z / -GravityZ;
+
+		// Without input, the horizontal velocity stays the same in the air, so the arc is a straight line from above.
+		const FVector ApexLocation = GetLocationAt(StartTime + ApexTime);
+		const FVector HorizontalTravel = FVector(ApexLocation.X - StartLocation.X, ApexLocation.Y - StartLocation.Y, 0.0f);
+		const float SteeringReach = Reach + (AirSpeedCap * ApexTime);
+		const float BoxBottom = StartLocation.Z + ScanBottom;
+		const float BoxTop = ApexLocation.Z + ScanTop;
+
+		BoxCenter = StartLocation + (HorizontalTravel * 0.5f);
+		BoxCenter.Z = (BoxBottom + BoxTop) * 0.5f;
+		BoxExtent = FVector((HorizontalTravel.Size() * 0.5f) + SteeringReach, SteeringReach, (BoxTop - BoxBottom) * 0.5f);
+		BoxRotation = HorizontalTravel.IsNearlyZero() ? FQuat::Identity : HorizontalTravel.ToOrientationQuat();
+		return true;
+	}
+
+	/** Where the capsule would be at the given movement clock time without any input. Clamped to the liftoff and the apex. */
+	FVector GetLocationAt(float Time) const {
+		const float t = FMath::Clamp(Time - StartTime, 0.0f, ApexTime);
+		return StartLocation + (StartVelocity * t) + FVector(0.0f, 0.0f, 0.5f * GravityZ * t * t);
+	}
+
+	/** True if a vertical column of the given radius between the two points lies entirely inside the overlapped box. */
+	bool Covers(const FVector& ColumnTop, const FVector& ColumnBottom, float Radius) const {
+		// The box only ever turns around Z, so the column stays vertical in its space.
+		const FVector LocalTop = BoxRotation.UnrotateVector(ColumnTop - BoxCenter);
+		const FVector LocalBottom = BoxRotation.UnrotateVector(ColumnBottom - BoxCenter);
+		return FMath::Abs(LocalTop.X) + Radius <= BoxExtent.X && FMath::Abs(LocalTop.Y) + Radius <= BoxExtent.Y
+			&& LocalTop.Z + Radius <= BoxExtent.Z && LocalBottom.Z - Radius >= -BoxExtent.Z;
+	}
+};
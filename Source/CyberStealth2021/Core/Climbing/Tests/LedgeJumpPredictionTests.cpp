@@ -0,0 +1,86 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "Character/PBMovementKernel.h"
+#include "../LedgeJumpPrediction.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace {
+	// Defaults of UStealthPlayerMovement and UPBPlayerMovement, and the engine's gravity.
+	constexpr float GravityZ = -980.0f;
+	constexpr float JumpZVelocity = 304.8f;
+	constexpr float MaxAcceleration = 857.25f;
+	constexpr float MaxClimbAngle = 35.0f;
+	constexpr float ScanRadius = 5.0f;
+	constexpr float PredictionMargin = 10.0f;
+	// The ledge scan of a standing capsule (half height 68): from 15 above the head down to MaxStepHeight above the feet.
+	constexpr float ScanTop = 83.0f;
+	constexpr float ScanBottom = -18.71f;
+
+	/**
+	* Jumps with the given horizontal speed while the camera turns at a constant rate, with the input held at a fixed angle
+	* to the view, and counts how many times the ledges along the arc are predicted until the apex. Mirrors
+	* UStealthPlayerMovement::TestForPredictedLedges(), with the air movement of UPBPlayerMovement.
+	*/
+	int32 CountPredictionsPerJump(float Speed, float TurnDegreesPerSecond, float InputDegrees) {
+		const PBMovementKernel::FMovementParams Params;
+		const float StepDeltaTime = 1.0f / 60.0f;
+		const float Reach = MaxClimbAngle + ScanRadius + PredictionMargin;
+		const float Top = ScanTop + ScanRadius + PredictionMargin;
+		const float Bottom = ScanBottom - ScanRadius - PredictionMargin;
+
+		float Time = 0.0f;
+		float Yaw = 0.0f;
+		FVector Location = FVector::ZeroVector;
+		FVector Velocity(Speed, 0.0f, JumpZVelocity);
+		FLedgeJumpPrediction Prediction;
+		Prediction.Build(Time, Location, Velocity, GravityZ, Reach, Top, Bottom, Params.AirSpeedCap);
+		int32 NumPredictions = 1;
+
+		while (Velocity.Z > 0.0f) {
+			Yaw += TurnDegreesPerSecond * StepDeltaTime;
+			const FVector InputDirection = FRotator(0.0f, Yaw + InputDegrees, 0.0f).Vector();
+			PBMovementKernel::FKernelVector KernelVelocity = { Velocity.X, Velocity.Y, Velocity.Z };
+			PBMovementKernel::FKernelVector KernelAcceleration = { InputDirection.X * MaxAcceleration, InputDirection.Y * MaxAcceleration, 0.0f };
+			PBMovementKernel::ApplyAcceleration(KernelVelocity, KernelAcceleration, MaxAcceleration, 1.0f, false, Params, StepDeltaTime);
+			Velocity = FVector(KernelVelocity.X, KernelVelocity.Y, KernelVelocity.Z + (GravityZ * StepDeltaTime));
+			Location += Velocity * StepDeltaTime;
+			Time += StepDeltaTime;
+
+			// The scan is a column in front of the capsule, which faces the view.
+			const FVector ScanLocation = Location + (FRotator(0.0f, Yaw, 0.0f).Vector() * MaxClimbAngle);
+			if (!Prediction.Covers(ScanLocation + FVector(0.0f, 0.0f, ScanTop), ScanLocation + FVector(0.0f, 0.0f, ScanBottom), ScanRadius)) {
+				if (Prediction.Build(Time, Location, Velocity, GravityZ, Reach, Top, Bottom, Params.AirSpeedCap)) {
+					NumPredictions++;
+				}
+			}
+		}
+		return NumPredictions;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLedgeJumpPredictionTurningTest, "CyberStealth.Movement.Climbing.JumpPredictionsUnderTurning",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FLedgeJumpPredictionTurningTest::RunTest(const FString& Parameters) {
+	const float Speeds[] = { 0.0f, 361.9f, 609.6f };
+	const float TurnRates[] = { 0.0f, 90.0f, 180.0f, 360.0f };
+	for (float Speed : Speeds) {
+		for (float TurnRate : TurnRates) {
+			// Looking around while holding forward is steering, which the predicted box allows for, so it is predicted once.
+			TestEqual(FString::Printf(TEXT("Predictions looking around at %.0f deg/s, running at %.0f"), TurnRate, Speed),
+				CountPredictionsPerJump(Speed, TurnRate, 0.0f), 1);
+			TestEqual(FString::Printf(TEXT("Predictions looking the other way at %.0f deg/s, running at %.0f"), TurnRate, Speed),
+				CountPredictionsPerJump(Speed, -TurnRate, 0.0f), 1);
+			// Strafing while turning gains speed past AirSpeedCap, which only takes a few more predictions.
+			TestTrue(FString::Printf(TEXT("Predictions air strafing at %.0f deg/s, running at %.0f"), TurnRate, Speed),
+				CountPredictionsPerJump(Speed, TurnRate, 90.0f) <= 3);
+		}
+	}
+	return true;
+}
+
+#endif
@@ -5,16 +5,21 @@
 #include "StealthPlayerCharacter.h"
 #include "StealthPlayerMovement.h"
 #include "Math/UnrealMathUtility.h"
-#include "GameFramework/SpringArmComponent.h"
+#include "StealthCameraAnchorComponent.h"
 #include "Camera/CameraComponent.h"
 #include "Kismet/KismetMathLibrary.h"
+#include "StealthMovementStats.h"
+
+DECLARE_CYCLE_STAT(TEXT("CameraFX Tick"), STAT_CameraFX_Tick, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("CameraFX Tilt"), STAT_CameraFX_Tilt, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("CameraFX Update FOV"), STAT_CameraFX_UpdateFOV, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("CameraFX Update Bob"), STAT_CameraFX_UpdateBob, STATGROUP_StealthMovement);
 
 // Sets default values for this component's properties
 UCameraFXHandler::UCameraFXHandler()
 {
-	// Set this component to be initialized when the game starts, and to be ticked every frame.  You can turn these features
-	// off to improve performance if you don't need them.
-	PrimaryComponentTick.bCanEverTick = true;
+	// Ticked by the owning UStealthPlayerMovement, see TickCameraFX().
+	PrimaryComponentTick.bCanEverTick = false;
 
 	PlayerRef = Cast<AStealthPlayerCharacter>(GetOwner());
 }
@@ -25,94 +30,114 @@ void UCameraFXHandler::BeginPlay()
 {
 	Super::BeginPlay();
 	NewFOV = PlayerRef->GetPlayerCamera()->FieldOfView;
+	CurrentFOV = NewFOV;
+	CameraLayers.Initialize(PlayerRef->GetCameraAnchor(), PlayerRef->GetPlayerCamera());
+
+	FHeadBobSettings BobSettings;
+	BobSettings.StepFrequency = StepFrequency;
+	BobSettings.StepVariation = StepVariation;
+	BobSettings.ZHeight = zHeightMult;
+	BobSettings.ZHeightVariation = zHeightVariation;
+	BobSettings.Sway = SwayAmount;
+	BobSettings.SwayVariation = SwayVariation;
+	BobSettings.Roll = BobRollAmount;
+	BobSettings.RollVariation = BobRollVariation;
+	BobGenerator.Initialize(BobSettings, BobRandomSeed != 0 ? BobRandomSeed : (int32)GetTypeHash(GetOwner()->GetFName()));
+	bAwake = true;
 }
 
-void UCameraFXHandler::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) {
-	if (!PlayerRef->GetStealthMovementComp()->GetInSlideState()) {
-		UpdateFOV(DeltaTime);
-		UpdateCameraBob(DeltaTime);
+void UCameraFXHandler::TickCameraFX(float DeltaTime) {
+	if (!bAwake && (PlayerRef->GetVelocity().SizeSquared2D() != 0.0f || HasMovementInput())) {
+		bAwake = true;
+	}
+
+	if (bAwake) {
+		SCOPE_CYCLE_COUNTER(STAT_CameraFX_Tick);
+		UpdateTilt(DeltaTime);
+		if (!PlayerRef->GetStealthMovementComp()->GetInSlideState()) {
+			UpdateFOV(DeltaTime);
+			UpdateCameraBob(DeltaTime);
+			bAwake = !CanSleep();
+		}
 	}
+
+	// The one place the camera components are written to during a frame.
+	CameraLayers.Apply();
+}
+
+bool UCameraFXHandler::CanSleep() const {
+	// Once the bob has faded out completely every further update would write the same camera transform again.
+	return BobGenerator.IsAtRest() && NewFOV == CurrentFOV
+		&& CameraLayers.GetLayer(ECameraLayer::StrafeTilt).Rotation.Roll == 0.0f && CameraLayers.GetLayer(ECameraLayer::SlideTilt).Rotation.Roll == 0.0f
+		&& PlayerRef->GetVelocity().SizeSquared2D() == 0.0f && !HasMovementInput();
+}
+
+bool UCameraFXHandler::HasMovementInput() const {
+	return !PlayerRef->GetLastMovementInputVector().IsZero();
 }
 
-void UCameraFXHandler::TiltPlayerCamera(float DeltaTime, float TiltAmount, float TransitionSpeed) {
-	FRotator newTilt(0.0f, 0.0f, FMath::FInterpTo(PlayerRef->GetCameraAnchor()->GetRelativeRotation().Roll, TiltAmount, DeltaTime, TransitionSpeed));
-	PlayerRef->GetCameraAnchor()->SetRelativeRotation(newTilt);
+void UCameraFXHandler::UpdateTilt(float DeltaTime) {
+	if (PlayerRef->GetStealthMovementComp()->GetInSlideState()) {
+		// The slide state tilts the camera itself.
+		return;
+	}
+	TiltPlayerCamera(DeltaTime, ECameraLayer::SlideTilt, 0.0f, slideTiltExitTime);
+
+	// Forward input isn't exactly perpendicular to the right vector, so ignore whatever is left of it.
+	const float Strafe = FVector::DotProduct(PlayerRef->GetLastMovementInputVector(), PlayerRef->GetActorRightVector());
+	if (Strafe > KINDA_SMALL_NUMBER) {
+		TiltPlayerCamera(DeltaTime, ECameraLayer::StrafeTilt, strafeTiltAmount, strafeTiltEnterTime);
+	}
+	else if (Strafe < -KINDA_SMALL_NUMBER) {
+		TiltPlayerCamera(DeltaTime, ECameraLayer::StrafeTilt, -strafeTiltAmount, strafeTiltEnterTime);
+	}
+	else {
+		TiltPlayerCamera(DeltaTime, ECameraLayer::StrafeTilt, 0.0f, strafeTiltExitTime);
+	}
+}
+
+void UCameraFXHandler::TiltPlayerCamera(float DeltaTime, ECameraLayer Layer, float TiltAmount, float TransitionSpeed) {
+	SCOPE_CYCLE_COUNTER(STAT_CameraFX_Tilt);
+	const float CurrentRoll = CameraLayers.GetLayer(Layer).Rotation.Roll;
+	if (CurrentRoll == TiltAmount) {
+		return;
+	}
+	FRotator newTilt(0.0f, 0.0f, FMath::FInterpTo(CurrentRoll, TiltAmount, DeltaTime, TransitionSpeed));
+	CameraLayers.SetRotation(Layer, newTilt);
+	WakeUp();
 }
 
 void UCameraFXHandler::UpdateFOV(float DeltaTime) {
-	if (NewFOV != PlayerRef->GetPlayerCamera()->FieldOfView) {
-		PlayerRef->GetPlayerCamera()->FieldOfView = FMath::FInterpTo(PlayerRef->GetPlayerCamera()->FieldOfView, NewFOV, DeltaTime, FOVTransitionSpeed);
+	SCOPE_CYCLE_COUNTER(STAT_CameraFX_UpdateFOV);
+	if (NewFOV != CurrentFOV) {
+		CurrentFOV = FMath::FInterpTo(CurrentFOV, NewFOV, DeltaTime, FOVTransitionSpeed);
 	}
 
-	if (FMath::IsNearlyEqual(NewFOV, PlayerRef->GetPlayerCamera()->FieldOfView, 0.1f)) {
-		PlayerRef->GetPlayerCamera()->FieldOfView = NewFOV;
+	if (FMath::IsNearlyEqual(NewFOV, CurrentFOV, 0.1f)) {
+		CurrentFOV = NewFOV;
 	}
+	CameraLayers.SetFOV(ECameraLayer::FOV, CurrentFOV - CameraLayers.GetBaseFOV());
 }
 
 void UCameraFXHandler::RequestNewFOV(float NewFOVParam, float TransitionSpeed) {
 	NewFOV = NewFOVParam;
 	FOVTransitionSpeed = TransitionSpeed;
+	WakeUp();
 }
 
 
 void UCameraFXHandler::UpdateCameraBob(float DeltaTime) {
+	SCOPE_CYCLE_COUNTER(STAT_CameraFX_UpdateBob);
 	// TODO: Replace this with a slider that can adjust bob intensity or disable entirely.
 	if (!bEnableBob) {
 		return;
 	}
 
-	float Velocity = FVector(PlayerRef->GetVelocity().X, PlayerRef->GetVelocity().Y, 0).Size();
-
-	if (Velocity != 0.0f) {
-		// TODO: Dehardcode min and max speed values
-		VelMultiplier = FMath::GetMappedRangeValueClamped(FVector2D(120.0f, 610.0f),
-			FVector2D(0.5f, 1.5f), Velocity);
-
-		// Check if we have just placed a foot on the ground (ie, are we at the bottom of the parabolic curve)
-		if (((oldOldZPos > oldZPos) && oldZPos < zPos) || zPos == 0.0f) {
-			// Use Perlin Noise instead of a totally random value to avoid extreme sudden changes in step frequency.
-			RandomizedStepFrequency = FMath::GetMappedRangeValueClamped(FVector2D(-1.0f, 1.0f),
-				FVector2D(StepFrequency - StepFrequency * (StepVariation / 100),
-					StepFrequency + StepFrequency * (StepVariation / 100)),
-				FMath::PerlinNoise1D(Offset));
-			RandomizedZHeightMult = FMath::RandRange(zHeightMult - zHeightMult * (zHeightVariation / 100),
-				zHeightMult + zHeightMult * (zHeightVariation / 100));
-			PlayerRef->OnPlayerStepped();
-		}
-
-		// Check if weve finished a cycle for side-to-side or camera roll movement. (The sine functions for these start at 0).
-		if (oldYPos <= 0.0f && yPos >= 0.0f) {
-			RandomizedSwayAmount = FMath::RandRange(SwayAmount - SwayAmount * (SwayVariation / 100),
-				SwayAmount + SwayAmount * (SwayAmount / 100));
-			RandomizedBobRollAmount = FMath::RandRange(BobRollAmount - BobRollAmount * (BobRollVariation / 100),
-				BobRollAmount + BobRollAmount * (BobRollVariation / 100));
-		}
-	}
-	else {
-		VelMultiplier = 0.0f;
-	}
-
-	Offset += RandomizedStepFrequency * DeltaTime * VelMultiplier;
-
-	float fadeDirection = Velocity < 0.1f ? 0 : 1;
-	FadeOut = FMath::FInterpTo(FadeOut, fadeDirection, DeltaTime, 5);
-
-	oldOldZPos = oldZPos;
-	oldZPos = zPos;
-	// Add an additional offset so that we start at the top of a parabola, bringing the camera down towards placing the first step.
-	zPos = FMath::Abs(FMath::Sin(Offset + 0.5f * 3.141592)) * RandomizedZHeightMult * FadeOut;
-
-	// Don't fade out the side to side movement because it can look weird. Side to side movement shouldnt be that dramatic anyway.
-	oldYPos = yPos;
-	yPos = FMath::Sin(Offset) * RandomizedSwayAmount;
-
-	FVector newLocation(0, 0, 0);
-	newLocation = newLocation + FVector(0.0f, yPos, zPos);
-	PlayerRef->GetPlayerCamera()->SetRelativeLocation(newLocation);
+	const float Velocity = FVector(PlayerRef->GetVelocity().X, PlayerRef->GetVelocity().Y, 0).Size();
+	const FHeadBobPose Pose = BobGenerator.Advance(DeltaTime, Velocity, [this](float SecondsAgo) {
+		PlayerRef->OnPlayerStepped(SecondsAgo);
+	});
 
-	// Create a new Rotator to be added to the player camera rotation.
-	float RollAmountThisFrame = FMath::Sin(Offset) * RandomizedBobRollAmount * FadeOut;
-	FRotator BobRotation(0.0f, 0.0f, RollAmountThisFrame);
-	// Apply specifically to the camera instead of the anchor, so we can layer different rotations on top of each other.
-	PlayerRef->GetPlayerCamera()->SetRelativeRotation(BobRotation);
+	CameraLayers.SetLocation(ECameraLayer::Bob, FVector(0.0f, Pose.Y, Pose.Z));
+	CameraLayers.SetRotation(ECameraLayer::Bob, FRotator(0.0f, 0.0f, Pose.Roll));
 }
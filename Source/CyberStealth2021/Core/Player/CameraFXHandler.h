@@ -4,6 +4,8 @@
 
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
+#include "CameraLayerStack.h"
+#include "HeadBobGenerator.h"
 #include "CameraFXHandler.generated.h"
 
 class AStealthPlayerCharacter;
@@ -18,25 +20,44 @@ public:
 	// Sets default values for this component's properties
 	UCameraFXHandler();
 
+	/**
+	* Advance the head bob and FOV by a frame. Called from the owning UStealthPlayerMovement's tick instead of a tick of its own.
+	*
+	* The handler falls asleep once the player stands still, the bob and tilts have faded out and the FOV has reached its target, and
+	* only checks the velocity and movement input until something wakes it again. The camera layers are applied either way.
+	*
+	* @param DeltaTime - Current delta time in seconds.
+	*/
+	void TickCameraFX(float DeltaTime);
+	void WakeUp() { bAwake = true; }
+	bool IsAwake() const { return bAwake; }
+
 	/**
 	* Shifts the Camera position while moving in a "heab-bob" pattern.
 	*
 	* This will move the camera up and down in a parabolic pattern, side-to-side with a sin wave, and slightly roll the camera.
+	* The bob is generated by FHeadBobGenerator, which also tells the player when each step lands.
 	*
 	* @param DeltaTime - Current delta time in seconds.
 	*/
 	void UpdateCameraBob(float DeltaTime);
 	/**
-	* Tilt/roll the player camera over specified time.
+	* Tilt/roll the player camera over specified time. Every layer tilts on its own, and the tilts of all layers add up.
 	*
 	* @param DeltaTime - Current delta time in seconds.
+	* @param Layer - Which of the tilt layers to roll, ECameraLayer::LeanTilt, StrafeTilt or SlideTilt.
 	* @param TiltAmount - The rotation amount you wish to tilt the camera.
 	* @param TransitionSpeed - How fast you want to the camera to reach the final TiltAmount. Higher value is quicker, lower value is slower.
 	*/
-	void TiltPlayerCamera(float DeltaTime, float TiltAmount, float TransitionSpeed);
+	void TiltPlayerCamera(float DeltaTime, ECameraLayer Layer, float TiltAmount, float TransitionSpeed);
 
 	void UpdateFOV(float DeltaTime);
 	void RequestNewFOV(float NewFOVParam, float TransitionSpeed = 0.0f);
+	/** The FOV the camera is easing through towards the last requested one, without any other FOV layers. */
+	float GetCurrentFOV() const { return CurrentFOV; }
+
+	/** Every contributor to the camera transform writes to a layer of this, instead of to the camera components. */
+	FCameraLayerStack& GetCameraLayers() { return CameraLayers; }
 
 	float GetStrafeTiltAmount() { return strafeTiltAmount; }
 	float GetStrafeTiltEnterTime() { return strafeTiltEnterTime; }
@@ -46,7 +67,6 @@ public:
 protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
-	virtual void TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 
 private:
 	AStealthPlayerCharacter* PlayerRef;
@@ -85,6 +105,9 @@ private:
 	// How much variation there should be in the amount of roll, as a percentage. See StepFrequency.
 	UPROPERTY(EditAnywhere, Category = "HeadBob")
 		float BobRollVariation = 25.0f;
+	// Seed for the head bob variation, so that replays and benchmarks bob the same way every run. 0 derives one from the owner's name.
+	UPROPERTY(EditAnywhere, Category = "HeadBob")
+		int32 BobRandomSeed = 0;
 
 	// How strong the camera should be tilted during strafe movement.
 	UPROPERTY(EditAnywhere, Category = "Strafe Tilting")
@@ -95,20 +118,20 @@ private:
 	// How long the transition out of strafe tilting should be.
 	UPROPERTY(EditAnywhere, Category = "Strafe Tilting")
 		float strafeTiltExitTime = 5.0f;
+	// How long the transition out of the slide tilt should be, once the slide is over.
+	UPROPERTY(EditAnywhere, Category = "Slide Tilting")
+		float slideTiltExitTime = 8.0f;
 
-	float VelMultiplier = 0.0f;
-	float FadeOut = 0.0f;
-	float RandomizedStepFrequency = StepFrequency;
-	float RandomizedZHeightMult = zHeightMult;
-	float RandomizedSwayAmount = SwayAmount;
-	float RandomizedBobRollAmount = BobRollAmount;
-	float Offset = 0.0f;
-	float zPos = 0.0f;
-	float oldZPos = 0.0f;
-	float oldOldZPos = 0.0f;
-	float yPos = 0.0f;
-	float oldYPos = 0.0f;
+	// Seeded with BobRandomSeed.
+	FHeadBobGenerator BobGenerator;
 
 	float NewFOV;
+	float CurrentFOV;
 	float FOVTransitionSpeed = 0.0f;
+
+	FCameraLayerStack CameraLayers;
+	bool bAwake = true;
+	bool CanSleep() const;
+	bool HasMovementInput() const;
+	void UpdateTilt(float DeltaTime);
 };
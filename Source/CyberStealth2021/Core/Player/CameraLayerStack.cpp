@@ -0,0 +1,103 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "CameraLayerStack.h"
+#include "Camera/CameraComponent.h"
+#include "StealthCameraAnchorComponent.h"
+#include "StealthMovementStats.h"
+
+DECLARE_CYCLE_STAT(TEXT("CameraFX Apply Layers"), STAT_CameraFX_ApplyLayers, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Camera Transform Writes"), STAT_CameraFX_TransformWrites, STATGROUP_StealthMovement);
+
+void FCameraLayerStack::Initialize(UStealthCameraAnchorComponent* InAnchor, UCameraComponent* InCamera) {
+	Anchor = InAnchor;
+	Camera = InCamera;
+	BaseCameraLocation = Camera->GetRelativeLocation();
+	BaseCameraRotation = Camera->GetRelativeRotation();
+	BaseFOV = Camera->FieldOfView;
+	for (FCameraLayer& Layer : Layers) {
+		Layer = FCameraLayer();
+	}
+	bDirty = false;
+}
+
+void FCameraLayerStack::SetLocation(ECameraLayer Layer, const FVector& Location) {
+	FCameraLayer& Target = Layers[(int32)Layer];
+	if (Target.Location != Location) {
+		Target.Location = Location;
+		bDirty = true;
+	}
+}
+
+void FCameraLayerStack::SetRotation(ECameraLayer Layer, const FRotator& Rotation) {
+	FCameraLayer& Target = Layers[(int32)Layer];
+	if (Target.Rotation != Rotation) {
+		Target.Rotation = Rotation;
+		bDirty = true;
+	}
+}
+
+void FCameraLayerStack::SetFOV(ECameraLayer Layer, float FOV) {
+	FCameraLayer& Target = Layers[(int32)Layer];
+	if (Target.FOV != FOV) {
+		Target.FOV = FOV;
+		bDirty = true;
+	}
+}
+
+void FCameraLayerStack::SetWeight(ECameraLayer Layer, float Weight) {
+	FCameraLayer& Target = Layers[(int32)Layer];
+	if (Target.Weight != Weight) {
+		Target.Weight = Weight;
+		bDirty = true;
+	}
+}
+
+float FCameraLayerStack::GetFOV() const {
+	float FOV = BaseFOV;
+	for (const FCameraLayer& Layer : Layers) {
+		FOV += Layer.FOV * Layer.Weight;
+	}
+	return FOV;
+}
+
+bool FCameraLayerStack::Apply() {
+	if (!Anchor) {
+		return false;
+	}
+	SCOPE_CYCLE_COUNTER(STAT_CameraFX_ApplyLayers);
+
+	FVector CameraLocation = BaseCameraLocation;
+	FRotator CameraRotation = BaseCameraRotation;
+	const bool bWasDirty = bDirty;
+	if (bDirty) {
+		bDirty = false;
+		FVector AnchorLocation = FVector::ZeroVector;
+		FRotator AnchorRotation = FRotator::ZeroRotator;
+		for (int32 i = 0; i < (int32)ECameraLayer::Count; i++) {
+			const FCameraLayer& Layer = Layers[i];
+			if (IsCameraLayer((ECameraLayer)i)) {
+				CameraLocation += Layer.Location * Layer.Weight;
+				CameraRotation += Layer.Rotation * Layer.Weight;
+			}
+			else {
+				AnchorLocation += Layer.Location * Layer.Weight;
+				AnchorRotation += Layer.Rotation * Layer.Weight;
+			}
+		}
+		Anchor->SetOffset(AnchorLocation, AnchorRotation);
+		Camera->FieldOfView = GetFOV();
+	}
+
+	// The anchor goes first, so moving it carries the camera along before the camera's own write.
+	bool bMoved = Anchor->UpdateAnchor();
+	if (bMoved) {
+		INC_DWORD_STAT(STAT_CameraFX_TransformWrites);
+	}
+	if (bWasDirty && (!CameraLocation.Equals(Camera->GetRelativeLocation(), 0.0f) || !CameraRotation.Equals(Camera->GetRelativeRotation(), 0.0f))) {
+		Camera->SetRelativeLocationAndRotation(CameraLocation, CameraRotation);
+		INC_DWORD_STAT(STAT_CameraFX_TransformWrites);
+		bMoved = true;
+	}
+	return bMoved;
+}
@@ -0,0 +1,76 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UStealthCameraAnchorComponent;
+class UCameraComponent;
+
+/** Everything that moves the player camera, each writing to its own layer of the FCameraLayerStack. */
+enum class ECameraLayer : uint8 {
+	// Keeps the camera steady while the capsule changes height. Anchor location.
+	CrouchHeight,
+	// Lean offset. Anchor location.
+	Lean,
+	// Offset that draws the camera between two fixed movement steps. Anchor location.
+	RenderInterpolation,
+	// Anchor roll.
+	LeanTilt,
+	StrafeTilt,
+	SlideTilt,
+	// Head bob. Camera location and rotation, so that it stacks on top of everything the anchor does.
+	Bob,
+	// FOV offset from sprinting.
+	FOV,
+	Count
+};
+
+struct FCameraLayer {
+	FVector Location = FVector::ZeroVector;
+	FRotator Rotation = FRotator::ZeroRotator;
+	float FOV = 0.0f;
+	// How much of this layer makes it into the composed camera, usually 0 or 1.
+	float Weight = 1.0f;
+};
+
+/**
+* Composes the player camera from layers, and writes it to the camera components once per frame.
+*
+* Each contributor only ever writes its own layer, so contributors can't overwrite each other, and lean tilt and strafe tilt simply add
+* up. Nothing touches the components until Apply(), which hands the anchor layers to the anchor as its offset, and moves the anchor
+* and the camera at most once each. The anchor follows the control rotation, so it is updated every frame. The camera is only
+* written if some layer changed since the last Apply().
+*/
+class CYBERSTEALTH2021_API FCameraLayerStack {
+public:
+	/** Take the current relative transform and FOV of the camera as the base that every layer is added to. */
+	void Initialize(UStealthCameraAnchorComponent* InAnchor, UCameraComponent* InCamera);
+
+	const FCameraLayer& GetLayer(ECameraLayer Layer) const { return Layers[(int32)Layer]; }
+	void SetLocation(ECameraLayer Layer, const FVector& Location);
+	void AddLocation(ECameraLayer Layer, const FVector& Delta) { SetLocation(Layer, GetLayer(Layer).Location + Delta); }
+	void SetRotation(ECameraLayer Layer, const FRotator& Rotation);
+	void SetFOV(ECameraLayer Layer, float FOV);
+	void SetWeight(ECameraLayer Layer, float Weight);
+
+	/** The FOV the camera had when the stack was initialized, which the FOV of every layer is added to. */
+	float GetBaseFOV() const { return BaseFOV; }
+	/** The FOV the camera is given by the next Apply(). */
+	float GetFOV() const;
+
+	/** Compose the layers and write the result to the components. Returns whether anything was written. */
+	bool Apply();
+
+private:
+	UStealthCameraAnchorComponent* Anchor = nullptr;
+	UCameraComponent* Camera = nullptr;
+
+	FCameraLayer Layers[(int32)ECameraLayer::Count];
+	FVector BaseCameraLocation = FVector::ZeroVector;
+	FRotator BaseCameraRotation = FRotator::ZeroRotator;
+	float BaseFOV = 90.0f;
+	bool bDirty = false;
+
+	static bool IsCameraLayer(ECameraLayer Layer) { return Layer == ECameraLayer::Bob; }
+};
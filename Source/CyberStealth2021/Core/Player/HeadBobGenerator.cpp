@@ -0,0 +1,124 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "HeadBobGenerator.h"
+
+namespace {
+	// Phases within a cycle at which a foot lands, and the end of the cycle.
+	constexpr float FirstFootfallPhase = 0.5f * PI;
+	constexpr float SecondFootfallPhase = 1.5f * PI;
+	constexpr float CyclePhase = 2.0f * PI;
+}
+
+void FHeadBobGenerator::Initialize(const FHeadBobSettings& InSettings, int32 Seed) {
+	Settings = InSettings;
+	Stream.Initialize(Seed);
+	for (float& Value : Noise) {
+		Value = Stream.FRandRange(-1.0f, 1.0f);
+	}
+
+	Phase = 0.0f;
+	NoisePosition = 0.0f;
+	FadeOut = 0.0f;
+	LastSpeed = 0.0f;
+	StepFrequency = Settings.StepFrequency;
+	ZHeight = Settings.ZHeight;
+	Sway = Settings.Sway;
+	Roll = Settings.Roll;
+}
+
+const FHeadBobGenerator::FCycleSample* FHeadBobGenerator::GetCycle() {
+	struct FCycle {
+		// One more sample than the cycle has, so that the last one can be interpolated without wrapping.
+		FCycleSample Samples[SamplesPerCycle + 1];
+
+		FCycle() {
+			for (int32 i = 0; i <= SamplesPerCycle; i++) {
+				const float SamplePhase = CyclePhase * i / SamplesPerCycle;
+				// Starts at the top of a step, bringing the camera down towards placing the first foot.
+				Samples[i].Drop = FMath::Abs(FMath::Cos(SamplePhase));
+				Samples[i].Sine = FMath::Sin(SamplePhase);
+			}
+		}
+	};
+	static const FCycle Cycle;
+	return Cycle.Samples;
+}
+
+float FHeadBobGenerator::SampleNoise(float Position) const {
+	const int32 Index = FMath::FloorToInt(Position);
+	const float Alpha = Position - Index;
+	const float A = Noise[Index % NoiseSize];
+	const float B = Noise[(Index + 1) % NoiseSize];
+	return FMath::Lerp(A, B, FMath::SmoothStep(0.0f, 1.0f, Alpha));
+}
+
+float FHeadBobGenerator::RandomizeAround(float Value, float VariationPercent) {
+	const float Variation = Value * (VariationPercent / 100);
+	return Stream.FRandRange(Value - Variation, Value + Variation);
+}
+
+void FHeadBobGenerator::OnFootfall() {
+	// Follow the noise instead of picking a totally random value, to avoid extreme sudden changes in step frequency.
+	const float Variation = Settings.StepFrequency * (Settings.StepVariation / 100);
+	StepFrequency = Settings.StepFrequency + (SampleNoise(NoisePosition) * Variation);
+	ZHeight = RandomizeAround(Settings.ZHeight, Settings.ZHeightVariation);
+}
+
+void FHeadBobGenerator::OnCycleStart() {
+	Sway = RandomizeAround(Settings.Sway, Settings.SwayVariation);
+	Roll = RandomizeAround(Settings.Roll, Settings.RollVariation);
+}
+
+FHeadBobPose FHeadBobGenerator::Advance(float DeltaTime, float Speed, TFunctionRef<void(float SecondsAgo)> OnStep) {
+	LastSpeed = Speed;
+	if (Speed != 0.0f) {
+		const float SpeedRate = FMath::GetMappedRangeValueClamped(FVector2D(Settings.MinSpeed, Settings.MaxSpeed),
+			FVector2D(Settings.MinSpeedRate, Settings.MaxSpeedRate), Speed);
+
+		// Walk the phase from one footfall or cycle start to the next, since each of them can change how quickly it advances.
+		float Remaining = DeltaTime;
+		while (Remaining > 0.0f) {
+			const float PhaseRate = StepFrequency * SpeedRate;
+			if (PhaseRate <= 0.0f) {
+				break;
+			}
+			const float NextEvent = Phase < FirstFootfallPhase ? FirstFootfallPhase : Phase < SecondFootfallPhase ? SecondFootfallPhase : CyclePhase;
+			const float TimeToEvent = (NextEvent - Phase) / PhaseRate;
+			if (TimeToEvent > Remaining) {
+				Phase += PhaseRate * Remaining;
+				NoisePosition += PhaseRate * Remaining;
+				break;
+			}
+
+			Remaining -= TimeToEvent;
+			NoisePosition += NextEvent - Phase;
+			if (NextEvent == CyclePhase) {
+				Phase = 0.0f;
+				OnCycleStart();
+			}
+			else {
+				Phase = NextEvent;
+				OnFootfall();
+				OnStep(Remaining);
+			}
+		}
+		NoisePosition = FMath::Fmod(NoisePosition, (float)NoiseSize);
+	}
+
+	FadeOut = FMath::FInterpTo(FadeOut, Speed < 0.1f ? 0.0f : 1.0f, DeltaTime, 5);
+
+	const float SamplePosition = Phase * (SamplesPerCycle / CyclePhase);
+	const int32 Index = FMath::Min(FMath::FloorToInt(SamplePosition), SamplesPerCycle - 1);
+	const float Alpha = SamplePosition - Index;
+	const FCycleSample* Cycle = GetCycle();
+	const float Drop = FMath::Lerp(Cycle[Index].Drop, Cycle[Index + 1].Drop, Alpha);
+	const float Sine = FMath::Lerp(Cycle[Index].Sine, Cycle[Index + 1].Sine, Alpha);
+
+	FHeadBobPose Pose;
+	Pose.Z = Drop * ZHeight * FadeOut;
+	// Don't fade out the side to side movement because it can look weird. Side to side movement shouldnt be that dramatic anyway.
+	Pose.Y = Sine * Sway;
+	Pose.Roll = Sine * Roll * FadeOut;
+	return Pose;
+}
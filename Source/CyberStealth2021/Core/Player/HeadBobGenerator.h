@@ -0,0 +1,91 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Math/RandomStream.h"
+#include "Templates/Function.h"
+
+/** Tuning of the head bob, as set on UCameraFXHandler. Variations are percentages of the value they vary. */
+struct FHeadBobSettings {
+	float StepFrequency = 6.5f;
+	float StepVariation = 25.0f;
+	float ZHeight = 3.2f;
+	float ZHeightVariation = 40.0f;
+	float Sway = 2.0f;
+	float SwayVariation = 10.0f;
+	float Roll = 0.25f;
+	float RollVariation = 25.0f;
+	// Horizontal speeds that map to the slowest and quickest gait, and how much quicker than StepFrequency each of them steps.
+	float MinSpeed = 120.0f;
+	float MaxSpeed = 610.0f;
+	float MinSpeedRate = 0.5f;
+	float MaxSpeedRate = 1.5f;
+};
+
+/** Offset of the camera for the head bob. Z and Y are its location, Roll its rotation. */
+struct FHeadBobPose {
+	float Z = 0.0f;
+	float Y = 0.0f;
+	float Roll = 0.0f;
+};
+
+/**
+* Generates the head bob from a precomputed gait cycle.
+*
+* One cycle is two steps: the camera drops into a footfall at a quarter and at three quarters of it, as the bottom of Abs(Cos(Phase)),
+* and sways and rolls side to side once as Sin(Phase). Both shapes are sampled into a table once, so a frame costs a table lookup.
+* Footfalls happen at known phases, so they are found by advancing the phase from one to the next rather than by watching the camera
+* height turn around, and each is reported with how long ago in the frame it happened.
+*
+* Every footfall picks a new step frequency and height, and every cycle a new sway and roll. The step frequency follows a smooth noise
+* so that it doesn't jump between steps. All of it comes from a stream seeded per instance, so the same seed and the same speeds
+* produce the same bob on every run.
+*/
+class CYBERSTEALTH2021_API FHeadBobGenerator {
+public:
+	static constexpr int32 SamplesPerCycle = 64;
+	static constexpr int32 NoiseSize = 64;
+
+	void Initialize(const FHeadBobSettings& InSettings, int32 Seed);
+
+	/**
+	* Advance the bob by a frame.
+	*
+	* @param DeltaTime - Current delta time in seconds.
+	* @param Speed - Horizontal speed of the character.
+	* @param OnStep - Called for every footfall in the frame, with how many seconds before the end of the frame it happened.
+	* @return The pose of the camera at the end of the frame.
+	*/
+	FHeadBobPose Advance(float DeltaTime, float Speed, TFunctionRef<void(float SecondsAgo)> OnStep);
+
+	/** Whether the bob has faded out and stopped, so that every further Advance() at zero speed returns the same pose. */
+	bool IsAtRest() const { return FadeOut == 0.0f && LastSpeed == 0.0f; }
+
+private:
+	struct FCycleSample {
+		float Drop;
+		float Sine;
+	};
+
+	FHeadBobSettings Settings;
+	FRandomStream Stream;
+	float Noise[NoiseSize];
+
+	// Phase of the current cycle in radians, in [0, 2 * PI).
+	float Phase = 0.0f;
+	// How far the step frequency noise has been read. Advances with the phase, wraps at NoiseSize.
+	float NoisePosition = 0.0f;
+	float FadeOut = 0.0f;
+	float LastSpeed = 0.0f;
+	float StepFrequency = 0.0f;
+	float ZHeight = 0.0f;
+	float Sway = 0.0f;
+	float Roll = 0.0f;
+
+	static const FCycleSample* GetCycle();
+	float SampleNoise(float Position) const;
+	float RandomizeAround(float Value, float VariationPercent);
+	void OnFootfall();
+	void OnCycleStart();
+};
@@ -0,0 +1,150 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "MovementProbePipeline.h"
+#include "Engine/World.h"
+#include "StealthMovementStats.h"
+
+DECLARE_CYCLE_STAT(TEXT("Probe CanUncrouch"), STAT_StealthProbe_CanUncrouch, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Probe NeedsVariableCrouch"), STAT_StealthProbe_NeedsVariableCrouch, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Probe CanExitVariableCrouch"), STAT_StealthProbe_CanExitVariableCrouch, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Probe LeanClearance"), STAT_StealthProbe_LeanClearance, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Probe FlatBase"), STAT_StealthProbe_FlatBase, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Probe SlideInterrupt"), STAT_StealthProbe_SlideInterrupt, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Probe LedgeScan"), STAT_StealthProbe_LedgeScan, STATGROUP_StealthMovement);
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Sync Queries: CanUncrouch"), STAT_StealthQueries_CanUncrouch, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Sync Queries: NeedsVariableCrouch"), STAT_StealthQueries_NeedsVariableCrouch, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Sync Queries: CanExitVariableCrouch"), STAT_StealthQueries_CanExitVariableCrouch, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Sync Queries: LeanClearance"), STAT_StealthQueries_LeanClearance, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Sync Queries: FlatBase"), STAT_StealthQueries_FlatBase, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Sync Queries: SlideInterrupt"), STAT_StealthQueries_SlideInterrupt, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Sync Queries: LedgeScan"), STAT_StealthQueries_LedgeScan, STATGROUP_StealthMovement);
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Async Queries: CanUncrouch"), STAT_StealthAsyncQueries_CanUncrouch, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Async Queries: NeedsVariableCrouch"), STAT_StealthAsyncQueries_NeedsVariableCrouch, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Async Queries: CanExitVariableCrouch"), STAT_StealthAsyncQueries_CanExitVariableCrouch, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Async Queries: LeanClearance"), STAT_StealthAsyncQueries_LeanClearance, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Async Queries: FlatBase"), STAT_StealthAsyncQueries_FlatBase, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Async Queries: SlideInterrupt"), STAT_StealthAsyncQueries_SlideInterrupt, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Async Queries: LedgeScan"), STAT_StealthAsyncQueries_LedgeScan, STATGROUP_StealthMovement);
+
+#if STATS
+static TStatId GetProbeStatId(EMovementProbe Type) {
+	switch (Type) {
+	case EMovementProbe::CanUncrouch: return GET_STATID(STAT_StealthProbe_CanUncrouch);
+	case EMovementProbe::NeedsVariableCrouch: return GET_STATID(STAT_StealthProbe_NeedsVariableCrouch);
+	case EMovementProbe::CanExitVariableCrouch: return GET_STATID(STAT_StealthProbe_CanExitVariableCrouch);
+	case EMovementProbe::LeanClearance: return GET_STATID(STAT_StealthProbe_LeanClearance);
+	case EMovementProbe::FlatBase: return GET_STATID(STAT_StealthProbe_FlatBase);
+	case EMovementProbe::SlideInterrupt: return GET_STATID(STAT_StealthProbe_SlideInterrupt);
+	case EMovementProbe::LedgeScan: return GET_STATID(STAT_StealthProbe_LedgeScan);
+	default: return TStatId();
+	}
+}
+
+// Queries run synchronously and queries queued as async traces are counted apart, to show how often the exact path still runs.
+static FName GetProbeQueryCounter(EMovementProbe Type, bool bAsync) {
+	switch (Type) {
+	case EMovementProbe::CanUncrouch: return bAsync ? GET_STATFNAME(STAT_StealthAsyncQueries_CanUncrouch) : GET_STATFNAME(STAT_StealthQueries_CanUncrouch);
+	case EMovementProbe::NeedsVariableCrouch: return bAsync ? GET_STATFNAME(STAT_StealthAsyncQueries_NeedsVariableCrouch) : GET_STATFNAME(STAT_StealthQueries_NeedsVariableCrouch);
+	case EMovementProbe::CanExitVariableCrouch: return bAsync ? GET_STATFNAME(STAT_StealthAsyncQueries_CanExitVariableCrouch) : GET_STATFNAME(STAT_StealthQueries_CanExitVariableCrouch);
+	case EMovementProbe::LeanClearance: return bAsync ? GET_STATFNAME(STAT_StealthAsyncQueries_LeanClearance) : GET_STATFNAME(STAT_StealthQueries_LeanClearance);
+	case EMovementProbe::FlatBase: return bAsync ? GET_STATFNAME(STAT_StealthAsyncQueries_FlatBase) : GET_STATFNAME(STAT_StealthQueries_FlatBase);
+	case EMovementProbe::SlideInterrupt: return bAsync ? GET_STATFNAME(STAT_StealthAsyncQueries_SlideInterrupt) : GET_STATFNAME(STAT_StealthQueries_SlideInterrupt);
+	case EMovementProbe::LedgeScan: return bAsync ? GET_STATFNAME(STAT_StealthAsyncQueries_LedgeScan) : GET_STATFNAME(STAT_StealthQueries_LedgeScan);
+	default: return NAME_None;
+	}
+}
+#endif
+
+void FMovementProbePipeline::Queue(UWorld* World, const FMovementProbe& Probe) {
+	FProbeSlot& Slot = Slots[(int32)Probe.Type];
+	INC_DWORD_STAT_FNAME_BY(GetProbeQueryCounter(Probe.Type, true), 1);
+
+	switch (Probe.Query) {
+	case EMovementProbeQuery::LineTrace:
+		Slot.Handle = World->AsyncLineTraceByChannel(EAsyncTraceType::Single, Probe.Start, Probe.End, Probe.Channel, Probe.Params);
+		break;
+	case EMovementProbeQuery::Sweep:
+		Slot.Handle = World->AsyncSweepByChannel(EAsyncTraceType::Single, Probe.Start, Probe.End, FQuat::Identity, Probe.Channel, Probe.Shape, Probe.Params);
+		break;
+	case EMovementProbeQuery::MultiSweepStatic:
+		Slot.Handle = World->AsyncSweepByObjectType(EAsyncTraceType::Multi, Probe.Start, Probe.End, FQuat::Identity,
+			FCollisionObjectQueryParams::AllStaticObjects, Probe.Shape, Probe.Params);
+		break;
+	}
+	Slot.FrameQueued = GFrameCounter;
+	Slot.bFetched = false;
+}
+
+const FMovementProbeResult* FMovementProbePipeline::Consume(UWorld* World, EMovementProbe Type) {
+	FProbeSlot& Slot = Slots[(int32)Type];
+	if (Slot.FramePublished == GFrameCounter) {
+		return &Slot.PublishedResult;
+	}
+	// Async results are only kept around by the world for the frame after they were requested.
+	if (Slot.FrameQueued + 1 != GFrameCounter) {
+		return nullptr;
+	}
+	if (Slot.bFetched) {
+		return &Slot.Result;
+	}
+
+	FTraceDatum Datum;
+	if (!World->QueryTraceData(Slot.Handle, Datum)) {
+		return nullptr;
+	}
+
+	Slot.Result.Hits = MoveTemp(Datum.OutHits);
+	Slot.Result.bBlockingHit = Slot.Result.Hits.Num() > 0 && (Datum.TraceType == EAsyncTraceType::Multi || Slot.Result.Hits[0].bBlockingHit);
+	Slot.Result.bStale = true;
+	Slot.Result.FrameNumber = Slot.FrameQueued;
+	Slot.bFetched = true;
+	return &Slot.Result;
+}
+
+const FMovementProbeResult& FMovementProbePipeline::Run(UWorld* World, const FMovementProbe& Probe) {
+	FMovementProbeResult& Result = Slots[(int32)Probe.Type].SyncResult;
+	Evaluate(World, Probe, Result);
+	return Result;
+}
+
+void FMovementProbePipeline::Evaluate(UWorld* World, const FMovementProbe& Probe, FMovementProbeResult& Result) {
+#if STATS
+	FScopeCycleCounter CycleCounter(GetProbeStatId(Probe.Type));
+#endif
+	INC_DWORD_STAT_FNAME_BY(GetProbeQueryCounter(Probe.Type, false), 1);
+	Result.Hits.Reset();
+	Result.bStale = false;
+	Result.FrameNumber = GFrameCounter;
+
+	switch (Probe.Query) {
+	case EMovementProbeQuery::LineTrace: {
+		FHitResult& Hit = Result.Hits.AddDefaulted_GetRef();
+		Result.bBlockingHit = World->LineTraceSingleByChannel(Hit, Probe.Start, Probe.End, Probe.Channel, Probe.Params);
+		break;
+	}
+	case EMovementProbeQuery::Sweep: {
+		FHitResult& Hit = Result.Hits.AddDefaulted_GetRef();
+		Result.bBlockingHit = World->SweepSingleByChannel(Hit, Probe.Start, Probe.End, FQuat::Identity, Probe.Channel, Probe.Shape, Probe.Params);
+		break;
+	}
+	case EMovementProbeQuery::MultiSweepStatic:
+		Result.bBlockingHit = World->SweepMultiByObjectType(Result.Hits, Probe.Start, Probe.End, FQuat::Identity,
+			FCollisionObjectQueryParams::AllStaticObjects, Probe.Shape, Probe.Params);
+		break;
+	}
+
+	if (!Result.bBlockingHit && Probe.Query != EMovementProbeQuery::MultiSweepStatic) {
+		Result.Hits.Reset();
+	}
+}
+
+void FMovementProbePipeline::Publish(EMovementProbe Type, FMovementProbeResult& Result) {
+	FProbeSlot& Slot = Slots[(int32)Type];
+	Swap(Slot.PublishedResult, Result);
+	// The capsule is going to move before the result is consumed, so it is exactly as trustworthy as a queued one.
+	Slot.PublishedResult.bStale = true;
+	Slot.FramePublished = GFrameCounter;
+}
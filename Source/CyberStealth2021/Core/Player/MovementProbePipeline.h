@@ -0,0 +1,102 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CollisionQueryParams.h"
+#include "CollisionShape.h"
+#include "Engine/EngineTypes.h"
+#include "WorldCollision.h"
+
+class UWorld;
+
+/** Every scene query that UStealthPlayerMovement runs, used to route a result back to the check that asked for it. */
+enum class EMovementProbe : uint8 {
+	CanUncrouch,
+	NeedsVariableCrouch,
+	CanExitVariableCrouch,
+	LeanClearance,
+	FlatBase,
+	SlideInterrupt,
+	LedgeScan,
+	Count
+};
+
+enum class EMovementProbeQuery : uint8 {
+	LineTrace,
+	Sweep,
+	// Multi-hit sweep against all static objects, rather than a single sweep against a trace channel.
+	MultiSweepStatic
+};
+
+/** Everything needed to run a single movement probe, either right away or queued on the physics scene. */
+struct FMovementProbe {
+	EMovementProbe Type = EMovementProbe::Count;
+	EMovementProbeQuery Query = EMovementProbeQuery::Sweep;
+	FVector Start = FVector::ZeroVector;
+	FVector End = FVector::ZeroVector;
+	FCollisionShape Shape;
+	ECollisionChannel Channel = ECollisionChannel::ECC_Visibility;
+	FCollisionQueryParams Params = FCollisionQueryParams::DefaultQueryParam;
+};
+
+struct FMovementProbeResult {
+	bool bBlockingHit = false;
+	// True if this result wasn't run against the current capsule position, either because it was queued on a previous frame
+	// or because it was evaluated in parallel before this frame's movement update.
+	bool bStale = false;
+	uint64 FrameNumber = 0;
+	// Single queries store at most one hit here. Multi queries store every hit in sweep order.
+	TArray<FHitResult> Hits;
+};
+
+/**
+* Runs movement probes for a single UStealthPlayerMovement, either synchronously or as asynchronous scene queries.
+*
+* Probes queued with Queue() are run by the physics scene alongside the rest of the frame, and their results can be
+* consumed on the following frame with Consume(). Probes can also be evaluated off the game thread with Evaluate() and
+* handed back with Publish(), in which case Consume() returns them for the rest of the frame they were published on.
+* Checks that must be exact can always fall back to Run(), which blocks until the query is done.
+*/
+class CYBERSTEALTH2021_API FMovementProbePipeline {
+public:
+	/** Queue a probe on the physics scene. Its result becomes available from Consume() on the next frame. */
+	void Queue(UWorld* World, const FMovementProbe& Probe);
+
+	/**
+	* Get the result of a probe that was queued on the previous frame.
+	*
+	* @return The result, or nullptr if no probe of this type was queued last frame or its result isn't available.
+	*/
+	const FMovementProbeResult* Consume(UWorld* World, EMovementProbe Type);
+
+	/** Run a probe synchronously. The returned result stays valid until the next probe of the same type is run. */
+	const FMovementProbeResult& Run(UWorld* World, const FMovementProbe& Probe);
+
+	/**
+	* Run a probe into the given result without touching any pipeline. Only reads the physics scene, so it is safe to call
+	* from task graph workers, as long as nothing is moving or adding collision at the same time.
+	*/
+	static void Evaluate(UWorld* World, const FMovementProbe& Probe, FMovementProbeResult& OutResult);
+
+	/**
+	* Hand over the result of a probe evaluated for this frame. Consume() prefers it over anything queued last frame.
+	* 
+	* The result is swapped in, and Result is left holding the previously published one, so that its hit array can be reused.
+	*/
+	void Publish(EMovementProbe Type, FMovementProbeResult& Result);
+
+private:
+	struct FProbeSlot {
+		FTraceHandle Handle;
+		uint64 FrameQueued = 0;
+		// Whether Result already holds the queued result, so that it is only fetched from the scene once per frame.
+		bool bFetched = false;
+		FMovementProbeResult Result;
+		FMovementProbeResult SyncResult;
+		// Result published for the frame it was evaluated on, see Publish().
+		uint64 FramePublished = 0;
+		FMovementProbeResult PublishedResult;
+	};
+	FProbeSlot Slots[(int32)EMovementProbe::Count];
+};
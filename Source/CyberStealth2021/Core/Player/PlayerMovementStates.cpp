@@ -7,8 +7,30 @@
 #include "Misc/App.h"
 #include "CollisionQueryParams.h"
 #include "SequenceCameraShake.h"
+#include "Camera/PlayerCameraManager.h"
+#include "StealthMovementStats.h"
 
-hsm::Transition PlayerMovementStates::GenericLocomotion::GetTransition() {
+DECLARE_CYCLE_STAT(TEXT("GenericLocomotion GetTransition"), STAT_StealthState_GenericLocomotion_GetTransition, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Slide GetTransition"), STAT_StealthState_Slide_GetTransition, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Slide Update"), STAT_StealthState_Slide_Update, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Slide OnEnter"), STAT_StealthState_Slide_OnEnter, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Slide OnExit"), STAT_StealthState_Slide_OnExit, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Walk GetTransition"), STAT_StealthState_Walk_GetTransition, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Crouch OnEnter"), STAT_StealthState_Crouch_OnEnter, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Crouch OnExit"), STAT_StealthState_Crouch_OnExit, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("VariableCrouch OnEnter"), STAT_StealthState_VariableCrouch_OnEnter, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("VariableCrouch OnExit"), STAT_StealthState_VariableCrouch_OnExit, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Crouch GetTransition"), STAT_StealthState_Crouch_GetTransition, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("VariableCrouch GetTransition"), STAT_StealthState_VariableCrouch_GetTransition, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("VariableCrouch Update"), STAT_StealthState_VariableCrouch_Update, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Sprint GetTransition"), STAT_StealthState_Sprint_GetTransition, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Sprint OnEnter"), STAT_StealthState_Sprint_OnEnter, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Sprint OnExit"), STAT_StealthState_Sprint_OnExit, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Climb GetTransition"), STAT_StealthState_Climb_GetTransition, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Climb OnEnter"), STAT_StealthState_Climb_OnEnter, STATGROUP_StealthMovement);
+
+FStealthStateTransition PlayerMovementStates::GenericLocomotion::GetTransition() {
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_GenericLocomotion_GetTransition);
 	FVector validLedgePos;
 
 	if (Owner().bDidFinishClimb) {
@@ -19,7 +41,7 @@ hsm::Transition PlayerMovementStates::GenericLocomotion::GetTransition() {
 		// For some reason I could not get state arguments to work here, so I'm setting the end
 		// climb pos directly.
 		Owner().EndClimbPos = validLedgePos;
-		return hsm::SiblingTransition<Climb>();
+		return SiblingTransition<Climb>();
 	}
 
 	// bDidFinishSlide is set after the slide timeline is completed. We flip it back to false here until the next slide occurs. 
@@ -27,107 +49,126 @@ hsm::Transition PlayerMovementStates::GenericLocomotion::GetTransition() {
 		Owner().bDidFinishSlide = false;
 		float OutCeilingDist = 0.0f;
 		if (Owner().CheckNeedsVariableCrouch(OutCeilingDist)) {
-			return hsm::InnerEntryTransition<VariableCrouch>(true);
+			return InnerEntryTransition<VariableCrouch>(true);
 		}
 		else {
-			return hsm::InnerEntryTransition<Crouch>(Owner().UncrouchTime, true);
+			return InnerEntryTransition<Crouch>(Owner().UncrouchTime, true);
 		}
 	}
-	else if (Owner().PBCharacter->IsSprinting()) {
-		if (Owner().bWantsToCrouch && !(Owner().movementStates.IsInState<Crouch>() || Owner().movementStates.IsInState<VariableCrouch>())) {
-			return hsm::SiblingTransition<Slide>();
+	else if (Owner().bWantsToSprint) {
+		if (Owner().bWantsToCrouch && !Owner().IsInStates(StealthMovementStateBits::Crouch | StealthMovementStateBits::VariableCrouch)) {
+			return SiblingTransition<Slide>();
 		}
 		else {
-			return hsm::InnerEntryTransition<Sprint>();
+			return InnerEntryTransition<Sprint>();
 		}
 	}
-	else if (!Owner().PBCharacter->IsSprinting()) {
-		return hsm::InnerEntryTransition<Walk>();
+	else if (!Owner().bWantsToSprint) {
+		return InnerEntryTransition<Walk>();
 	}
-	return hsm::NoTransition();
+	return NoTransition();
+}
+
+void PlayerMovementStates::GenericLocomotion::OnEnter() {
+	Owner().SetStateActive(StealthMovementStateBits::GenericLocomotion, true);
+}
+
+void PlayerMovementStates::GenericLocomotion::OnExit() {
+	Owner().SetStateActive(StealthMovementStateBits::GenericLocomotion, false);
 }
 
-hsm::Transition PlayerMovementStates::Slide::GetTransition() {
+FStealthStateTransition PlayerMovementStates::Slide::GetTransition() {
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_Slide_GetTransition);
 	if (Owner().bDidFinishSlide || CheckIfSlideInterrupted()) {
-		return hsm::SiblingTransition<GenericLocomotion>();
+		return SiblingTransition<GenericLocomotion>();
 	}
 	else {
-		return hsm::NoTransition();
+		return NoTransition();
 	}
 }
 
 void PlayerMovementStates::Slide::Update() {
-	Owner().PlayerRef->GetCameraFXHandler()->TiltPlayerCamera(FApp::GetDeltaTime(), -10.0f, 8.0f);
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_Slide_Update);
+	if (Owner().bNPCMode) {
+		return;
+	}
+	Owner().PlayerRef->GetCameraFXHandler()->TiltPlayerCamera(Owner().GetMovementDeltaTime(), ECameraLayer::SlideTilt, -10.0f, 8.0f);
 }
 
 void PlayerMovementStates::Slide::OnEnter() {
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_Slide_OnEnter);
+	Owner().SetStateActive(StealthMovementStateBits::Slide, true);
 	Owner().SlideStartCachedVector = Owner().PlayerRef->GetActorForwardVector();
 	Owner().RequestCharacterResize(Owner().SlideHeight, Owner().SlideTransitionTime);
 	Owner().SlideTimeline.PlayFromStart();
 }
 
 void PlayerMovementStates::Slide::OnExit() {
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_Slide_OnExit);
+	Owner().SetStateActive(StealthMovementStateBits::Slide, false);
 	Owner().SlideTimeline.Stop();
 }
 
 bool PlayerMovementStates::Slide::CheckIfSlideInterrupted() {
-	FCollisionShape Box = FCollisionShape::MakeBox(FVector(15, 15, 0));
-	FVector Start = Owner().PlayerRef->GetCapsuleComponent()->GetComponentLocation();
-	Start = Start + (Owner().PlayerRef->GetActorForwardVector() * 20.0f);
-	Start.Z = Start.Z - Owner().GetFloorOffset() - Owner().PlayerRef->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight() + 1;
-	FVector End = Start;
-	Start.Z = Start.Z + Owner().MaxStepHeight;
-	End.Z = End.Z + (56);
-
-	FHitResult Result;
-	// FCollisionQueryParams::DefaultQueryParam is set to trace complex collision. For some reason, that is causing the trace to fail
-	// for me. So for now I have to substitute my own default FCollisionQueryParams that isn't tracing for complex collision.
-	static FCollisionQueryParams defaultParams;
-	if (Owner().GetWorld()->SweepSingleByChannel(Result, Start, End, FQuat::Identity, ECollisionChannel::ECC_Visibility, Box, defaultParams)) {
-		return true;
-	}
-	else {
-		return false;
-	}
+	return Owner().RunProbe(EMovementProbe::SlideInterrupt).bBlockingHit;
 }
 
-hsm::Transition PlayerMovementStates::Walk::GetTransition() {
+FStealthStateTransition PlayerMovementStates::Walk::GetTransition() {
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_Walk_GetTransition);
 	if (Owner().bWantsToCrouch && Owner().CharacterOwner->CanCrouch()) {
 		float OutCeilingDist = 0.0f;
 		// Enter Variable Crouch State
 		if (Owner().CheckNeedsVariableCrouch(OutCeilingDist)) {
-			return hsm::SiblingTransition<VariableCrouch>(false, true);
+			return SiblingTransition<VariableCrouch>(false, true);
 		}
 		// Enter Regular Crouch State.
 		else {
-			return hsm::SiblingTransition<Crouch>(Owner().CrouchTime);
+			return SiblingTransition<Crouch>(Owner().CrouchTime);
 		}
 	}
 	// Enter Sprint State
-	else if (Owner().PBCharacter->IsSprinting()) {
-		return hsm::SiblingTransition<Sprint>();
+	else if (Owner().bWantsToSprint) {
+		return SiblingTransition<Sprint>();
 	}
 
-	return hsm::NoTransition();
+	return NoTransition();
 }
 
-void PlayerMovementStates::Crouch::OnEnter(float TransitionSpeed, bool bForceCrouch) {
+void PlayerMovementStates::Walk::OnEnter() {
+	Owner().SetStateActive(StealthMovementStateBits::Walk, true);
+}
+
+void PlayerMovementStates::Walk::OnExit() {
+	Owner().SetStateActive(StealthMovementStateBits::Walk, false);
+}
+
+void PlayerMovementStates::Crouch::EnterCrouch(bool bForceCrouch, uint32 StateBit) {
+	Owner().SetStateActive(StateBit, true);
 	if (bForceCrouch) {
 		Owner().PlayerRef->Crouch(false);
 	}
 	Owner().PBCharacter->bIsCrouched = true;
+}
+
+void PlayerMovementStates::Crouch::ExitCrouch(uint32 StateBit) {
+	Owner().SetStateActive(StateBit, false);
+	Owner().PBCharacter->bIsCrouched = false;
+}
+
+void PlayerMovementStates::Crouch::OnEnter(float TransitionSpeed, bool bForceCrouch) {
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_Crouch_OnEnter);
+	EnterCrouch(bForceCrouch, StealthMovementStateBits::Crouch);
 	Owner().RequestCharacterResize(Owner().CrouchedHalfHeight, TransitionSpeed);
 }
 
 void PlayerMovementStates::Crouch::OnExit() {
-	Owner().PBCharacter->bIsCrouched = false;
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_Crouch_OnExit);
+	ExitCrouch(StealthMovementStateBits::Crouch);
 }
 
 void PlayerMovementStates::VariableCrouch::OnEnter(bool bForceCrouch, bool bRegularCrouchSpeed) {
-	if (bForceCrouch) {
-		Owner().PlayerRef->Crouch(false);
-	}
-	Owner().PBCharacter->bIsCrouched = true;
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_VariableCrouch_OnEnter);
+	EnterCrouch(bForceCrouch, StealthMovementStateBits::VariableCrouch);
 
 	mRegularCrouchSpeed = bRegularCrouchSpeed;
 	float OutCeilingDist = 0.0f;
@@ -135,55 +176,63 @@ void PlayerMovementStates::VariableCrouch::OnEnter(bool bForceCrouch, bool bRegu
 	EntryHeight = OutCeilingDist / 2;
 }
 
-hsm::Transition PlayerMovementStates::Crouch::GetTransition() {
+void PlayerMovementStates::VariableCrouch::OnExit() {
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_VariableCrouch_OnExit);
+	ExitCrouch(StealthMovementStateBits::VariableCrouch);
+}
+
+FStealthStateTransition PlayerMovementStates::Crouch::GetTransition() {
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_Crouch_GetTransition);
 	float OutCeilingDist = 0.0f;
 	// Enter Sprint State
-	if (Owner().PBCharacter->IsSprinting()) {
+	if (Owner().bWantsToSprint) {
 		Owner().PBCharacter->bIsCrouched = false;
 		Owner().PlayerRef->UnCrouch();
 		Owner().RequestCharacterResize(Owner().PlayerRef->StandingHeight, Owner().CrouchToSprintTime);
-		return hsm::SiblingTransition<Sprint>();
+		return SiblingTransition<Sprint>();
 	}
 	// Enter Walk State
 	else if (!Owner().bWantsToCrouch && Owner().CanUncrouch()) {
 		Owner().PBCharacter->bIsCrouched = false;
 		Owner().RequestCharacterResize(Owner().PlayerRef->StandingHeight, Owner().UncrouchTime);
-		return hsm::SiblingTransition<Walk>();
+		return SiblingTransition<Walk>();
 	}
 	
 	// Enter Variable Crouch State
 	if (Owner().CheckNeedsVariableCrouch(OutCeilingDist)) {
-		return hsm::SiblingTransition<VariableCrouch>(false);
+		return SiblingTransition<VariableCrouch>(false);
 	}
 
-	return hsm::NoTransition();
+	return NoTransition();
 }
 
-hsm::Transition PlayerMovementStates::VariableCrouch::GetTransition() {
+FStealthStateTransition PlayerMovementStates::VariableCrouch::GetTransition() {
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_VariableCrouch_GetTransition);
 	float OutCeilingDist = 0.0f;
 
 	// Enter Sprint State
-	if (Owner().PBCharacter->IsSprinting() && Owner().CanUncrouch()) {
+	if (Owner().bWantsToSprint && Owner().CanUncrouch()) {
 		Owner().PBCharacter->bIsCrouched = false;
 		Owner().PlayerRef->UnCrouch();
 		Owner().RequestCharacterResize(Owner().PlayerRef->StandingHeight, Owner().CrouchToSprintTime);
-		return hsm::SiblingTransition<Sprint>();
+		return SiblingTransition<Sprint>();
 	}
 	// Enter Regular Crouch State
 	else if (Owner().bWantsToCrouch && Owner().CheckCanExitVariableCrouch()) {
-		return hsm::SiblingTransition<Crouch>(Owner().VariableCrouchTime);
+		return SiblingTransition<Crouch>(Owner().VariableCrouchTime);
 	}
 	// Enter Walk State
 	else if (!Owner().bWantsToCrouch && Owner().CanUncrouch()) {
 		Owner().PBCharacter->bIsCrouched = false;
 		Owner().RequestCharacterResize(Owner().PlayerRef->StandingHeight, Owner().UncrouchTime);
-		return hsm::SiblingTransition<Walk>();
+		return SiblingTransition<Walk>();
 	}
 
-	return hsm::NoTransition();
+	return NoTransition();
 }
 
 void PlayerMovementStates::VariableCrouch::Update() {
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_VariableCrouch_Update);
 	float OutCeilingDist = 0.0f;
 	if (Owner().CheckNeedsVariableCrouch(OutCeilingDist)) {
 		if (!mRegularCrouchSpeed) {
@@ -195,7 +244,7 @@ void PlayerMovementStates::VariableCrouch::Update() {
 		// Currently, this is only for transitioning from Walk -> VariableCrouch directly, so that the transition doesn't make the 
 		// player go straight from standing to a full variable crouch in a really short amount of time. 
 		else {
-			if (!FMath::IsNearlyEqual(EntryHeight, Owner().PlayerRef->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight(), 0.9f)) {
+			if (!FMath::IsNearlyEqual(EntryHeight, Owner().GetQueryCache().CapsuleHalfHeight, 0.9f)) {
 				if (EntryHeight != -1.0f) {
 					Owner().RequestCharacterResize(OutCeilingDist / 2.0f, Owner().CrouchTime);
 				}
@@ -210,49 +259,72 @@ void PlayerMovementStates::VariableCrouch::Update() {
 	}
 }
 
-hsm::Transition PlayerMovementStates::Sprint::GetTransition() {
+FStealthStateTransition PlayerMovementStates::Sprint::GetTransition() {
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_Sprint_GetTransition);
 	// Enter Walk State
-	if (!Owner().PBCharacter->IsSprinting()) {
-		return hsm::SiblingTransition<Walk>();
+	if (!Owner().bWantsToSprint) {
+		return SiblingTransition<Walk>();
 	}
 
-	return hsm::NoTransition();
+	return NoTransition();
 }
 
 void PlayerMovementStates::Sprint::OnEnter() {
-	float currentFOV = Owner().PlayerRef->GetPlayerCamera()->FieldOfView;
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_Sprint_OnEnter);
+	Owner().SetStateActive(StealthMovementStateBits::Sprint, true);
+	if (Owner().bNPCMode) {
+		return;
+	}
+	float currentFOV = Owner().PlayerRef->GetCameraFXHandler()->GetCurrentFOV();
 	Owner().PlayerRef->GetCameraFXHandler()->RequestNewFOV(currentFOV + Owner().PlayerRef->GetCameraFXHandler()->GetSprintFOVOffset(), SprintFOVTransitionSpeed);
 }
 
 void PlayerMovementStates::Sprint::OnExit() {
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_Sprint_OnExit);
+	Owner().SetStateActive(StealthMovementStateBits::Sprint, false);
+	if (Owner().bNPCMode) {
+		return;
+	}
 	float DefaultFOV = Owner().PlayerRef->GetCameraFXHandler()->GetCameraDefaultFOV();
 	Owner().PlayerRef->GetCameraFXHandler()->RequestNewFOV(DefaultFOV, SprintFOVTransitionSpeed);
 }
 
-hsm::Transition PlayerMovementStates::Climb::GetTransition() {
+FStealthStateTransition PlayerMovementStates::Climb::GetTransition() {
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_Climb_GetTransition);
 	if (Owner().bDidFinishClimb) {
-		return hsm::SiblingTransition<GenericLocomotion>();
+		return SiblingTransition<GenericLocomotion>();
 	}
 
-	return hsm::NoTransition();
+	return NoTransition();
 }
 void PlayerMovementStates::Climb::OnEnter() {
+	SCOPE_CYCLE_COUNTER(STAT_StealthState_Climb_OnEnter);
+	Owner().SetStateActive(StealthMovementStateBits::Climb, true);
 	Owner().PlayerRef->StopJumping();
 	Owner().StopMovementImmediately();
-	Owner().ClimbDistance = (Owner().EndClimbPos.Z - Owner().PlayerRef->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight()) - (Owner().PlayerRef->GetLastJumpStartingZPos());
+	Owner().ClimbDistance = (Owner().EndClimbPos.Z - Owner().GetQueryCache().CapsuleHalfHeight) - (Owner().PlayerRef->GetLastJumpStartingZPos());
 	Owner().StartClimbPos = Owner().PlayerRef->GetActorLocation();
 	// We want to modify how long the climb is based on how high up it was from the player's starting position.
 	if (Owner().ClimbDistance > Owner().ClimbTimeDistanceThreshold) {
 		Owner().ClimbTimeline.SetPlayRate(1 / Owner().SlowClimbSpeed);
-		USequenceCameraShake* dco = Owner().ClimbShaker->GetDefaultObject<USequenceCameraShake>();
-		dco->PlayRate = 1 / Owner().SlowClimbSpeed;
-		Owner().PlayerRef->GetCameraManager()->PlayWorldCameraShake(Owner().GetWorld(), Owner().ClimbShaker, Owner().PlayerRef->GetActorLocation(), 500, 500, 1.0f);
+		// An NPC climbing nearby shouldn't shake the player's camera.
+		if (!Owner().bNPCMode) {
+			USequenceCameraShake* dco = Owner().ClimbShaker->GetDefaultObject<USequenceCameraShake>();
+			dco->PlayRate = 1 / Owner().SlowClimbSpeed;
+			APlayerCameraManager::PlayWorldCameraShake(Owner().GetWorld(), Owner().ClimbShaker, Owner().PlayerRef->GetActorLocation(), 500, 500, 1.0f);
+		}
 	}
 	else {
 		Owner().ClimbTimeline.SetPlayRate(1 / Owner().QuickClimbSpeed);
-		USequenceCameraShake* dco = Owner().ClimbShaker->GetDefaultObject<USequenceCameraShake>();
-		dco->PlayRate = 1 / Owner().QuickClimbSpeed;
-		Owner().PlayerRef->GetCameraManager()->PlayWorldCameraShake(Owner().GetWorld(), Owner().ClimbShaker, Owner().PlayerRef->GetActorLocation(), 500, 500, 1.0f);
+		if (!Owner().bNPCMode) {
+			USequenceCameraShake* dco = Owner().ClimbShaker->GetDefaultObject<USequenceCameraShake>();
+			dco->PlayRate = 1 / Owner().QuickClimbSpeed;
+			APlayerCameraManager::PlayWorldCameraShake(Owner().GetWorld(), Owner().ClimbShaker, Owner().PlayerRef->GetActorLocation(), 500, 500, 1.0f);
+		}
 	}
 	Owner().ClimbTimeline.PlayFromStart();
-}
\ No newline at end of file
+}
+
+void PlayerMovementStates::Climb::OnExit() {
+	Owner().SetStateActive(StealthMovementStateBits::Climb, false);
+}
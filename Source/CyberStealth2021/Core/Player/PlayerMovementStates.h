@@ -3,71 +3,73 @@
 #pragma once
 
 #include "CoreMinimal.h"
-#include "hsm.h"
+#include "StealthStateMachine.h"
 
 class UStealthPlayerMovement;
 
 
 /**
- *
+ * The movement states of UStealthPlayerMovement. GenericLocomotion and its inner states Walk, Sprint, Crouch and VariableCrouch
+ * cover regular movement, and Slide and Climb are its siblings.
  */
 struct CYBERSTEALTH2021_API PlayerMovementStates {
-	struct GenericLocomotion : hsm::StateWithOwner<UStealthPlayerMovement> {
-		DEFINE_HSM_STATE(GenericLocomotion)
-
-		virtual hsm::Transition GetTransition() override;
+	struct GenericLocomotion : TStealthState<UStealthPlayerMovement> {
+		FStealthStateTransition GetTransition();
+		void OnEnter();
+		void OnExit();
 	};
 
-	struct Slide : hsm::StateWithOwner<UStealthPlayerMovement> {
-		DEFINE_HSM_STATE(Slide)
-
-		virtual hsm::Transition GetTransition() override;
-		virtual void OnEnter() override;
-		virtual void OnExit() override;
-		virtual void Update() override;
+	struct Slide : TStealthState<UStealthPlayerMovement> {
+		FStealthStateTransition GetTransition();
+		void OnEnter();
+		void OnExit();
+		void Update();
 
 	private:
 		bool CheckIfSlideInterrupted();
 	};
 
-	struct Climb : hsm::StateWithOwner<UStealthPlayerMovement> {
-		DEFINE_HSM_STATE(Climb)
-		virtual hsm::Transition GetTransition() override;
-		virtual void OnEnter() override;
+	struct Climb : TStealthState<UStealthPlayerMovement> {
+		FStealthStateTransition GetTransition();
+		void OnEnter();
+		void OnExit();
 	};
 
-	struct Walk : hsm::StateWithOwner<UStealthPlayerMovement> {
-		DEFINE_HSM_STATE(Walk)
-
-		virtual hsm::Transition GetTransition() override;
+	struct Walk : TStealthState<UStealthPlayerMovement, GenericLocomotion> {
+		FStealthStateTransition GetTransition();
+		void OnEnter();
+		void OnExit();
 	};
 
-	struct Sprint : hsm::StateWithOwner<UStealthPlayerMovement> {
-		DEFINE_HSM_STATE(Sprint)
+	struct Sprint : TStealthState<UStealthPlayerMovement, GenericLocomotion> {
 		float SprintFOVTransitionSpeed = 3.5f;
 
-		virtual void OnEnter() override;
-		virtual void OnExit() override;
-		virtual hsm::Transition GetTransition() override;
+		void OnEnter();
+		void OnExit();
+		FStealthStateTransition GetTransition();
 	};
 
-	struct Crouch : hsm::StateWithOwner<UStealthPlayerMovement> {
-		DEFINE_HSM_STATE(Crouch)
-		// Disallow use of the base OnEnter() function, since there is never a reason it should be called for this state.
-		// Instead, the custom OnEnter() function with parameters should always be used.
-		virtual void OnEnter() override { check(false); }
+	struct Crouch : TStealthState<UStealthPlayerMovement, GenericLocomotion> {
+		// Hides the OnEnter() without parameters, so that a transition into this state without a transition speed doesn't compile.
 		void OnEnter(float TransitionSpeed, bool bForceCrouch = false);
-		virtual void OnExit() override;
-		virtual hsm::Transition GetTransition() override;
+		void OnExit();
+		FStealthStateTransition GetTransition();
+
+	protected:
+		/** Shared by Crouch and VariableCrouch, which only differ in the state bit they set. */
+		void EnterCrouch(bool bForceCrouch, uint32 StateBit);
+		void ExitCrouch(uint32 StateBit);
 	};
 
 	struct VariableCrouch : Crouch {
-		DEFINE_HSM_STATE(VariableCrouch)
 		void OnEnter(bool bForceCrouch, bool bRegularCrouchSpeed = false);
-		virtual hsm::Transition GetTransition() override;
-		virtual void Update() override;
+		void OnExit();
+		FStealthStateTransition GetTransition();
+		void Update();
 
 		bool mRegularCrouchSpeed = false;
 		float EntryHeight = 0.0f;
 	};
+
+	using Machine = TStealthStateMachine<UStealthPlayerMovement, GenericLocomotion, Slide, Climb, Walk, Sprint, Crouch, VariableCrouch>;
 };
@@ -0,0 +1,43 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "StealthCameraAnchorComponent.h"
+#include "GameFramework/Pawn.h"
+
+UStealthCameraAnchorComponent::UStealthCameraAnchorComponent() {
+	PrimaryComponentTick.bCanEverTick = false;
+	// The control rotation is already in world space, so it is set as the anchor's rotation without going through the capsule's.
+	SetUsingAbsoluteRotation(bUsePawnControlRotation);
+}
+
+void UStealthCameraAnchorComponent::SetBaseLocation(const FVector& Location) {
+	BaseLocation = Location;
+	SetRelativeLocation(BaseLocation + LocationOffset);
+}
+
+void UStealthCameraAnchorComponent::SetOffset(const FVector& InLocationOffset, const FRotator& InRotationOffset) {
+	LocationOffset = InLocationOffset;
+	RotationOffset = InRotationOffset;
+}
+
+bool UStealthCameraAnchorComponent::UpdateAnchor() {
+	FRotator Rotation = RotationOffset;
+	APawn* Pawn = Cast<APawn>(GetOwner());
+	if (bUsePawnControlRotation && Pawn) {
+		FRotator ViewRotation = Pawn->GetViewRotation();
+		if (!bInheritRoll) {
+			ViewRotation.Roll = 0.0f;
+		}
+		Rotation += ViewRotation;
+	}
+	if (IsUsingAbsoluteRotation() != bUsePawnControlRotation) {
+		SetUsingAbsoluteRotation(bUsePawnControlRotation);
+	}
+
+	const FVector Location = BaseLocation + LocationOffset;
+	if (Location.Equals(GetRelativeLocation(), 0.0f) && Rotation.Equals(GetRelativeRotation(), 0.0f)) {
+		return false;
+	}
+	SetRelativeLocationAndRotation(Location, Rotation);
+	return true;
+}
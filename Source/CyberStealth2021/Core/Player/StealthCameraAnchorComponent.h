@@ -0,0 +1,45 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/SceneComponent.h"
+#include "StealthCameraAnchorComponent.generated.h"
+
+/**
+* The point the player camera hangs from, at eye height on the capsule.
+*
+* Follows the control rotation of the owning pawn without its roll, so the camera can be rolled by the offset instead. This is all the
+* player used a USpringArmComponent for, without the collision sweep and arm math that the spring arm runs on every tick. The anchor
+* has no tick of its own: offsets are handed to it by the camera layer stack, and UpdateAnchor() is called once per frame from the
+* movement tick, which runs after the controller has updated the control rotation.
+*/
+UCLASS(ClassGroup=(Custom), meta=(BlueprintSpawnableComponent))
+class CYBERSTEALTH2021_API UStealthCameraAnchorComponent : public USceneComponent
+{
+	GENERATED_BODY()
+
+public:
+	UStealthCameraAnchorComponent();
+
+	/** Set the location the offsets are added to, relative to the parent, and move the anchor there. */
+	void SetBaseLocation(const FVector& Location);
+	/** Set the additive offsets of the anchor, such as lean and crouch height. They are applied by the next UpdateAnchor(). */
+	void SetOffset(const FVector& LocationOffset, const FRotator& RotationOffset);
+
+	/** Move the anchor to the base location plus offset, and turn it to the control rotation plus offset. Returns whether it moved. */
+	bool UpdateAnchor();
+
+	// Whether the anchor turns with the control rotation of the owning pawn, or with its parent.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Camera Anchor")
+		bool bUsePawnControlRotation = true;
+	// Whether the roll of the control rotation is kept. When it isn't, the roll only comes from the rotation offset.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Camera Anchor")
+		bool bInheritRoll = false;
+
+private:
+	UPROPERTY(EditAnywhere, Category = "Camera Anchor")
+		FVector BaseLocation = FVector::ZeroVector;
+	FVector LocationOffset = FVector::ZeroVector;
+	FRotator RotationOffset = FRotator::ZeroRotator;
+};
@@ -0,0 +1,48 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+* The single clock that the whole stealth movement stack measures time with.
+*
+* Advanced once per frame by UStealthMovementSubsystem. With a variable step, every frame is a single step of the frame's delta time.
+* With a fixed step, frame time is accumulated and spent in whole steps of StepSeconds, so a frame can simulate zero, one or several
+* steps. Alpha is how far the frame has got towards the next step, which is used to interpolate the camera for rendering.
+*/
+struct FStealthMovementClock {
+	// Length of a fixed step, or 0 to run a single variable step per frame.
+	float StepSeconds = 0.0f;
+	// Most steps that are run in a single frame. Time beyond that is dropped, so a hitch can't snowball into ever longer frames.
+	int32 MaxStepsPerFrame = 8;
+
+	// Everything below is the result of the last Advance().
+	float FrameDeltaTime = 0.0f;
+	int32 NumSteps = 1;
+	float StepDeltaTime = 0.0f;
+	float Alpha = 1.0f;
+	// Frame time that hasn't been simulated yet, always less than a step.
+	float Accumulator = 0.0f;
+
+	bool IsFixed() const { return StepSeconds > 0.0f; }
+	/** Time simulated this frame, across all of its steps. */
+	float GetSimulatedSeconds() const { return NumSteps * StepDeltaTime; }
+
+	void Advance(float DeltaTime) {
+		FrameDeltaTime = DeltaTime;
+		if (!IsFixed()) {
+			NumSteps = 1;
+			StepDeltaTime = DeltaTime;
+			Alpha = 1.0f;
+			Accumulator = 0.0f;
+			return;
+		}
+
+		Accumulator += DeltaTime;
+		NumSteps = FMath::Min(FMath::FloorToInt(Accumulator / StepSeconds), MaxStepsPerFrame);
+		Accumulator = FMath::Min(Accumulator - (NumSteps * StepSeconds), StepSeconds * 0.999f);
+		StepDeltaTime = StepSeconds;
+		Alpha = Accumulator / StepSeconds;
+	}
+};
@@ -0,0 +1,46 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "StealthMovementStats.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "HAL/PlatformTime.h"
+
+UE_TRACE_CHANNEL_DEFINE(StealthMovementChannel);
+
+UE_TRACE_EVENT_BEGIN(StealthMovement, StateTransition)
+	UE_TRACE_EVENT_FIELD(uint64, Cycle)
+	UE_TRACE_EVENT_FIELD(uint32, ComponentId)
+	UE_TRACE_EVENT_FIELD(uint32, PreviousStates)
+	UE_TRACE_EVENT_FIELD(uint32, NewStates)
+UE_TRACE_EVENT_END()
+
+// An empty scope shows up on the Insights timeline as a marker at the point it was traced.
+#define STEALTH_TRACE_STATE_ENTERED(State) \
+	if (Entered & StealthMovementStateBits::State) { \
+		TRACE_CPUPROFILER_EVENT_SCOPE_ON_CHANNEL_STR("StealthMovement: Enter " #State, StealthMovementChannel); \
+	}
+
+void TraceStealthStateTransition(const UObject* Component, uint32 PreviousStates, uint32 NewStates) {
+#if UE_TRACE_ENABLED
+	if (!UE_TRACE_CHANNELEXPR_IS_ENABLED(StealthMovementChannel)) {
+		return;
+	}
+
+	UE_TRACE_LOG(StealthMovement, StateTransition, StealthMovementChannel)
+		<< StateTransition.Cycle(FPlatformTime::Cycles64())
+		<< StateTransition.ComponentId(Component ? Component->GetUniqueID() : 0)
+		<< StateTransition.PreviousStates(PreviousStates)
+		<< StateTransition.NewStates(NewStates);
+
+	const uint32 Entered = NewStates & ~PreviousStates;
+	STEALTH_TRACE_STATE_ENTERED(GenericLocomotion)
+	STEALTH_TRACE_STATE_ENTERED(Walk)
+	STEALTH_TRACE_STATE_ENTERED(Sprint)
+	STEALTH_TRACE_STATE_ENTERED(Crouch)
+	STEALTH_TRACE_STATE_ENTERED(VariableCrouch)
+	STEALTH_TRACE_STATE_ENTERED(Slide)
+	STEALTH_TRACE_STATE_ENTERED(Climb)
+#endif
+}
+
+#undef STEALTH_TRACE_STATE_ENTERED
@@ -0,0 +1,41 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "Trace/Trace.h"
+
+/**
+* Profiling for the stealth movement stack.
+*
+* Every probe, state transition and state update has a cycle stat in STATGROUP_StealthMovement ("stat StealthMovement"), and every
+* scene query is counted per call site. State changes are also traced as timeline events on the StealthMovement Insights channel,
+* which is off by default and can be enabled with -trace=cpu,StealthMovement.
+*/
+DECLARE_STATS_GROUP(TEXT("StealthMovement"), STATGROUP_StealthMovement, STATCAT_Advanced);
+
+UE_TRACE_CHANNEL_EXTERN(StealthMovementChannel, CYBERSTEALTH2021_API);
+
+/** Every state of the movement state machine, as bits in UStealthPlayerMovement::GetActiveStateBits() and the masks passed to TraceStealthStateTransition(). */
+namespace StealthMovementStateBits {
+	enum Type : uint32 {
+		GenericLocomotion = 1 << 0,
+		Walk = 1 << 1,
+		Sprint = 1 << 2,
+		Crouch = 1 << 3,
+		VariableCrouch = 1 << 4,
+		Slide = 1 << 5,
+		Climb = 1 << 6
+	};
+}
+
+/**
+* Records a change of the active movement states on the StealthMovement trace channel. Each state that was entered shows up
+* on the timeline as an instant event named after it.
+*
+* @param Component - The movement component that changed state.
+* @param PreviousStates - StealthMovementStateBits of the states that were active before the transition.
+* @param NewStates - StealthMovementStateBits of the states that are active now.
+*/
+CYBERSTEALTH2021_API void TraceStealthStateTransition(const UObject* Component, uint32 PreviousStates, uint32 NewStates);
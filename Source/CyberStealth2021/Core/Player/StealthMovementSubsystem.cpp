@@ -0,0 +1,257 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "StealthMovementSubsystem.h"
+#include "StealthPlayerMovement.h"
+#include "StealthMovementStats.h"
+#include "../Benchmark/MovementBenchmark.h"
+#include "Components/CapsuleComponent.h"
+#include "GameFramework/Character.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+#include "Async/ParallelFor.h"
+
+static TAutoConsoleVariable<int32> CVarBatchMovers(TEXT("stealth.BatchMovers"), 1,
+	TEXT("If enabled, the capsule height and lean of every stealth mover are interpolated together in one pass by UStealthMovementSubsystem, instead of by each mover during its own tick.\n"), ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarFixedStepRate(TEXT("stealth.FixedStepRate"), 0.0f,
+	TEXT("If above 0, stealth movement is simulated in fixed steps at this many steps per second, and the camera is interpolated between steps for rendering. The capsule and mesh are drawn where the last step left them. 0 runs one variable step per frame.\n")
+	TEXT("Only used in standalone games, networked movement keeps the delta times of its saved moves.\n"), ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarParallelProbes(TEXT("stealth.ParallelProbes"), 0,
+	TEXT("If enabled, the probes of every stealth mover are gathered at the start of the frame and evaluated together on task graph workers, instead of by each mover on the game thread.\n"), ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarParallelProbesMinBatch(TEXT("stealth.ParallelProbesMinBatch"), 8,
+	TEXT("Fewest probes in a frame worth spreading over task graph workers. Smaller batches are evaluated on the game thread.\n"), ECVF_Default);
+
+DECLARE_CYCLE_STAT(TEXT("Batch Tick Movers"), STAT_StealthMovement_TickMovers, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Batch Parallel Probes"), STAT_StealthMovement_ParallelProbes, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Batched Movers"), STAT_StealthMovement_BatchedMovers, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Parallel Probes"), STAT_StealthMovement_ParallelProbeCount, STATGROUP_StealthMovement);
+
+void FStealthMoverBatchTickFunction::ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent) {
+	if (Target && TickType != LEVELTICK_ViewportsOnly) {
+		Target->TickMovers(DeltaTime);
+	}
+}
+
+FString FStealthMoverBatchTickFunction::DiagnosticMessage() {
+	return TEXT("UStealthMovementSubsystem::TickMovers");
+}
+
+bool UStealthMovementSubsystem::ShouldCreateSubsystem(UObject* Outer) const {
+	UWorld* World = Cast<UWorld>(Outer);
+	return World && World->IsGameWorld();
+}
+
+void UStealthMovementSubsystem::Deinitialize() {
+	if (BatchTickFunction.IsTickFunctionRegistered()) {
+		BatchTickFunction.UnRegisterTickFunction();
+	}
+	while (Movers.Num() > 0) {
+		UnregisterMover(Movers.Last());
+	}
+	Super::Deinitialize();
+}
+
+int32 UStealthMovementSubsystem::RegisterMover(UStealthPlayerMovement* Mover) {
+	check(Mover && Mover->MoverBatchSlot == INDEX_NONE);
+	if (!BatchTickFunction.IsTickFunctionRegistered()) {
+		BatchTickFunction.Target = this;
+		BatchTickFunction.TickGroup = TG_PrePhysics;
+		BatchTickFunction.bCanEverTick = true;
+		BatchTickFunction.RegisterTickFunction(GetWorld()->PersistentLevel);
+	}
+	Mover->PrimaryComponentTick.AddPrerequisite(this, BatchTickFunction);
+
+	const int32 Slot = Movers.Add(Mover);
+	CurrentHeight.AddUninitialized();
+	TargetHeight.AddUninitialized();
+	HeightSpeed.AddUninitialized();
+	LeanHorz.AddUninitialized();
+	LeanVert.AddUninitialized();
+	TargetLeanHorz.AddUninitialized();
+	TargetLeanVert.AddUninitialized();
+	LeanSpeed.AddUninitialized();
+	LeanModifier.AddUninitialized();
+	DrivesCamera.AddUninitialized();
+	Mover->MoverBatchSlot = Slot;
+	GatherFromMover(Slot);
+	return Slot;
+}
+
+void UStealthMovementSubsystem::UnregisterMover(UStealthPlayerMovement* Mover) {
+	const int32 Slot = Mover ? Mover->MoverBatchSlot : INDEX_NONE;
+	if (!Movers.IsValidIndex(Slot) || Movers[Slot] != Mover) {
+		return;
+	}
+	Mover->PrimaryComponentTick.RemovePrerequisite(this, BatchTickFunction);
+	Mover->MoverBatchSlot = INDEX_NONE;
+
+	// Swap the last mover into the freed slot so the arrays stay packed.
+	Movers.RemoveAtSwap(Slot, 1, false);
+	CurrentHeight.RemoveAtSwap(Slot, 1, false);
+	TargetHeight.RemoveAtSwap(Slot, 1, false);
+	HeightSpeed.RemoveAtSwap(Slot, 1, false);
+	LeanHorz.RemoveAtSwap(Slot, 1, false);
+	LeanVert.RemoveAtSwap(Slot, 1, false);
+	TargetLeanHorz.RemoveAtSwap(Slot, 1, false);
+	TargetLeanVert.RemoveAtSwap(Slot, 1, false);
+	LeanSpeed.RemoveAtSwap(Slot, 1, false);
+	LeanModifier.RemoveAtSwap(Slot, 1, false);
+	DrivesCamera.RemoveAtSwap(Slot, 1, false);
+	if (Movers.IsValidIndex(Slot)) {
+		Movers[Slot]->MoverBatchSlot = Slot;
+	}
+}
+
+void UStealthMovementSubsystem::GatherFromMovers() {
+	for (int32 i = 0; i < Movers.Num(); i++) {
+		GatherFromMover(i);
+	}
+}
+
+void UStealthMovementSubsystem::GatherFromMover(int32 Slot) {
+	const UStealthPlayerMovement* Mover = Movers[Slot];
+	CurrentHeight[Slot] = Mover->CharacterOwner->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight();
+	TargetHeight[Slot] = Mover->NewCapsuleHeight;
+	HeightSpeed[Slot] = Mover->HeightTransitionSpeed;
+	LeanHorz[Slot] = Mover->LastHorzLeanProgress;
+	LeanVert[Slot] = Mover->LastVertLeanProgress;
+	TargetLeanHorz[Slot] = Mover->TargetLeanHorzOffset;
+	TargetLeanVert[Slot] = Mover->TargetLeanVertOffset;
+	LeanSpeed[Slot] = Mover->LeanTransitionSpeed;
+	LeanModifier[Slot] = 1.0f;
+	DrivesCamera[Slot] = !Mover->bNPCMode;
+}
+
+void UStealthMovementSubsystem::TickMovers(float DeltaTime) {
+	STEALTH_BENCHMARK_SCOPE("UStealthMovementSubsystem::TickMovers");
+	SCOPE_CYCLE_COUNTER(STAT_StealthMovement_TickMovers);
+	const bool bWantsBatching = CVarBatchMovers->GetInt() != 0;
+	if (bWantsBatching && !bBatching) {
+		// The movers have been interpolating on their own, so the arrays are out of date.
+		GatherFromMovers();
+	}
+	bBatching = bWantsBatching;
+
+	const float FixedStepRate = CVarFixedStepRate->GetFloat();
+	Clock.StepSeconds = FixedStepRate > 0.0f && GetWorld()->GetNetMode() == NM_Standalone ? 1.0f / FixedStepRate : 0.0f;
+	Clock.Advance(DeltaTime);
+
+	if (bBatching) {
+		InterpolateMovers(Clock.StepDeltaTime, Clock.NumSteps);
+	}
+
+	// Probes are gathered after the interpolation, so that they see this frame's capsule heights.
+	bProbingInParallel = CVarParallelProbes->GetInt() != 0;
+	if (bProbingInParallel) {
+		EvaluateProbesInParallel();
+	}
+}
+
+void UStealthMovementSubsystem::InterpolateMovers(float StepDeltaTime, int32 NumSteps) {
+	const int32 Num = Movers.Num();
+	SET_DWORD_STAT(STAT_StealthMovement_BatchedMovers, Num);
+	NewHeight.SetNumUninitialized(Num, false);
+
+	// Same math as FMath::FInterpTo() followed by the snap to target in UStealthPlayerMovement::UpdateCharacterHeight(), but
+	// without any branches that would keep the compiler from vectorizing the loop.
+	const float* RESTRICT Current = CurrentHeight.GetData();
+	const float* RESTRICT Target = TargetHeight.GetData();
+	const float* RESTRICT Speed = HeightSpeed.GetData();
+	float* RESTRICT OutHeight = NewHeight.GetData();
+	for (int32 i = 0; i < Num; i++) {
+		OutHeight[i] = Current[i];
+	}
+	for (int32 Step = 0; Step < NumSteps; Step++) {
+		for (int32 i = 0; i < Num; i++) {
+			const float Alpha = Speed[i] > 0.0f ? FMath::Clamp(StepDeltaTime * Speed[i], 0.0f, 1.0f) : 1.0f;
+			const float Height = OutHeight[i] + ((Target[i] - OutHeight[i]) * Alpha);
+			OutHeight[i] = FMath::Abs(Height - Target[i]) <= 0.1f ? Target[i] : Height;
+		}
+	}
+
+	InterpolateLeans(Num, StepDeltaTime, NumSteps, LeanHorz.GetData(), LeanVert.GetData(), TargetLeanHorz.GetData(), TargetLeanVert.GetData(),
+		LeanSpeed.GetData(), LeanModifier.GetData(), LeanHorzDelta, LeanVertDelta, LeanChanged);
+
+	// Only touch the components whose results need to go somewhere.
+	const float SimulatedSeconds = StepDeltaTime * NumSteps;
+	for (int32 i = 0; i < Num; i++) {
+		UStealthPlayerMovement* Mover = Movers[i];
+		if (NewHeight[i] != CurrentHeight[i]) {
+			Mover->ApplyCharacterHeight(CurrentHeight[i], NewHeight[i]);
+			CurrentHeight[i] = NewHeight[i];
+		}
+		// The camera tilt eases toward its own target every frame, even once the lean offset has settled.
+		if (LeanChanged[i] || (DrivesCamera[i] && !Mover->bLeanTiltSettled)) {
+			Mover->ApplyLeanState(SimulatedSeconds, LeanModifier[i], LeanHorz[i], LeanVert[i], LeanHorzDelta[i], LeanVertDelta[i]);
+		}
+	}
+}
+
+void UStealthMovementSubsystem::InterpolateLeans(int32 Num, float StepDeltaTime, int32 NumSteps, float* RESTRICT Horz, float* RESTRICT Vert,
+	const float* RESTRICT TargetHorz, const float* RESTRICT TargetVert, const float* RESTRICT LeanSpeeds, const float* RESTRICT Modifier,
+	TArray<float>& OutHorzDeltas, TArray<float>& OutVertDeltas, TArray<bool>& OutChangedFlags) {
+	// The steps accumulate into the outputs, so last frame's results have to be cleared, not just kept at the same size.
+	OutHorzDeltas.Reset();
+	OutHorzDeltas.SetNumZeroed(Num);
+	OutVertDeltas.Reset();
+	OutVertDeltas.SetNumZeroed(Num);
+	OutChangedFlags.Reset();
+	OutChangedFlags.SetNumZeroed(Num);
+
+	// Same as UStealthPlayerMovement::UpdateLeanState(). The lean eases toward the target scaled by the lean clearance, but snaps
+	// to, and compares against, the unscaled target. The offsets of every step are summed, since they are applied as one move.
+	float* RESTRICT OutHorzDelta = OutHorzDeltas.GetData();
+	float* RESTRICT OutVertDelta = OutVertDeltas.GetData();
+	bool* RESTRICT OutChanged = OutChangedFlags.GetData();
+	for (int32 Step = 0; Step < NumSteps; Step++) {
+		for (int32 i = 0; i < Num; i++) {
+			const float Alpha = LeanSpeeds[i] > 0.0f ? FMath::Clamp(StepDeltaTime * LeanSpeeds[i], 0.0f, 1.0f) : 1.0f;
+			const float HorzProgress = Horz[i] + (((Modifier[i] * TargetHorz[i]) - Horz[i]) * Alpha);
+			const float VertProgress = Vert[i] + (((Modifier[i] * TargetVert[i]) - Vert[i]) * Alpha);
+			const bool bHorzArrived = FMath::Abs(HorzProgress - TargetHorz[i]) <= 0.1f;
+			const bool bVertArrived = FMath::Abs(VertProgress - TargetVert[i]) <= 0.1f;
+			OutHorzDelta[i] += bHorzArrived ? 0.0f : HorzProgress - Horz[i];
+			OutVertDelta[i] += bVertArrived ? 0.0f : VertProgress - Vert[i];
+			const float NewHorz = bHorzArrived ? TargetHorz[i] : HorzProgress;
+			const float NewVert = bVertArrived ? TargetVert[i] : VertProgress;
+			OutChanged[i] |= (NewHorz != Horz[i]) | (NewVert != Vert[i]);
+			Horz[i] = NewHorz;
+			Vert[i] = NewVert;
+		}
+	}
+}
+
+void UStealthMovementSubsystem::EvaluateProbesInParallel() {
+	STEALTH_BENCHMARK_SCOPE("UStealthMovementSubsystem::EvaluateProbesInParallel");
+	SCOPE_CYCLE_COUNTER(STAT_StealthMovement_ParallelProbes);
+
+	// Building the probes reads the components and may run FindFloor(), so that part stays on the game thread.
+	ParallelProbes.Reset();
+	ParallelProbeOwners.Reset();
+	TArray<FMovementProbe, TInlineAllocator<8>> MoverProbes;
+	for (int32 i = 0; i < Movers.Num(); i++) {
+		MoverProbes.Reset();
+		Movers[i]->GatherUpcomingProbes(MoverProbes);
+		ParallelProbes.Append(MoverProbes);
+		for (int32 j = 0; j < MoverProbes.Num(); j++) {
+			ParallelProbeOwners.Add(i);
+		}
+	}
+
+	const int32 Num = ParallelProbes.Num();
+	SET_DWORD_STAT(STAT_StealthMovement_ParallelProbeCount, Num);
+	ParallelResults.SetNum(Num, false);
+
+	UWorld* World = GetWorld();
+	const bool bSingleThreaded = Num < CVarParallelProbesMinBatch->GetInt();
+	ParallelFor(Num, [this, World](int32 i) {
+		FMovementProbePipeline::Evaluate(World, ParallelProbes[i], ParallelResults[i]);
+	}, bSingleThreaded);
+
+	for (int32 i = 0; i < Num; i++) {
+		Movers[ParallelProbeOwners[i]]->ProbePipeline.Publish(ParallelProbes[i].Type, ParallelResults[i]);
+	}
+}
@@ -0,0 +1,138 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Engine/EngineBaseTypes.h"
+#include "MovementProbePipeline.h"
+#include "StealthMovementClock.h"
+#include "StealthMovementSubsystem.generated.h"
+
+class UStealthPlayerMovement;
+class UStealthMovementSubsystem;
+
+/** Runs UStealthMovementSubsystem::TickMovers() once per frame, ahead of every registered movement component. */
+USTRUCT()
+struct FStealthMoverBatchTickFunction : public FTickFunction
+{
+	GENERATED_BODY()
+
+	UStealthMovementSubsystem* Target = nullptr;
+
+	virtual void ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent) override;
+	virtual FString DiagnosticMessage() override;
+};
+
+template<>
+struct TStructOpsTypeTraits<FStealthMoverBatchTickFunction> : public TStructOpsTypeTraitsBase2<FStealthMoverBatchTickFunction>
+{
+	enum { WithCopy = false };
+};
+
+/**
+* Owns the per-tick height and lean state of every UStealthPlayerMovement in the world, and interpolates all of it in one pass.
+*
+* The state is kept as struct-of-arrays, one entry per mover, so the interpolation is a tight loop over packed floats instead of
+* a walk through every character's capsule and camera anchor. Only the results that actually changed are written back to the
+* components afterwards. The arrays are authoritative while batching is enabled (stealth.BatchMovers): movers push their targets
+* in through the Set functions, and nothing else should resize the capsule behind their back.
+*
+* The batch ticks in TG_PrePhysics ahead of all the movers, so they see their new height and lean for the whole of their own tick.
+* 
+* With stealth.ParallelProbes enabled, the batch also gathers the probes every mover's states are going to ask for this frame,
+* evaluates all of them with ParallelFor() on task graph workers, and publishes the results to each mover's probe pipeline
+* before any of them run their state machine. Scene queries only read the physics scene, and nothing moves while the batch
+* ticks, so the probes of all movers can safely run at the same time.
+* 
+* The batch also owns the FStealthMovementClock that every mover and its camera measure time with. With stealth.FixedStepRate set,
+* the interpolation runs once per fixed step, and the movers step their own simulation the same number of times during their tick.
+*/
+UCLASS()
+class CYBERSTEALTH2021_API UStealthMovementSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+	virtual void Deinitialize() override;
+
+	/**
+	* Add a mover to the batch, seeding its entry from the component's current state.
+	*
+	* @return The mover's slot, which stays valid until it is unregistered. Slots of other movers may change when one is removed.
+	*/
+	int32 RegisterMover(UStealthPlayerMovement* Mover);
+	void UnregisterMover(UStealthPlayerMovement* Mover);
+
+	/** True if this frame's heights and leans were updated by the batch, rather than by each mover on its own. */
+	bool IsBatching() const { return bBatching; }
+	/** The movement clock for this frame, advanced before any mover ticks. */
+	const FStealthMovementClock& GetClock() const { return Clock; }
+	/** True if this frame's probes were evaluated by the batch, so movers shouldn't queue any for the next frame themselves. */
+	bool IsProbingInParallel() const { return bProbingInParallel; }
+
+	void SetTargetHeight(int32 Slot, float HalfHeight, float Speed) { TargetHeight[Slot] = HalfHeight; HeightSpeed[Slot] = Speed; }
+	void SetTargetLean(int32 Slot, float HorzOffset, float VertOffset, float Speed) { TargetLeanHorz[Slot] = HorzOffset; TargetLeanVert[Slot] = VertOffset; LeanSpeed[Slot] = Speed; }
+	/** Movers measure their lean clearance during their own tick, the batch applies it on the next frame. */
+	void SetLeanModifier(int32 Slot, float Modifier) { LeanModifier[Slot] = Modifier; }
+	/** NPC movers have no camera, so their lean only has to be written back while it is changing. */
+	void SetDrivesCamera(int32 Slot, bool bDrivesCamera) { DrivesCamera[Slot] = bDrivesCamera; }
+
+	/**
+	* Interpolate the height and lean of every registered mover and write the results back to the components, then evaluate
+	* this frame's probes if they are run in parallel.
+	*/
+	void TickMovers(float DeltaTime);
+
+	/**
+	* The lean half of the batched interpolation: eases Num leans toward their targets for NumSteps steps.
+	*
+	* The Out arrays are resized to Num and cleared, then receive the summed offset of every step and whether the lean moved at all.
+	*/
+	static void InterpolateLeans(int32 Num, float StepDeltaTime, int32 NumSteps, float* Horz, float* Vert, const float* TargetHorz, const float* TargetVert,
+		const float* LeanSpeeds, const float* Modifier, TArray<float>& OutHorzDeltas, TArray<float>& OutVertDeltas, TArray<bool>& OutChangedFlags);
+
+private:
+	UPROPERTY(Transient)
+	TArray<UStealthPlayerMovement*> Movers;
+
+	// Capsule half height.
+	TArray<float> CurrentHeight;
+	TArray<float> TargetHeight;
+	TArray<float> HeightSpeed;
+
+	// Lean offsets of the camera, in units.
+	TArray<float> LeanHorz;
+	TArray<float> LeanVert;
+	TArray<float> TargetLeanHorz;
+	TArray<float> TargetLeanVert;
+	TArray<float> LeanSpeed;
+	TArray<float> LeanModifier;
+	TArray<bool> DrivesCamera;
+
+	// Scratch output of the interpolation pass, reused every frame.
+	TArray<float> NewHeight;
+	TArray<float> LeanHorzDelta;
+	TArray<float> LeanVertDelta;
+	TArray<bool> LeanChanged;
+
+	// Every probe gathered for this frame, the mover that asked for it, and its result. Kept around to reuse the allocations.
+	TArray<FMovementProbe> ParallelProbes;
+	TArray<int32> ParallelProbeOwners;
+	TArray<FMovementProbeResult> ParallelResults;
+
+	FStealthMovementClock Clock;
+	FStealthMoverBatchTickFunction BatchTickFunction;
+	bool bBatching = false;
+	bool bProbingInParallel = false;
+
+	/** Runs the interpolation for every step of this frame, and writes the results back once at the end. */
+	void InterpolateMovers(float StepDeltaTime, int32 NumSteps);
+	/** Gather the upcoming probes of every mover, evaluate them on task graph workers, and publish the results. */
+	void EvaluateProbesInParallel();
+
+	/** Re-reads every entry from its component, after the movers have been updating themselves with batching off. */
+	void GatherFromMovers();
+	void GatherFromMover(int32 Slot);
+};
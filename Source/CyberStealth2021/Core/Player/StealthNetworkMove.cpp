@@ -0,0 +1,107 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "StealthNetworkMove.h"
+#include "StealthPlayerMovement.h"
+#include "StealthPlayerCharacter.h"
+
+void FStealthMoveState::NetSerialize(FArchive& Ar) {
+	uint32 StateValue = (uint32)State;
+	Ar.SerializeBits(&StateValue, StateBits);
+	State = (EStealthMoveState)FMath::Min(StateValue, (uint32)EStealthMoveState::Count - 1);
+
+	if (State == EStealthMoveState::Slide) {
+		Ar << SlideProgress;
+	}
+	else if (State == EStealthMoveState::Climb) {
+		Ar << ClimbProgress;
+	}
+	Ar << RequestedHalfHeight;
+	Ar << HeightTransitionSpeed;
+
+	// Most moves aren't leaning at all, so the lean only costs a single bit then.
+	uint8 bHasLean = HasLean() ? 1 : 0;
+	Ar.SerializeBits(&bHasLean, 1);
+	if (bHasLean) {
+		Ar << LeanHorzOffset;
+		Ar << LeanVertOffset;
+		Ar << LeanRoll;
+	}
+	else if (Ar.IsLoading()) {
+		LeanHorzOffset = 0;
+		LeanVertOffset = 0;
+		LeanRoll = 0;
+	}
+}
+
+void FStealthLeanState::NetSerialize(FArchive& Ar) {
+	uint8 bLeaning = IsLeaning() ? 1 : 0;
+	Ar.SerializeBits(&bLeaning, 1);
+	if (bLeaning) {
+		Ar << TargetHorzOffset;
+		Ar << TargetVertOffset;
+		Ar << TargetRoll;
+		Ar << HorzOffset;
+		Ar << VertOffset;
+		Ar << Clearance;
+	}
+	else if (Ar.IsLoading()) {
+		*this = FStealthLeanState();
+	}
+}
+
+void FSavedMove_Stealth::Clear() {
+	Super::Clear();
+	bSavedWantsToSprint = false;
+	SavedMoveState = FStealthMoveState();
+}
+
+uint8 FSavedMove_Stealth::GetCompressedFlags() const {
+	uint8 Result = Super::GetCompressedFlags();
+	if (bSavedWantsToSprint) {
+		Result |= FLAG_WantsToSprint;
+	}
+	return Result;
+}
+
+bool FSavedMove_Stealth::CanCombineWith(const FSavedMovePtr& NewMove, ACharacter* InCharacter, float MaxDelta) const {
+	const FSavedMove_Stealth* NewStealthMove = static_cast<const FSavedMove_Stealth*>(NewMove.Get());
+	// Moves that were simulated in different states, or at different points of a slide or climb, have to be replayed separately.
+	if (bSavedWantsToSprint != NewStealthMove->bSavedWantsToSprint || SavedMoveState != NewStealthMove->SavedMoveState) {
+		return false;
+	}
+	return Super::CanCombineWith(NewMove, InCharacter, MaxDelta);
+}
+
+void FSavedMove_Stealth::SetMoveFor(ACharacter* Character, float InDeltaTime, FVector const& NewAccel, FNetworkPredictionData_Client_Character& ClientData) {
+	Super::SetMoveFor(Character, InDeltaTime, NewAccel, ClientData);
+	AStealthPlayerCharacter* StealthCharacter = Cast<AStealthPlayerCharacter>(Character);
+	if (StealthCharacter) {
+		bSavedWantsToSprint = StealthCharacter->GetStealthMovementComp()->bWantsToSprint;
+		SavedMoveState = StealthCharacter->GetStealthMovementComp()->CaptureMoveState();
+	}
+}
+
+void FSavedMove_Stealth::PrepMoveFor(ACharacter* Character) {
+	Super::PrepMoveFor(Character);
+	AStealthPlayerCharacter* StealthCharacter = Cast<AStealthPlayerCharacter>(Character);
+	if (StealthCharacter) {
+		// Replays only need the state the move was made in. The timelines and capsule keep going from where they are now.
+		StealthCharacter->GetStealthMovementComp()->SetNetworkMoveState(SavedMoveState, false);
+	}
+}
+
+FSavedMovePtr FNetworkPredictionData_Client_Stealth::AllocateNewMove() {
+	return FSavedMovePtr(new FSavedMove_Stealth());
+}
+
+void FStealthNetworkMoveData::ClientFillNetworkMoveData(const FSavedMove_Character& ClientMove, ENetworkMoveType MoveType) {
+	Super::ClientFillNetworkMoveData(ClientMove, MoveType);
+	MoveState = static_cast<const FSavedMove_Stealth&>(ClientMove).SavedMoveState;
+}
+
+bool FStealthNetworkMoveData::Serialize(UCharacterMovementComponent& CharacterMovement, FArchive& Ar, UPackageMap* PackageMap, ENetworkMoveType MoveType) {
+	Super::Serialize(CharacterMovement, Ar, PackageMap, MoveType);
+	MoveState.NetSerialize(Ar);
+	return !Ar.IsError();
+}
@@ -0,0 +1,141 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/CharacterMovementComponent.h"
+
+/** The innermost active state of the movement state machine, as sent over the network. */
+enum class EStealthMoveState : uint8 {
+	None,
+	Walk,
+	Sprint,
+	Crouch,
+	VariableCrouch,
+	Slide,
+	Climb,
+	Count
+};
+
+/**
+* Quantized snapshot of everything UStealthPlayerMovement simulates outside of the base character movement: the active state,
+* how far along the slide and climb timelines are, the capsule height that was last requested, and the lean target.
+*
+* Captured for every saved move on the owning client, sent to the server with the move, and restored when either side simulates
+* that move again, so that both run it with the same max speed, timeline positions and capsule.
+*/
+struct FStealthMoveState {
+	EStealthMoveState State = EStealthMoveState::None;
+	// Timeline playback position as a fraction of its length, 0-255.
+	uint8 SlideProgress = 0;
+	uint8 ClimbProgress = 0;
+	// Requested capsule half height in half units, and how fast to transition to it in tenths, up to 6553.5.
+	uint8 RequestedHalfHeight = 0;
+	uint16 HeightTransitionSpeed = 0;
+	// Lean target, in whole units and degrees.
+	int8 LeanHorzOffset = 0;
+	int8 LeanVertOffset = 0;
+	int8 LeanRoll = 0;
+
+	static constexpr int32 StateBits = 3;
+	static_assert((int32)EStealthMoveState::Count <= (1 << StateBits), "EStealthMoveState no longer fits in FStealthMoveState::StateBits");
+
+	static uint8 QuantizeProgress(float Alpha) { return (uint8)FMath::RoundToInt(FMath::Clamp(Alpha, 0.0f, 1.0f) * 255.0f); }
+	static float DequantizeProgress(uint8 Progress) { return Progress / 255.0f; }
+	static uint8 QuantizeHalfHeight(float HalfHeight) { return (uint8)FMath::Clamp(FMath::RoundToInt(HalfHeight * 2.0f), 0, 255); }
+	static float DequantizeHalfHeight(uint8 HalfHeight) { return HalfHeight * 0.5f; }
+	static uint16 QuantizeSpeed(float Speed) { return (uint16)FMath::Clamp(FMath::RoundToInt(Speed * 10.0f), 0, 65535); }
+	static float DequantizeSpeed(uint16 Speed) { return Speed * 0.1f; }
+	static int8 QuantizeLean(float Value) { return (int8)FMath::Clamp(FMath::RoundToInt(Value), -127, 127); }
+
+	bool HasLean() const { return LeanHorzOffset != 0 || LeanVertOffset != 0 || LeanRoll != 0; }
+
+	/** Writes or reads the state in as few bits as possible. Timeline progress and lean are only sent while they mean anything. */
+	void NetSerialize(FArchive& Ar);
+
+	bool operator==(const FStealthMoveState& Other) const {
+		return State == Other.State && SlideProgress == Other.SlideProgress && ClimbProgress == Other.ClimbProgress
+			&& RequestedHalfHeight == Other.RequestedHalfHeight && HeightTransitionSpeed == Other.HeightTransitionSpeed
+			&& LeanHorzOffset == Other.LeanHorzOffset && LeanVertOffset == Other.LeanVertOffset && LeanRoll == Other.LeanRoll;
+	}
+	bool operator!=(const FStealthMoveState& Other) const { return !(*this == Other); }
+};
+
+/**
+* Quantized lean of a UStealthPlayerMovement: what was requested, how far along the lean is, and how much room there is for it.
+*
+* Small enough to replicate to other clients with every update, and what UI should read rather than the component's floats. Nothing
+* replicates it yet: NetSerialize() is there for when simulated proxies need to show each other's leans.
+*/
+struct FStealthLeanState {
+	// Lean target, in whole units and degrees.
+	int8 TargetHorzOffset = 0;
+	int8 TargetVertOffset = 0;
+	int8 TargetRoll = 0;
+	// Current lean offset, in whole units.
+	int8 HorzOffset = 0;
+	int8 VertOffset = 0;
+	// Fraction of the requested sideways lean there is room for, 0-255.
+	uint8 Clearance = 255;
+
+	bool IsLeaning() const { return TargetHorzOffset != 0 || TargetVertOffset != 0 || TargetRoll != 0 || HorzOffset != 0 || VertOffset != 0; }
+	float GetClearance() const { return Clearance / 255.0f; }
+
+	/** Writes or reads the state. A character that isn't leaning costs a single bit. */
+	void NetSerialize(FArchive& Ar);
+
+	bool operator==(const FStealthLeanState& Other) const {
+		return TargetHorzOffset == Other.TargetHorzOffset && TargetVertOffset == Other.TargetVertOffset && TargetRoll == Other.TargetRoll
+			&& HorzOffset == Other.HorzOffset && VertOffset == Other.VertOffset && Clearance == Other.Clearance;
+	}
+	bool operator!=(const FStealthLeanState& Other) const { return !(*this == Other); }
+};
+
+/**
+* Saved move of a UStealthPlayerMovement. Adds sprinting to the compressed flags, and keeps the FStealthMoveState the move was made in.
+*/
+class CYBERSTEALTH2021_API FSavedMove_Stealth : public FSavedMove_Character {
+public:
+	typedef FSavedMove_Character Super;
+
+	bool bSavedWantsToSprint = false;
+	FStealthMoveState SavedMoveState;
+
+	virtual void Clear() override;
+	virtual uint8 GetCompressedFlags() const override;
+	virtual bool CanCombineWith(const FSavedMovePtr& NewMove, ACharacter* InCharacter, float MaxDelta) const override;
+	virtual void SetMoveFor(ACharacter* Character, float InDeltaTime, FVector const& NewAccel, FNetworkPredictionData_Client_Character& ClientData) override;
+	virtual void PrepMoveFor(ACharacter* Character) override;
+
+	/** Compressed flag that carries the sprint input. */
+	static constexpr uint8 FLAG_WantsToSprint = FLAG_Custom_0;
+};
+
+class CYBERSTEALTH2021_API FNetworkPredictionData_Client_Stealth : public FNetworkPredictionData_Client_Character {
+public:
+	typedef FNetworkPredictionData_Client_Character Super;
+
+	FNetworkPredictionData_Client_Stealth(const UCharacterMovementComponent& ClientMovement) : Super(ClientMovement) {}
+
+	virtual FSavedMovePtr AllocateNewMove() override;
+};
+
+/** Network move data that carries the FStealthMoveState of a saved move to the server. */
+struct CYBERSTEALTH2021_API FStealthNetworkMoveData : public FCharacterNetworkMoveData {
+	typedef FCharacterNetworkMoveData Super;
+
+	FStealthMoveState MoveState;
+
+	virtual void ClientFillNetworkMoveData(const FSavedMove_Character& ClientMove, ENetworkMoveType MoveType) override;
+	virtual bool Serialize(UCharacterMovementComponent& CharacterMovement, FArchive& Ar, UPackageMap* PackageMap, ENetworkMoveType MoveType) override;
+};
+
+struct CYBERSTEALTH2021_API FStealthNetworkMoveDataContainer : public FCharacterNetworkMoveDataContainer {
+	FStealthNetworkMoveDataContainer() {
+		NewMoveData = &StealthMoveData[0];
+		PendingMoveData = &StealthMoveData[1];
+		OldMoveData = &StealthMoveData[2];
+	}
+
+	FStealthNetworkMoveData StealthMoveData[3];
+};
@@ -5,25 +5,25 @@
 #include "StealthPlayerMovement.h"
 #include "Camera/CameraComponent.h"
 #include "Components/CapsuleComponent.h"
-#include "GameFramework/SpringArmComponent.h"
+#include "StealthCameraAnchorComponent.h"
 #include "Math/Vector.h"
 #include "Math/UnrealMathUtility.h"
 #include "Kismet/GameplayStatics.h"
 #include "Camera/PlayerCameraManager.h"
+#include "GameFramework/Controller.h"
+#include "../Benchmark/MovementInputRecording.h"
 
 AStealthPlayerCharacter::AStealthPlayerCharacter(const FObjectInitializer& ObjectInitializer)
 	: Super(ObjectInitializer.SetDefaultSubobjectClass<UStealthPlayerMovement>(ACharacter::CharacterMovementComponentName)) {
 
 	GetCapsuleComponent()->InitCapsuleSize(28.0f, StandingHeight);
 
-	// We aren't actually using the SpringArm for its intended purpose. It's just an "anchor" object, so that we 
-	// can bob the camera without having to worry about things like player's eye height. SpringArm is used specifically
-	// because we can use bInheritRoll = false, allowing us to roll the SpringArm but still use control rotation.
-	CameraAnchor = CreateDefaultSubobject<USpringArmComponent>(TEXT("CameraAnchor"));
+	// The anchor is there so that we can bob the camera without having to worry about things like player's eye height.
+	// It ignores the roll of the control rotation, allowing us to roll the anchor but still use control rotation.
+	// The subobject isn't named "CameraAnchor" anymore, since that name holds USpringArmComponent overrides in saved Blueprints and maps.
+	CameraAnchor = CreateDefaultSubobject<UStealthCameraAnchorComponent>(TEXT("StealthCameraAnchor"));
 	CameraAnchor->SetupAttachment(GetCapsuleComponent());
-	CameraAnchor->SetRelativeLocation(FVector(0.0f, 0.0f, StandingEyeHeight));
-	CameraAnchor->TargetArmLength = 0.0f;
-	CameraAnchor->bEnableCameraLag = false;
+	CameraAnchor->SetBaseLocation(FVector(0.0f, 0.0f, StandingEyeHeight));
 	CameraAnchor->bUsePawnControlRotation = true;		// Critical for ensuring capsule doesn't rotate when we look up and down.
 	CameraAnchor->bInheritRoll = false;
 
@@ -40,36 +40,33 @@ AStealthPlayerCharacter::AStealthPlayerCharacter(const FObjectInitializer& Objec
 
 void AStealthPlayerCharacter::Tick(float DeltaTime) {
 	Super::Tick(DeltaTime);
-
-	// TODO: Doesn't work well with lean camera tilt. How to fix?
-	/*
-	if (!StealthMovementPtr->GetInSlideState()) {
-		if (GetInputAxisValue("MoveRight") > 0) {
-			CameraFXHandler->TiltPlayerCamera(DeltaTime, CameraFXHandler->GetStrafeTiltAmount(), 
-													CameraFXHandler->GetStrafeTiltEnterTime());
-		}
-		else if (GetInputAxisValue("MoveRight") < 0) {
-			CameraFXHandler->TiltPlayerCamera(DeltaTime, -CameraFXHandler->GetStrafeTiltAmount(), 
-													CameraFXHandler->GetStrafeTiltEnterTime());
-		}
-		else {
-			CameraFXHandler->TiltPlayerCamera(DeltaTime, 0.0f, CameraFXHandler->GetStrafeTiltExitTime());
-		}
+	// The controller ticks before its pawn, so all of this frame's input has arrived by now.
+	if (FMovementInputRecorder* Recorder = FMovementInputRecorder::GetActiveFor(this)) {
+		Recorder->EndFrame(DeltaTime);
 	}
-	*/
+}
+
+void AStealthPlayerCharacter::PossessedBy(AController* NewController) {
+	Super::PossessedBy(NewController);
+	StealthMovementPtr->SetNPCMode(NewController && !NewController->IsPlayerController());
 }
 
 void AStealthPlayerCharacter::OnJumped_Implementation() {
 	Super::OnJumped_Implementation();
 	bIsAvailableForLedgeGrab = true;
 	LastJumpLiftoffZPos = GetCapsuleComponent()->GetComponentLocation().Z - GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight();
+	StealthMovementPtr->RequestJumpPrediction();
 }
 
 void AStealthPlayerCharacter::NotifyJumpApex() {
 	bIsAvailableForLedgeGrab = false;
+	StealthMovementPtr->ClearJumpPrediction();
 }
 
 void AStealthPlayerCharacter::LookY(float value) {
+	if (FMovementInputRecorder* Recorder = FMovementInputRecorder::GetActiveFor(this)) {
+		Recorder->Record(EMovementInput::LookY, value);
+	}
 	if (!StealthMovementPtr->GetInSlideState()) {
 		AddControllerPitchInput(value * XMouseSensitivity);
 	}
@@ -80,6 +77,9 @@ void AStealthPlayerCharacter::LookY(float value) {
 }
 
 void AStealthPlayerCharacter::LookX(float value) {
+	if (FMovementInputRecorder* Recorder = FMovementInputRecorder::GetActiveFor(this)) {
+		Recorder->Record(EMovementInput::LookX, value);
+	}
 	if (!StealthMovementPtr->GetInSlideState()) {
 		AddControllerYawInput(value * XMouseSensitivity);
 	}
@@ -90,17 +90,54 @@ void AStealthPlayerCharacter::LookX(float value) {
 }
 
 void AStealthPlayerCharacter::Crouch(bool bClientSimulation) {
+	if (FMovementInputRecorder* Recorder = FMovementInputRecorder::GetActiveFor(this)) {
+		Recorder->Record(EMovementInput::Crouch);
+	}
 	StealthMovementPtr->bWantsToCrouch = true;
 }
 
-void AStealthPlayerCharacter::OnPlayerStepped() {
+void AStealthPlayerCharacter::UnCrouch(bool bClientSimulation) {
+	if (FMovementInputRecorder* Recorder = FMovementInputRecorder::GetActiveFor(this)) {
+		Recorder->Record(EMovementInput::UnCrouch);
+	}
+	Super::UnCrouch(bClientSimulation);
+}
+
+void AStealthPlayerCharacter::Jump() {
+	if (FMovementInputRecorder* Recorder = FMovementInputRecorder::GetActiveFor(this)) {
+		Recorder->Record(EMovementInput::Jump);
+	}
+	Super::Jump();
+}
+
+void AStealthPlayerCharacter::StopJumping() {
+	if (FMovementInputRecorder* Recorder = FMovementInputRecorder::GetActiveFor(this)) {
+		Recorder->Record(EMovementInput::StopJumping);
+	}
+	Super::StopJumping();
+}
+
+void AStealthPlayerCharacter::AddMovementInput(FVector WorldDirection, float ScaleValue, bool bForce) {
+	if (FMovementInputRecorder* Recorder = FMovementInputRecorder::GetActiveFor(this)) {
+		Recorder->RecordMovementInput(WorldDirection * ScaleValue);
+	}
+	Super::AddMovementInput(WorldDirection, ScaleValue, bForce);
+}
+
+void AStealthPlayerCharacter::OnPlayerStepped(float SecondsAgo) {
 	// TODO: Footstep sounds.
 }
 
 void AStealthPlayerCharacter::Sprint() {
-	bIsSprinting = true;
+	if (FMovementInputRecorder* Recorder = FMovementInputRecorder::GetActiveFor(this)) {
+		Recorder->Record(EMovementInput::Sprint);
+	}
+	StealthMovementPtr->bWantsToSprint = true;
 }
 
 void AStealthPlayerCharacter::StopSprinting() {
-	bIsSprinting = false;
+	if (FMovementInputRecorder* Recorder = FMovementInputRecorder::GetActiveFor(this)) {
+		Recorder->Record(EMovementInput::StopSprinting);
+	}
+	StealthMovementPtr->bWantsToSprint = false;
 }
\ No newline at end of file
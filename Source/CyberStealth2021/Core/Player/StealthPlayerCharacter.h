@@ -9,7 +9,7 @@
 
 class UCameraComponent;
 class UStealthPlayerMovement;
-class USpringArmComponent;
+class UStealthCameraAnchorComponent;
 class APlayerCameraManager;
 /**
  * 
@@ -25,7 +25,7 @@ private:
 	UPROPERTY(EditAnywhere)
 	UCameraFXHandler* CameraFXHandler;
 	UStealthPlayerMovement* StealthMovementPtr;
-	USpringArmComponent* CameraAnchor;
+	UStealthCameraAnchorComponent* CameraAnchor;
 
 	APlayerCameraManager* cameraManager;
 
@@ -33,9 +33,17 @@ private:
 	float LastJumpLiftoffZPos = 0.0f;
 
 	friend UCameraFXHandler;			// Declare UCameraBob as friend so it can access the private OnPlayerStepped() function.
+	friend UStealthPlayerMovement;		// Sets bIsSprinting from its bWantsToSprint, like it sets bIsCrouched.
 protected:
 	virtual void Tick(float DeltaTime) override;
-	virtual void OnPlayerStepped();
+	/**
+	* Called by the head bob for every step that lands.
+	*
+	* @param SecondsAgo - How long before the end of the current frame the foot landed.
+	*/
+	virtual void OnPlayerStepped(float SecondsAgo);
+	/** Switches the movement component into NPC mode when possessed by an AI controller, and back when possessed by a player. */
+	virtual void PossessedBy(AController* NewController) override;
 
 public:
 	AStealthPlayerCharacter(const FObjectInitializer& ObjectInitializer);
@@ -50,6 +58,11 @@ public:
 	void LookX(float value);
 
 	virtual void Crouch(bool bClientSimulation) override;
+	virtual void UnCrouch(bool bClientSimulation) override;
+	virtual void Jump() override;
+	virtual void StopJumping() override;
+	/** Also reports the input to the active FMovementInputRecorder if it is recording this character. */
+	virtual void AddMovementInput(FVector WorldDirection, float ScaleValue = 1.0f, bool bForce = false) override;
 	virtual void OnJumped_Implementation() override;
 	virtual void NotifyJumpApex() override;
 
@@ -58,7 +71,7 @@ public:
 	UFUNCTION(BlueprintCallable)
 	FORCEINLINE UStealthPlayerMovement* GetStealthMovementComp() { return StealthMovementPtr; }
 	UFUNCTION(BlueprintCallable)
-	FORCEINLINE USpringArmComponent* GetCameraAnchor() { return CameraAnchor; }
+	FORCEINLINE UStealthCameraAnchorComponent* GetCameraAnchor() { return CameraAnchor; }
 	UFUNCTION(BlueprintCallable)
 	FORCEINLINE UCameraFXHandler* GetCameraFXHandler() { return CameraFXHandler; }
 	UFUNCTION(BlueprintCallable)
@@ -4,12 +4,71 @@
 #include "StealthPlayerMovement.h"
 #include "GameFramework/Character.h"
 #include "Components/CapsuleComponent.h"
-#include "GameFramework/SpringArmComponent.h"
+#include "StealthCameraAnchorComponent.h"
 #include "StealthPlayerCharacter.h"
 #include "Camera/CameraComponent.h"
 #include "Algo/Reverse.h"
+#include "HAL/IConsoleManager.h"
+#include "../Climbing/LedgeIndex.h"
+#include "../Climbing/LedgeIndexSubsystem.h"
+#include "StealthMovementSubsystem.h"
 
 #include "CameraFXHandler.h"
+#include "../Benchmark/MovementBenchmark.h"
+#include "../Benchmark/MovementInputRecording.h"
+#include "StealthMovementStats.h"
+
+static TAutoConsoleVariable<int32> CVarAsyncProbes(TEXT("stealth.AsyncProbes"), 1, 
+	TEXT("If enabled, movement probes are queued as async scene queries at the end of each tick and consumed on the next one.\n"), ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarUseLedgeIndex(TEXT("stealth.UseLedgeIndex"), 1,
+	TEXT("If enabled, ledge detection looks ledges up in the baked ledge index of the current level when there is one, instead of sweeping for them.\n"), ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarPredictLedges(TEXT("stealth.PredictLedges"), 1,
+	TEXT("If enabled, the geometry along a jump is gathered once at liftoff, and ledge detection only tests against that until the player strays from the predicted arc.\n"), ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarLeanClearanceTolerance(TEXT("stealth.LeanClearanceTolerance"), 2.0f,
+	TEXT("How far in units the lean clearance probe may stray from the last one before the lean clearance is probed again. 0 only reuses it while the anchor stands perfectly still.\n"), ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarLeanClearanceMaxAge(TEXT("stealth.LeanClearanceMaxAge"), 0.25f,
+	TEXT("Seconds of movement the lean clearance is reused for at most, so that doors and characters moving into the lean are still noticed while the anchor stands still. 0 never expires it.\n"), ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarDeriveFlatBase(TEXT("stealth.DeriveFlatBase"), 1,
+	TEXT("If enabled, whether to use the flat base is decided from the floor the movement update already swept for, instead of with a floor trace of its own.\n"), ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarValidateFlatBase(TEXT("stealth.ValidateFlatBase"), 0,
+	TEXT("If enabled while stealth.DeriveFlatBase is, the floor trace still runs every grounded tick and every tick where it disagrees with the derived flat base is counted.\n"), ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarEventDrivenTransitions(TEXT("stealth.EventDrivenTransitions"), 1,
+	TEXT("If enabled, movement state transitions are only evaluated on ticks where an input, the movement mode, a timeline or the pose they depend on changed.\n"), ECVF_Default);
+
+DECLARE_CYCLE_STAT(TEXT("Movement Tick"), STAT_StealthMovement_TickComponent, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Process State Transitions"), STAT_StealthMovement_ProcessStateTransitions, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Update States"), STAT_StealthMovement_UpdateStates, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Queue Async Probes"), STAT_StealthMovement_QueueAsyncProbes, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Flat Base Toggle"), STAT_StealthMovement_FlatBaseToggle, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Test For Valid Ledges"), STAT_StealthMovement_TestForValidLedges, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Update Lean State"), STAT_StealthMovement_UpdateLeanState, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Update Character Height"), STAT_StealthMovement_UpdateCharacterHeight, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Predict Jump Ledges"), STAT_StealthMovement_PredictJumpLedges, STATGROUP_StealthMovement);
+DECLARE_CYCLE_STAT(TEXT("Build Query Cache"), STAT_StealthMovement_BuildQueryCache, STATGROUP_StealthMovement);
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Queries: Floor Trace"), STAT_StealthQueries_FloorTrace, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Queries: Ledge Confirm"), STAT_StealthQueries_LedgeConfirm, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Queries: Jump Prediction"), STAT_StealthQueries_JumpPrediction, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Jump Predictions"), STAT_StealthMovement_JumpPredictions, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Queries: Find Floor"), STAT_StealthQueries_FindFloor, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("State Transitions Skipped"), STAT_StealthMovement_TransitionsSkipped, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Capsule Resize Overlap Updates"), STAT_StealthMovement_ResizeOverlapUpdates, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Lean Clearance Reused"), STAT_StealthMovement_LeanClearanceReused, STATGROUP_StealthMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Flat Base Mismatches"), STAT_StealthMovement_FlatBaseMismatches, STATGROUP_StealthMovement);
+
+namespace {
+	// How far the floor under the flat base may move up or down before the ledge it was switched on at no longer holds it.
+	constexpr float FlatBaseEdgeHeightTolerance = 1.0f;
+	// Radius of the capsule swept down past an edge to measure the drop, thin enough to stand in for the floor trace under the center.
+	constexpr float FlatBaseDropProbeRadius = 1.0f;
+}
 
 UStealthPlayerMovement::UStealthPlayerMovement() {
 	// We want this off by default, so the player can smoothly move up and down steps.
@@ -20,6 +79,7 @@ UStealthPlayerMovement::UStealthPlayerMovement() {
 	CrouchedHalfHeight = 42.0f;
 
 	movementStates.Initialize<PlayerMovementStates::GenericLocomotion>(this);
+	SetNetworkMoveDataContainer(StealthMoveDataContainer);
 
 	PlayerRef = Cast<AStealthPlayerCharacter>(GetOwner());
 }
@@ -45,7 +105,37 @@ void UStealthPlayerMovement::BeginPlay() {
 	ClimbTimeline.SetTimelineFinishedFunc(FinishedClimbEvent);
 	ClimbTimeline.SetPlayRate(1 / 0.3f);
 
-	
+	LedgeIndex = GetWorld()->GetSubsystem<ULedgeIndexSubsystem>();
+	SetNPCMode(bNPCMode);
+
+	MoverBatch = GetWorld()->GetSubsystem<UStealthMovementSubsystem>();
+	if (MoverBatch) {
+		MoverBatch->RegisterMover(this);
+	}
+}
+
+void UStealthPlayerMovement::EndPlay(const EEndPlayReason::Type EndPlayReason) {
+	if (MoverBatch) {
+		MoverBatch->UnregisterMover(this);
+		MoverBatch = nullptr;
+	}
+	Super::EndPlay(EndPlayReason);
+}
+
+void UStealthPlayerMovement::SetNPCMode(bool bEnable) {
+	bNPCMode = bEnable;
+	// The flat base toggle only exists to keep the player's camera smooth on steps, NPCs can always use the flat base.
+	bUseFlatBaseForFloorChecks = bNPCMode;
+
+	if (PlayerRef) {
+		if (!bNPCMode) {
+			PlayerRef->GetCameraFXHandler()->WakeUp();
+		}
+		PlayerRef->GetPlayerCamera()->SetActive(!bNPCMode);
+	}
+	if (MoverBatchSlot != INDEX_NONE) {
+		MoverBatch->SetDrivesCamera(MoverBatchSlot, !bNPCMode);
+	}
 }
 
 void UStealthPlayerMovement::OnMovementModeChanged(EMovementMode PreviousMovementMode, uint8 PreviousCustomMode) {
@@ -57,82 +147,450 @@ void UStealthPlayerMovement::OnMovementModeChanged(EMovementMode PreviousMovemen
 }
 
 void UStealthPlayerMovement::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) {
-	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
-	UpdateCharacterHeight();
-	UpdateLeanState();
+	STEALTH_BENCHMARK_SCOPE("UStealthPlayerMovement::TickComponent");
+	SCOPE_CYCLE_COUNTER(STAT_StealthMovement_TickComponent);
+	TGuardValue<bool> InMovementTick(bInMovementTick, true);
+	const bool bBatched = MoverBatchSlot != INDEX_NONE && MoverBatch->IsBatching();
+	const FStealthMovementClock* Clock = MoverBatchSlot != INDEX_NONE ? &MoverBatch->GetClock() : nullptr;
 
-	movementStates.ProcessStateTransitions();
-	movementStates.UpdateStates();
-	FlatBaseToggle();
-	SlideTimeline.TickTimeline(DeltaTime);
-	ClimbTimeline.TickTimeline(DeltaTime);
+	UCapsuleComponent* capsule = CharacterOwner->GetCapsuleComponent();
+	if (Clock && Clock->IsFixed()) {
+		// Simulate from where the capsule really is, not from where it was drawn last frame.
+		ApplyRenderInterpolation(0.0f);
+		// The base movement consumes its input on every step, so hand the same input to each of them.
+		const FVector PendingInput = GetPendingInputVector();
+		for (int32 Step = 0; Step < Clock->NumSteps; Step++) {
+			if (Step > 0) {
+				AddInputVector(PendingInput);
+			}
+			LastStepLocation = capsule->GetComponentLocation();
+			LastStepHalfHeight = capsule->GetUnscaledCapsuleHalfHeight();
+			// Only the first step ticks the base component, so Blueprint ticks and the rest of the component tick run once per frame.
+			SimulateStep(Clock->StepDeltaTime, TickType, ThisTickFunction, bBatched, Step == 0);
+		}
+		ApplyRenderInterpolation(Clock->Alpha);
+		bRenderInterpolating = true;
+	}
+	else {
+		if (bRenderInterpolating) {
+			ApplyRenderInterpolation(0.0f);
+			bRenderInterpolating = false;
+		}
+		SimulateStep(DeltaTime, TickType, ThisTickFunction, bBatched, true);
+	}
+
+	if (bBatched && !IsLeanIdle()) {
+		// The batch already moved us to this frame's height and lean, it only needs to know how much room there is to lean into.
+		MoverBatch->SetLeanModifier(MoverBatchSlot, CalculateLeanModifier());
+	}
+	if (!bNPCMode) {
+		PlayerRef->GetCameraFXHandler()->TickCameraFX(DeltaTime);
+	}
+	else {
+		// NPCs have no camera effects, but their anchor still has to follow the view and carry the crouch and lean offsets.
+		PlayerRef->GetCameraFXHandler()->GetCameraLayers().Apply();
+	}
+	QueueAsyncProbes();
 }
 
-void UStealthPlayerMovement::FlatBaseToggle() {
-	// No need to alter base when in midair.
-	if (IsMovingOnGround()) {
+void UStealthPlayerMovement::SimulateStep(float StepDeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction, bool bBatched,
+	bool bTickComponent) {
+	MovementDeltaTime = StepDeltaTime;
+	if (bTickComponent) {
+		Super::TickComponent(StepDeltaTime, TickType, ThisTickFunction);
+	}
+	else {
+		SimulateMovement(StepDeltaTime);
+	}
+	// CurrentFloor was just filled in by the movement update, remember where that happened so the query cache can reuse it.
+	CurrentFloorLocation = CharacterOwner->GetCapsuleComponent()->GetComponentLocation();
+	CurrentFloorHalfHeight = CharacterOwner->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight();
+	InvalidateQueryCache();
+	MovementTime += StepDeltaTime;
+
+	if (bJumpPredictionPending) {
+		bJumpPredictionPending = false;
+		PredictJumpLedges();
+	}
+
+	// While the capsule is being resized, the resize and anything the states and timelines move it by afterwards update its overlaps
+	// once, when this step is done. The base movement above keeps its own scope, so it always starts from up to date overlaps.
+	UCapsuleComponent* capsule = CharacterOwner->GetCapsuleComponent();
+	const bool bResizing = !bBatched && capsule->GetUnscaledCapsuleHalfHeight() != NewCapsuleHeight;
+	{
+		FScopedMovementUpdate DeferResizeOverlaps(capsule, bResizing ? EScopedUpdate::DeferredUpdates : EScopedUpdate::ImmediateUpdates);
+		if (!bBatched) {
+			UpdateCharacterHeight();
+			UpdateLeanState();
+		}
+
+		ProcessStates();
+		FlatBaseToggle();
+		SlideTimeline.TickTimeline(StepDeltaTime);
+		ClimbTimeline.TickTimeline(StepDeltaTime);
+	}
+	if (bResizeOverlapsDeferred) {
+		INC_DWORD_STAT(STAT_StealthMovement_ResizeOverlapUpdates);
+		bResizeOverlapsDeferred = false;
+	}
+}
+
+void UStealthPlayerMovement::SimulateMovement(float StepDeltaTime) {
+	// The movement part of UPBPlayerMovement::TickComponent() and UCharacterMovementComponent::TickComponent(). Fixed steps only run
+	// in standalone games, so there is no replication or proxy smoothing to do, only the move of a character we have authority over.
+	const FVector InputVector = ConsumeInputVector();
+	if (!HasValidData() || ShouldSkipUpdate(StepDeltaTime) || UpdatedComponent->IsSimulatingPhysics()) {
+		return;
+	}
+
+	bAppliedFriction = false;
+	BrakingFrictionFactor = StepDeltaTime > MaxSimulationTimeStep ? 2.0f : 1.0f;
+	if (CharacterOwner->IsLocallyControlled() || (!CharacterOwner->Controller && bRunPhysicsWithNoController)
+		|| (!CharacterOwner->Controller && CharacterOwner->IsPlayingRootMotion())) {
+		ControlledCharacterMove(InputVector, StepDeltaTime);
+	}
+	bBrakingFrameTolerated = IsMovingOnGround();
+}
+
+void UStealthPlayerMovement::ProcessStates() {
+	if (!bTransitionInputsValid || CVarEventDrivenTransitions->GetInt() == 0 || CaptureTransitionInputs() != LastTransitionInputs) {
+		{
+			STEALTH_BENCHMARK_SCOPE("UStealthPlayerMovement::ProcessStateTransitions");
+			SCOPE_CYCLE_COUNTER(STAT_StealthMovement_ProcessStateTransitions);
+			movementStates.ProcessStateTransitions();
+		}
+		// The transitions clear the finished flags and may enter states that test the pose, so capture the inputs as they left them.
+		LastTransitionInputs = CaptureTransitionInputs();
+		bTransitionInputsValid = true;
+		bActiveStatesHaveUpdate = IsInStates(StealthMovementStateBits::Slide | StealthMovementStateBits::VariableCrouch);
+		NotifyStateChanges();
+	}
+	else {
+		INC_DWORD_STAT(STAT_StealthMovement_TransitionsSkipped);
+	}
+
+	if (bActiveStatesHaveUpdate) {
+		STEALTH_BENCHMARK_SCOPE("UStealthPlayerMovement::UpdateStates");
+		SCOPE_CYCLE_COUNTER(STAT_StealthMovement_UpdateStates);
+		movementStates.UpdateStates();
+	}
+}
+
+void UStealthPlayerMovement::NotifyStateChanges() {
+	if (ActiveStateBits != BroadcastStateBits) {
+		const uint32 PreviousStateBits = BroadcastStateBits;
+		BroadcastStateBits = ActiveStateBits;
+		OnStateChangedNative.Broadcast(this, PreviousStateBits, ActiveStateBits);
+		OnStateChanged.Broadcast((int32)PreviousStateBits, (int32)ActiveStateBits);
+	}
+#if UE_TRACE_ENABLED
+	if (UE_TRACE_CHANNELEXPR_IS_ENABLED(StealthMovementChannel) && ActiveStateBits != TracedStateBits) {
+		TraceStealthStateTransition(this, TracedStateBits, ActiveStateBits);
+		TracedStateBits = ActiveStateBits;
+	}
+#endif
+}
+
+UStealthPlayerMovement::FStateTransitionInputs UStealthPlayerMovement::CaptureTransitionInputs() {
+	const bool bLedgeGrab = PlayerRef->GetIsAvailableForLedgeGrab();
+
+	FStateTransitionInputs Inputs;
+	Inputs.Flags = (bWantsToSprint ? 1 << 0 : 0)
+		| (bWantsToCrouch ? 1 << 1 : 0)
+		| (PBCharacter->bIsCrouched ? 1 << 2 : 0)
+		| (bLedgeGrab ? 1 << 3 : 0)
+		| (bDidFinishSlide ? 1 << 4 : 0)
+		| (bDidFinishClimb ? 1 << 5 : 0);
+	Inputs.MovementMode = MovementMode;
+	Inputs.CustomMovementMode = CustomMovementMode;
+
+	// Walking and sprinting only depend on input. Crouching checks the ceiling, a slide checks what is in front of it, and a
+	// jump looks for ledges, so those are evaluated again whenever the capsule has moved or changed height.
+	if (bLedgeGrab || IsInStates(StealthMovementStateBits::Crouch | StealthMovementStateBits::VariableCrouch | StealthMovementStateBits::Slide)) {
+		UCapsuleComponent* capsule = CharacterOwner->GetCapsuleComponent();
+		Inputs.PoseLocation = capsule->GetComponentLocation();
+		Inputs.PoseHalfHeight = capsule->GetUnscaledCapsuleHalfHeight();
+	}
+	return Inputs;
+}
+
+void UStealthPlayerMovement::ApplyRenderInterpolation(float Alpha) {
+	FVector Offset = FVector::ZeroVector;
+	if (Alpha > 0.0f) {
+		// Draw the camera where the capsule was Alpha of the way through the step that is still to come, which is the same as
+		// lagging behind the last step by the rest of it.
+		UCapsuleComponent* capsule = CharacterOwner->GetCapsuleComponent();
+		const FVector WorldOffset = (LastStepLocation - capsule->GetComponentLocation()) * (1.0f - Alpha);
+		Offset = capsule->GetComponentTransform().InverseTransformVectorNoScale(WorldOffset);
+		// The camera anchor moves by as much as the capsule is resized, so ease the resize the same way.
+		Offset.Z += (LastStepHalfHeight - capsule->GetUnscaledCapsuleHalfHeight()) * (1.0f - Alpha);
+	}
+	if (!bNPCMode) {
+		PlayerRef->GetCameraFXHandler()->GetCameraLayers().SetLocation(ECameraLayer::RenderInterpolation, Offset);
+	}
+}
+
+FMovementProbe UStealthPlayerMovement::MakeProbe(EMovementProbe Type) {
+	const FMovementQueryCache& Cache = GetQueryCache();
+	FMovementProbe Probe;
+	Probe.Type = Type;
+
+	switch (Type) {
+	case EMovementProbe::CanUncrouch:
+		// Sweeps a box from the bottom of the capsule up to the standing height.
+		Probe.Start = Cache.CapsuleBase;
+		Probe.End = Probe.Start;
+		Probe.End.Z = Probe.End.Z + (PlayerRef->StandingHeight * 2);
+		Probe.Shape = FCollisionShape::MakeBox(FVector(10, 10, 0));
+		break;
+	case EMovementProbe::NeedsVariableCrouch:
+		// Sweeps a box from the floor up to the regular crouch height.
+		Probe.Start = Cache.CapsuleLocation;
+		Probe.Start.Z -= Cache.FloorDist;
+		Probe.End = Probe.Start;
+		Probe.Start.Z = Probe.Start.Z - Cache.CapsuleHalfHeight + 1;
+		Probe.End.Z = (Probe.End.Z - Cache.CapsuleHalfHeight) + (CrouchedHalfHeight * 2);
+		Probe.Shape = FCollisionShape::MakeBox(FVector(30, 30, 0));
+		break;
+	case EMovementProbe::CanExitVariableCrouch:
+		Probe.Start = Cache.CapsuleLocation;
+		Probe.End = Probe.Start;
+		Probe.Start.Z = Probe.Start.Z - (Cache.CapsuleHalfHeight) * MovementDeltaTime;
+		Probe.End.Z = (Probe.End.Z - (Cache.CapsuleHalfHeight) * MovementDeltaTime) + (CrouchedHalfHeight * 2);
+		Probe.Shape = FCollisionShape::MakeBox(FVector(30, 30, 0));
+		break;
+	case EMovementProbe::LeanClearance: {
+		if (bNPCMode) {
+			// NPCs have no camera to keep out of walls, only a line of sight.
+			Probe.Query = EMovementProbeQuery::LineTrace;
+			Probe.Start = Cache.CapsuleLocation;
+			Probe.Start.Z += PlayerRef->StandingEyeHeight;
+			Probe.End = (CharacterOwner->GetActorRightVector() * TargetLeanHorzOffset) + Probe.Start;
+			break;
+		}
+		UStealthCameraAnchorComponent* cameraAnchor = PlayerRef->GetCameraAnchor();
+		Probe.Start = cameraAnchor->GetComponentLocation();
+		Probe.End = (cameraAnchor->GetRightVector() * (TargetLeanHorzOffset)) + Probe.Start;
+		Probe.Shape = FCollisionShape::MakeSphere(25.0f);
+		break;
+	}
+	case EMovementProbe::FlatBase:
 		// We add max step height to our trace, because we don't want a flat base when the player
 		// approaches ledges that they should be able to just "step off".
-		if (!TraceTestForFloor(MaxStepHeight)) {
-			bUseFlatBaseForFloorChecks = true;
+		Probe = MakeFloorProbe(MaxStepHeight);
+		break;
+	case EMovementProbe::SlideInterrupt:
+		// Sweeps a box in front of the player, from step height up to the slide height.
+		Probe.Start = Cache.CapsuleLocation;
+		Probe.Start = Probe.Start + (PlayerRef->GetActorForwardVector() * 20.0f);
+		Probe.Start.Z = Probe.Start.Z - Cache.FloorDist - Cache.CapsuleHalfHeight + 1;
+		Probe.End = Probe.Start;
+		Probe.Start.Z = Probe.Start.Z + MaxStepHeight;
+		Probe.End.Z = Probe.End.Z + (56);
+		Probe.Shape = FCollisionShape::MakeBox(FVector(15, 15, 0));
+		// FCollisionQueryParams::DefaultQueryParam is set to trace complex collision. For some reason, that is causing the trace to fail
+		// for me. So for now I have to substitute my own default FCollisionQueryParams that isn't tracing for complex collision.
+		Probe.Params = FCollisionQueryParams();
+		break;
+	case EMovementProbe::LedgeScan:
+		// Check in front of the player to see if there are any ledges within the player's "grabbing range".
+		Probe.Query = EMovementProbeQuery::MultiSweepStatic;
+		Probe.Start = Cache.CapsuleLocation;
+		Probe.Start.Z = (Probe.Start.Z + Cache.CapsuleHalfHeight) + LedgeGrabHeightAboveHead;
+		Probe.Start = Probe.Start + (CharacterOwner->GetCapsuleComponent()->GetForwardVector() * MaxClimbAngle);
+		Probe.End = Probe.Start;
+		Probe.End.Z = Probe.End.Z - (Cache.CapsuleHalfHeight * 2) + MaxStepHeight;
+		Probe.Shape = FCollisionShape::MakeSphere(5.0f);
+		break;
+	default:
+		checkNoEntry();
+		break;
+	}
+
+	return Probe;
+}
+
+FMovementProbe UStealthPlayerMovement::MakeFloorProbe(float zOffset) {
+	const FMovementQueryCache& Cache = GetQueryCache();
+	FMovementProbe Probe;
+	Probe.Type = EMovementProbe::FlatBase;
+	Probe.Query = EMovementProbeQuery::LineTrace;
+	Probe.Start = Cache.CapsuleLocation;
+	Probe.End = Probe.Start;
+	// Subtract any specified user offset, and subtract the units that the character floats above the floor.
+	Probe.End.Z = Probe.End.Z - Cache.CapsuleHalfHeight - zOffset - Cache.FloorDist;
+	return Probe;
+}
+
+const FMovementProbeResult& UStealthPlayerMovement::RunProbe(EMovementProbe Type, bool bExact) {
+	const bool bProbedInParallel = MoverBatchSlot != INDEX_NONE && MoverBatch->IsProbingInParallel();
+	if (!bExact && (CVarAsyncProbes->GetInt() != 0 || bProbedInParallel)) {
+		if (const FMovementProbeResult* Queued = ProbePipeline.Consume(GetWorld(), Type)) {
+			return *Queued;
 		}
-		else {
-			bUseFlatBaseForFloorChecks = false;
+	}
+	return ProbePipeline.Run(GetWorld(), MakeProbe(Type));
+}
+
+void UStealthPlayerMovement::QueueAsyncProbes() {
+	STEALTH_BENCHMARK_SCOPE("UStealthPlayerMovement::QueueAsyncProbes");
+	SCOPE_CYCLE_COUNTER(STAT_StealthMovement_QueueAsyncProbes);
+	if (CVarAsyncProbes->GetInt() == 0) {
+		return;
+	}
+	// The batch is going to evaluate next frame's probes itself, with fresher positions than we have now.
+	if (MoverBatchSlot != INDEX_NONE && MoverBatch->IsProbingInParallel()) {
+		return;
+	}
+
+	TArray<FMovementProbe, TInlineAllocator<8>> Probes;
+	GatherUpcomingProbes(Probes);
+	for (const FMovementProbe& Probe : Probes) {
+		ProbePipeline.Queue(GetWorld(), Probe);
+	}
+}
+
+void UStealthPlayerMovement::GatherUpcomingProbes(TArray<FMovementProbe, TInlineAllocator<8>>& OutProbes) {
+	// Only gather the probes that the current states are actually going to ask for.
+	if (IsMovingOnGround() && !bNPCMode && CVarDeriveFlatBase->GetInt() == 0) {
+		OutProbes.Add(MakeProbe(EMovementProbe::FlatBase));
+	}
+	if (TargetLeanHorzOffset != 0.0f) {
+		FMovementProbe LeanProbe = MakeProbe(EMovementProbe::LeanClearance);
+		if (!IsLeanClearanceCached(LeanProbe)) {
+			OutProbes.Add(MoveTemp(LeanProbe));
 		}
 	}
+	if (PlayerRef->GetIsAvailableForLedgeGrab() && !(JumpPrediction.bValid && CVarPredictLedges->GetInt() != 0)) {
+		OutProbes.Add(MakeProbe(EMovementProbe::LedgeScan));
+	}
+
+	if (IsInStates(StealthMovementStateBits::Slide)) {
+		OutProbes.Add(MakeProbe(EMovementProbe::SlideInterrupt));
+	}
+	else if (IsInStates(StealthMovementStateBits::VariableCrouch)) {
+		OutProbes.Add(MakeProbe(EMovementProbe::CanUncrouch));
+		OutProbes.Add(MakeProbe(EMovementProbe::NeedsVariableCrouch));
+		OutProbes.Add(MakeProbe(EMovementProbe::CanExitVariableCrouch));
+	}
+	else if (IsInStates(StealthMovementStateBits::Crouch)) {
+		OutProbes.Add(MakeProbe(EMovementProbe::CanUncrouch));
+		OutProbes.Add(MakeProbe(EMovementProbe::NeedsVariableCrouch));
+	}
+	else if (bWantsToCrouch || bDidFinishSlide) {
+		OutProbes.Add(MakeProbe(EMovementProbe::NeedsVariableCrouch));
+	}
 }
 
-bool UStealthPlayerMovement::TraceTestForFloor(float zOffset = 0) {
-	FVector Start = CharacterOwner->GetCapsuleComponent()->GetComponentLocation();
-	FVector End = Start;
-	// Subtract any specified user offset, and subtract the units that the character floats above the floor.
-	End.Z = End.Z - CharacterOwner->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight() - zOffset - GetFloorOffset();
+void UStealthPlayerMovement::FlatBaseToggle() {
+	STEALTH_BENCHMARK_SCOPE("UStealthPlayerMovement::FlatBaseToggle");
+	SCOPE_CYCLE_COUNTER(STAT_StealthMovement_FlatBaseToggle);
+	// No need to alter base when in midair, and NPCs always use the flat base.
+	if (IsMovingOnGround() && !bNPCMode) {
+		if (CVarDeriveFlatBase->GetInt() == 0) {
+			// A floor result from last frame is fine here, the base only needs to be close to right as the player approaches a ledge.
+			bUseFlatBaseForFloorChecks = !RunProbe(EMovementProbe::FlatBase).bBlockingHit;
+			return;
+		}
 
-	FHitResult discard;		// For now, we never actually need the hit result, so we are discarding it.
-							// TODO: Think of a way to optionally return this? Function overloading? Out parameters?
-	if (GetWorld()->LineTraceSingleByChannel(discard, Start, End, ECollisionChannel::ECC_Visibility)) {
+		const bool bNearLedge = IsNearLedge(CurrentFloor);
+		if (CVarValidateFlatBase->GetInt() != 0) {
+			bFlatBaseMismatch = bNearLedge == RunProbe(EMovementProbe::FlatBase, true).bBlockingHit;
+			if (bFlatBaseMismatch) {
+				INC_DWORD_STAT(STAT_StealthMovement_FlatBaseMismatches);
+			}
+		}
+		bUseFlatBaseForFloorChecks = bNearLedge;
+	}
+}
+
+bool UStealthPlayerMovement::IsNearLedge(const FFindFloorResult& Floor) {
+	// Without a swept floor there is nothing to go by, so keep the base the player already has.
+	if (!Floor.IsWalkableFloor() || Floor.bLineTrace) {
+		return bUseFlatBaseForFloorChecks;
+	}
+
+	const FHitResult& Hit = Floor.HitResult;
+	if (!bUseFlatBaseForFloorChecks) {
+		// The rounded base rests on the face beneath its lowest point, touching it along the face normal, even on a slope. It only
+		// touches at an angle to the face when the face ends before it reaches under the capsule, which is the player stepping past an edge.
+		if (FVector::Parallel(Hit.Normal, Hit.ImpactNormal)) {
+			return false;
+		}
+		// Like the floor trace, only a drop deeper than a step is a ledge. Anything shallower the player should just step down.
+		// The perch check sweeps a thin capsule down from the center, so it only runs on the ticks the base is on an edge.
+		FFindFloorResult DropFloor;
+		INC_DWORD_STAT(STAT_StealthQueries_FindFloor);
+		if (ComputePerchResult(FlatBaseDropProbeRadius, Hit, MaxStepHeight, DropFloor)) {
+			return false;
+		}
+		FlatBaseEdge = Hit.ImpactPoint;
+		FlatBaseEdgeNormal = (Hit.ImpactPoint - Hit.Location).GetSafeNormal2D();
 		return true;
 	}
-	else {
+
+	// The flat base stands level on the edge, so its sweep can't tell where the edge is anymore. Keep it until the capsule has
+	// moved back over the floor behind the edge it was switched on at, or stepped onto a floor at another height.
+	if (FMath::Abs(Hit.ImpactPoint.Z - FlatBaseEdge.Z) > FlatBaseEdgeHeightTolerance) {
 		return false;
 	}
+	return ((Hit.Location - FlatBaseEdge) | FlatBaseEdgeNormal) < 0.0f;
+}
+
+bool UStealthPlayerMovement::TraceTestForFloor(float zOffset = 0) {
+	INC_DWORD_STAT(STAT_StealthQueries_FloorTrace);
+	return ProbePipeline.Run(GetWorld(), MakeFloorProbe(zOffset)).bBlockingHit;
 }
 
 bool UStealthPlayerMovement::TestForValidLedges(FVector& OutValidLedgeLocation) {
-	UCapsuleComponent* playerCapsule = CharacterOwner->GetCapsuleComponent();
-	float halfHeight = playerCapsule->GetUnscaledCapsuleHalfHeight();
-
-	// Check in front of the player to see if there are any ledges within the player's "grabbing range". 
-	TArray<FHitResult> results;
-	FVector start = playerCapsule->GetComponentLocation();
-	start.Z = (start.Z + halfHeight) + LedgeGrabHeightAboveHead;
-	start = start + (playerCapsule->GetForwardVector() * MaxClimbAngle);
-	FVector end = start;
-	end.Z = end.Z - (halfHeight * 2) + MaxStepHeight;
-	if (!GetWorld()->SweepMultiByObjectType(results, start, end, FQuat::Identity, FCollisionObjectQueryParams::AllStaticObjects, FCollisionShape::MakeSphere(5.0f))) {
+	STEALTH_BENCHMARK_SCOPE("UStealthPlayerMovement::TestForValidLedges");
+	SCOPE_CYCLE_COUNTER(STAT_StealthMovement_TestForValidLedges);
+	if (LedgeIndex && CVarUseLedgeIndex->GetInt() != 0) {
+		bool bCovered = false;
+		bool bFoundLedge = TestForIndexedLedges(OutValidLedgeLocation, bCovered);
+		if (bCovered) {
+			return bFoundLedge;
+		}
+	}
+
+	if (JumpPrediction.bValid && CVarPredictLedges->GetInt() != 0) {
+		return TestForPredictedLedges(OutValidLedgeLocation);
+	}
+
+	// The ledge scan only gathers candidates, every candidate is still confirmed below with exact traces from the current position.
+	const FMovementProbeResult& LedgeScan = RunProbe(EMovementProbe::LedgeScan);
+	if (!LedgeScan.bBlockingHit) {
 		return false;
 	}
+	return ValidateLedgeHits(LedgeScan.Hits, OutValidLedgeLocation);
+}
+
+bool UStealthPlayerMovement::ValidateLedgeHits(TArrayView<const FHitResult> LedgeHits, FVector& OutValidLedgeLocation) {
+	const FMovementQueryCache& Cache = GetQueryCache();
+	float halfHeight = Cache.CapsuleHalfHeight;
 
 	// Iterate through each potential ledge, starting from the last (lowest) ledge encountered.
-	for (auto potentialLedge : results) {
+	for (const FHitResult& potentialLedge : LedgeHits) {
 		if (potentialLedge.Time == 0) {
 			return false;
 		}
 		
 		// Check if there's actually enough height above the player to move into the requested ledge position
-		FVector enoughHeadroomEnd = playerCapsule->GetComponentLocation();
+		FVector enoughHeadroomEnd = Cache.CapsuleLocation;
 		enoughHeadroomEnd.Z = enoughHeadroomEnd.Z + ((halfHeight * 2) + potentialLedge.ImpactPoint.Z) - enoughHeadroomEnd.Z;
 		FHitResult discard;
-		if (GetWorld()->LineTraceSingleByChannel(discard, playerCapsule->GetComponentLocation(), enoughHeadroomEnd, ECollisionChannel::ECC_Visibility)) {
+		INC_DWORD_STAT(STAT_StealthQueries_LedgeConfirm);
+		if (GetWorld()->LineTraceSingleByChannel(discard, Cache.CapsuleLocation, enoughHeadroomEnd, ECollisionChannel::ECC_Visibility)) {
 			return false;
 		}
 
 		// Capsule Trace at the final ledge position to ensure there's enough room for the player.
-		FCollisionShape capsuleCheck = FCollisionShape::MakeCapsule(playerCapsule->GetUnscaledCapsuleRadius(), halfHeight);
+		FCollisionShape capsuleCheck = FCollisionShape::MakeCapsule(Cache.CapsuleRadius, halfHeight);
 		FHitResult CheckSpaceHitResult;
 		FVector roomStart = potentialLedge.ImpactPoint;
 		roomStart.Z += halfHeight;
 		roomStart.Z += 2.0f;		// Buffer for ensuring the trace doesnt touch the floor in an otherwise valid position.
+		INC_DWORD_STAT(STAT_StealthQueries_LedgeConfirm);
 		if (!GetWorld()->SweepSingleByChannel(CheckSpaceHitResult, roomStart, roomStart, FQuat::Identity, ECollisionChannel::ECC_Visibility, capsuleCheck)) {
 			// If there's no hit, we are good to go!
 			OutValidLedgeLocation = roomStart;
@@ -148,6 +606,7 @@ bool UStealthPlayerMovement::TestForValidLedges(FVector& OutValidLedgeLocation)
 				GetWorld()->DebugDrawTraceTag = TraceTag;
 				FCollisionQueryParams params;
 				params.TraceTag = TraceTag;
+				INC_DWORD_STAT(STAT_StealthQueries_LedgeConfirm);
 				if (!GetWorld()->SweepSingleByChannel(CheckSpaceHitResult, EdgeCaseStart, EdgeCaseStart, FQuat::Identity, ECollisionChannel::ECC_Visibility, capsuleCheck, params)) {
 					// We've confirmed the edge case and that the player can indeed fit here
 					OutValidLedgeLocation = EdgeCaseStart;
@@ -162,32 +621,333 @@ bool UStealthPlayerMovement::TestForValidLedges(FVector& OutValidLedgeLocation)
 
 }
 
+bool UStealthPlayerMovement::TestForIndexedLedges(FVector& OutValidLedgeLocation, bool& bOutCovered) {
+	const FMovementQueryCache& Cache = GetQueryCache();
+	float halfHeight = Cache.CapsuleHalfHeight;
+
+	// Look up the same column the ledge scan would have swept.
+	FMovementProbe LedgeScan = MakeProbe(EMovementProbe::LedgeScan);
+	bOutCovered = LedgeIndex->IsCovered(LedgeScan.Start);
+	if (!bOutCovered) {
+		return false;
+	}
+
+	TArray<const FLedgeRecord*> Candidates;
+	const float scanRadius = LedgeScan.Shape.GetSphereRadius();
+	LedgeIndex->Query(FBox(LedgeScan.End, LedgeScan.Start).ExpandBy(FVector(scanRadius)), Candidates);
+	if (Candidates.Num() == 0) {
+		return false;
+	}
+
+	// The ledge scan reports the highest ledge first, and that is the one the trace path would climb onto if it fits.
+	const FLedgeRecord* bestLedge = nullptr;
+	for (const FLedgeRecord* potentialLedge : Candidates) {
+		if (potentialLedge->Location.Z >= LedgeScan.Start.Z) {
+			// The scan would have started inside this ledge.
+			return false;
+		}
+
+		// Discard ledges that were baked with too little room above them, without tracing.
+		const float requiredClearance = (halfHeight * 2) + 2.0f + potentialLedge->StepUpHeight;
+		if (potentialLedge->ClearanceHeight < requiredClearance) {
+			continue;
+		}
+
+		// Discard ledges that face away from the player, which can only be climbed from their other side.
+		const FVector toPlayer = Cache.CapsuleLocation - potentialLedge->Location;
+		if (FVector::DotProduct(FVector(toPlayer.X, toPlayer.Y, 0.0f), potentialLedge->GetNormal()) <= 0.0f) {
+			continue;
+		}
+
+		if (!bestLedge || potentialLedge->Location.Z > bestLedge->Location.Z) {
+			bestLedge = potentialLedge;
+		}
+	}
+	if (!bestLedge) {
+		return false;
+	}
+
+	// The step-up edge case was already resolved while baking, so only the best ledge is confirmed. Like the trace path, a line
+	// trace first checks the headroom above the player up to the height they would climb to. A capsule sweep then moves from there
+	// onto the ledge, which catches anything that has moved onto it since it was baked.
+	FVector roomStart = bestLedge->Location;
+	roomStart.Z += halfHeight + 2.0f + bestLedge->StepUpHeight;
+	const FVector climbStart(Cache.CapsuleLocation.X, Cache.CapsuleLocation.Y, roomStart.Z);
+	const FCollisionQueryParams confirmParams(SCENE_QUERY_STAT(IndexedLedgeConfirm), false, CharacterOwner);
+	FHitResult discard;
+	INC_DWORD_STAT(STAT_StealthQueries_LedgeConfirm);
+	if (GetWorld()->LineTraceSingleByChannel(discard, Cache.CapsuleLocation, climbStart, ECollisionChannel::ECC_Visibility, confirmParams)) {
+		return false;
+	}
+
+	FCollisionShape capsuleCheck = FCollisionShape::MakeCapsule(Cache.CapsuleRadius, halfHeight);
+	INC_DWORD_STAT(STAT_StealthQueries_LedgeConfirm);
+	if (GetWorld()->SweepSingleByChannel(discard, climbStart, roomStart, FQuat::Identity, ECollisionChannel::ECC_Visibility, capsuleCheck,
+		confirmParams)) {
+		return false;
+	}
+
+	OutValidLedgeLocation = roomStart;
+	return true;
+}
+
+void UStealthPlayerMovement::RequestJumpPrediction() {
+	// The jump is started from inside the movement update, before the step that lifts off has moved the player. Predict once
+	// that step is done, from where it left the player, so the arc and the movement clock agree on where the player is when.
+	if (bInMovementTick) {
+		bJumpPredictionPending = true;
+	}
+	else {
+		PredictJumpLedges();
+	}
+}
+
+void UStealthPlayerMovement::PredictJumpLedges() {
+	SCOPE_CYCLE_COUNTER(STAT_StealthMovement_PredictJumpLedges);
+	const FMovementQueryCache& Cache = GetQueryCache();
+
+	// The ledge scan is a column in front of the player, but the player can turn freely mid-jump, so cover every direction around the arc.
+	FMovementProbe LedgeScan = MakeProbe(EMovementProbe::LedgeScan);
+	const float scanRadius = LedgeScan.Shape.GetSphereRadius();
+	const float reach = MaxClimbAngle + scanRadius + LedgePredictionMargin;
+	const float scanTop = LedgeScan.Start.Z - Cache.CapsuleLocation.Z + scanRadius + LedgePredictionMargin;
+	const float scanBottom = LedgeScan.End.Z - Cache.CapsuleLocation.Z - scanRadius - LedgePredictionMargin;
+	if (!JumpPrediction.Build(MovementTime, Cache.CapsuleLocation, Velocity, GetGravityZ(), reach, scanTop, scanBottom, AirSpeedCap)) {
+		return;
+	}
+
+	TArray<FOverlapResult> Overlaps;
+	INC_DWORD_STAT(STAT_StealthMovement_JumpPredictions);
+	INC_DWORD_STAT(STAT_StealthQueries_JumpPrediction);
+	GetWorld()->OverlapMultiByObjectType(Overlaps, JumpPrediction.BoxCenter, JumpPrediction.BoxRotation, FCollisionObjectQueryParams::AllStaticObjects,
+		FCollisionShape::MakeBox(JumpPrediction.BoxExtent), FCollisionQueryParams(SCENE_QUERY_STAT(PredictJumpLedges), false, CharacterOwner));
+
+	for (const FOverlapResult& Overlap : Overlaps) {
+		if (Overlap.Component.IsValid()) {
+			JumpPrediction.Candidates.AddUnique(Overlap.Component);
+		}
+	}
+	JumpPrediction.Candidates.Sort([](const TWeakObjectPtr<UPrimitiveComponent>& A, const TWeakObjectPtr<UPrimitiveComponent>& B) {
+		return A->Bounds.GetBox().Max.Z > B->Bounds.GetBox().Max.Z;
+	});
+	for (const TWeakObjectPtr<UPrimitiveComponent>& Candidate : JumpPrediction.Candidates) {
+		const FBox& Bounds = JumpPrediction.CandidateBounds.Add_GetRef(Candidate->Bounds.GetBox());
+		JumpPrediction.AllCandidateBounds += Bounds;
+	}
+	JumpPrediction.bValid = true;
+}
+
+bool UStealthPlayerMovement::TestForPredictedLedges(FVector& OutValidLedgeLocation) {
+	// The box already allows for any steering, so only predict again once the scan has left it, after a collision or air strafing.
+	FMovementProbe LedgeScan = MakeProbe(EMovementProbe::LedgeScan);
+	const float scanRadius = LedgeScan.Shape.GetSphereRadius();
+	if (!JumpPrediction.Covers(LedgeScan.Start, LedgeScan.End, scanRadius)) {
+		PredictJumpLedges();
+		if (!JumpPrediction.bValid) {
+			return false;
+		}
+	}
+
+	// Most of a jump is spent in open air, where the scan doesn't reach any of the cached components at all.
+	const FBox scanBox = FBox(LedgeScan.End, LedgeScan.Start).ExpandBy(scanRadius);
+	if (!JumpPrediction.AllCandidateBounds.Intersect(scanBox)) {
+		return false;
+	}
+
+	// Run the ledge scan against each cached component on its own, which is much cheaper than a scene query.
+	TArray<FHitResult, TInlineAllocator<8>> LedgeHits;
+	for (int32 i = 0; i < JumpPrediction.Candidates.Num(); i++) {
+		const TWeakObjectPtr<UPrimitiveComponent>& Candidate = JumpPrediction.Candidates[i];
+		if (!JumpPrediction.CandidateBounds[i].Intersect(scanBox) || !Candidate.IsValid()) {
+			continue;
+		}
+		FHitResult Hit;
+		INC_DWORD_STAT(STAT_StealthQueries_JumpPrediction);
+		if (Candidate->SweepComponent(Hit, LedgeScan.Start, LedgeScan.End, FQuat::Identity, LedgeScan.Shape)) {
+			LedgeHits.Add(Hit);
+		}
+	}
+	if (LedgeHits.Num() == 0) {
+		return false;
+	}
+
+	// Same order the scene sweep would have reported them in.
+	LedgeHits.Sort([](const FHitResult& A, const FHitResult& B) { return A.Time < B.Time; });
+	return ValidateLedgeHits(LedgeHits, OutValidLedgeLocation);
+}
+
 float UStealthPlayerMovement::GetMaxSpeed() const {
 	if (bCheatFlying) {
 		return SprintSpeed * 1.5f;
 	}
-	else if (movementStates.IsInState<PlayerMovementStates::Walk>()) {
+
+	// Replayed and remote moves run at the speed of the state they were made in, not the one we are in now.
+	switch (bHasNetworkMoveState ? NetworkMoveState.State : GetActiveMoveState()) {
+	case EStealthMoveState::Walk:
 		return WalkSpeed;
-	} 
-	else if (movementStates.IsInState<PlayerMovementStates::Sprint>()) {
+	case EStealthMoveState::Sprint:
 		return SprintSpeed;
-	}
-	else if (movementStates.IsInState<PlayerMovementStates::Crouch>() || movementStates.IsInState<PlayerMovementStates::VariableCrouch>()) {
+	case EStealthMoveState::Crouch:
+	case EStealthMoveState::VariableCrouch:
 		return MaxWalkSpeedCrouched;
-	} 
-	else if (movementStates.IsInState<PlayerMovementStates::Slide>()) {
+	case EStealthMoveState::Slide:
 		return SlideSpeed;
+	default:
+		// Fallback on Super if no other match found.
+		return Super::GetMaxSpeed();
+	}
+}
+
+EStealthMoveState UStealthPlayerMovement::GetActiveMoveState() const {
+	if (ActiveStateBits & StealthMovementStateBits::Walk) {
+		return EStealthMoveState::Walk;
+	}
+	else if (ActiveStateBits & StealthMovementStateBits::Sprint) {
+		return EStealthMoveState::Sprint;
 	}
+	else if (ActiveStateBits & StealthMovementStateBits::VariableCrouch) {
+		return EStealthMoveState::VariableCrouch;
+	}
+	else if (ActiveStateBits & StealthMovementStateBits::Crouch) {
+		return EStealthMoveState::Crouch;
+	}
+	else if (ActiveStateBits & StealthMovementStateBits::Slide) {
+		return EStealthMoveState::Slide;
+	}
+	else if (ActiveStateBits & StealthMovementStateBits::Climb) {
+		return EStealthMoveState::Climb;
+	}
+	return EStealthMoveState::None;
+}
 
-	// Fallback on Super if no other match found.
-	return Super::GetMaxSpeed();
+FStealthMoveState UStealthPlayerMovement::CaptureMoveState() const {
+	FStealthMoveState MoveState;
+	MoveState.State = GetActiveMoveState();
+	// Progress is only captured while its timeline is playing, so that it doesn't keep moves from being combined otherwise.
+	if (MoveState.State == EStealthMoveState::Slide && SlideTimeline.GetTimelineLength() > 0.0f) {
+		MoveState.SlideProgress = FStealthMoveState::QuantizeProgress(SlideTimeline.GetPlaybackPosition() / SlideTimeline.GetTimelineLength());
+	}
+	else if (MoveState.State == EStealthMoveState::Climb && ClimbTimeline.GetTimelineLength() > 0.0f) {
+		MoveState.ClimbProgress = FStealthMoveState::QuantizeProgress(ClimbTimeline.GetPlaybackPosition() / ClimbTimeline.GetTimelineLength());
+	}
+	MoveState.RequestedHalfHeight = FStealthMoveState::QuantizeHalfHeight(NewCapsuleHeight);
+	MoveState.HeightTransitionSpeed = FStealthMoveState::QuantizeSpeed(HeightTransitionSpeed);
+	MoveState.LeanHorzOffset = FStealthMoveState::QuantizeLean(TargetLeanHorzOffset);
+	MoveState.LeanVertOffset = FStealthMoveState::QuantizeLean(TargetLeanVertOffset);
+	MoveState.LeanRoll = FStealthMoveState::QuantizeLean(TargetLeanRot);
+	return MoveState;
+}
+
+void UStealthPlayerMovement::SetNetworkMoveState(const FStealthMoveState& MoveState, bool bReconcile) {
+	NetworkMoveState = MoveState;
+	bHasNetworkMoveState = true;
+	if (!bReconcile) {
+		return;
+	}
+
+	// The server stays authoritative on whether a slide or climb can start at all, it only follows the client's progress through one
+	// that it agrees is happening. Otherwise the move is corrected as usual.
+	const EStealthMoveState LocalState = GetActiveMoveState();
+	if (MoveState.State == EStealthMoveState::Slide && LocalState == EStealthMoveState::Slide) {
+		// The slide's forward input already arrives as the move's acceleration, so don't add it a second time.
+		SlideTimeline.SetPlaybackPosition(FStealthMoveState::DequantizeProgress(MoveState.SlideProgress) * SlideTimeline.GetTimelineLength(), false, false);
+	}
+	else if (MoveState.State == EStealthMoveState::Climb && LocalState == EStealthMoveState::Climb) {
+		// Moves the capsule along the climb to where the client has it.
+		ClimbTimeline.SetPlaybackPosition(FStealthMoveState::DequantizeProgress(MoveState.ClimbProgress) * ClimbTimeline.GetTimelineLength(), false);
+	}
+
+	const float RequestedHalfHeight = FStealthMoveState::DequantizeHalfHeight(MoveState.RequestedHalfHeight);
+	if (!FMath::IsNearlyEqual(RequestedHalfHeight, NewCapsuleHeight, 0.5f)) {
+		// Never let a client stand up into geometry that the server thinks is in the way.
+		if (RequestedHalfHeight < NewCapsuleHeight || CanUncrouch()) {
+			RequestCharacterResize(FMath::Clamp(RequestedHalfHeight, FMath::Min(SlideHeight, 28.0f), PlayerRef->StandingHeight),
+				FStealthMoveState::DequantizeSpeed(MoveState.HeightTransitionSpeed));
+		}
+	}
+
+	if (MoveState.LeanHorzOffset != FStealthMoveState::QuantizeLean(TargetLeanHorzOffset)
+		|| MoveState.LeanVertOffset != FStealthMoveState::QuantizeLean(TargetLeanVertOffset)
+		|| MoveState.LeanRoll != FStealthMoveState::QuantizeLean(TargetLeanRot)) {
+		RequestLean(MoveState.LeanHorzOffset, MoveState.LeanVertOffset, MoveState.LeanRoll, LeanTransitionSpeed);
+	}
+}
+
+FNetworkPredictionData_Client* UStealthPlayerMovement::GetPredictionData_Client() const {
+	if (ClientPredictionData == nullptr) {
+		UStealthPlayerMovement* MutableThis = const_cast<UStealthPlayerMovement*>(this);
+		MutableThis->ClientPredictionData = new FNetworkPredictionData_Client_Stealth(*this);
+	}
+	return ClientPredictionData;
+}
+
+void UStealthPlayerMovement::UpdateFromCompressedFlags(uint8 Flags) {
+	Super::UpdateFromCompressedFlags(Flags);
+	bWantsToSprint = (Flags & FSavedMove_Stealth::FLAG_WantsToSprint) != 0;
+}
+
+void UStealthPlayerMovement::UpdateCharacterStateBeforeMovement(float DeltaSeconds) {
+	Super::UpdateCharacterStateBeforeMovement(DeltaSeconds);
+	// The PB movement reads the character's flag, for the jump boost among others.
+	if (PlayerRef) {
+		PlayerRef->bIsSprinting = bWantsToSprint;
+	}
+}
+
+void UStealthPlayerMovement::MoveAutonomous(float ClientTimeStamp, float DeltaTime, uint8 CompressedFlags, const FVector& NewAccel) {
+	// Only set while the server is handling a move sent by the owning client. Replays on the client restore their state in PrepMoveFor() instead.
+	const FStealthNetworkMoveData* MoveData = static_cast<const FStealthNetworkMoveData*>(GetCurrentNetworkMoveData());
+	const bool bRemoteMove = MoveData && CharacterOwner->GetLocalRole() == ROLE_Authority;
+	if (bRemoteMove) {
+		SetNetworkMoveState(MoveData->MoveState, true);
+	}
+	Super::MoveAutonomous(ClientTimeStamp, DeltaTime, CompressedFlags, NewAccel);
+	if (bRemoteMove) {
+		ClearNetworkMoveState();
+	}
+}
+
+bool UStealthPlayerMovement::ClientUpdatePositionAfterServerUpdate() {
+	const bool bResult = Super::ClientUpdatePositionAfterServerUpdate();
+	// The replayed moves are done, new moves use the state machine again.
+	ClearNetworkMoveState();
+	return bResult;
 }
 
 float UStealthPlayerMovement::GetFloorOffset() {
-	FFindFloorResult result;
-	FindFloor(CharacterOwner->GetCapsuleComponent()->GetComponentLocation(), result, true);
-	
-	return result.FloorDist;
+	return GetQueryCache().FloorDist;
+}
+
+const FMovementQueryCache& UStealthPlayerMovement::GetQueryCache() {
+	if (QueryCache.bValid && QueryCache.FrameNumber == GFrameCounter) {
+		QueryCacheHits++;
+		return QueryCache;
+	}
+	QueryCacheMisses++;
+	SCOPE_CYCLE_COUNTER(STAT_StealthMovement_BuildQueryCache);
+
+	UCapsuleComponent* capsule = CharacterOwner->GetCapsuleComponent();
+	QueryCache.FrameNumber = GFrameCounter;
+	QueryCache.bValid = true;
+	QueryCache.CapsuleLocation = capsule->GetComponentLocation();
+	QueryCache.CapsuleHalfHeight = capsule->GetUnscaledCapsuleHalfHeight();
+	QueryCache.CapsuleRadius = capsule->GetUnscaledCapsuleRadius();
+	QueryCache.CapsuleBase = QueryCache.CapsuleLocation - FVector(0.0f, 0.0f, QueryCache.CapsuleHalfHeight);
+
+	// The base movement update already swept for the floor. As long as the capsule is still where it was then, 
+	// and the same size, that result is exactly what FindFloor() would give us again.
+	if (IsMovingOnGround() && CurrentFloor.bBlockingHit && QueryCache.CapsuleHalfHeight == CurrentFloorHalfHeight 
+		&& QueryCache.CapsuleLocation.Equals(CurrentFloorLocation)) {
+		QueryCache.FloorDist = CurrentFloor.FloorDist;
+	}
+	else {
+		FFindFloorResult result;
+		INC_DWORD_STAT(STAT_StealthQueries_FindFloor);
+		FindFloor(QueryCache.CapsuleLocation, result, true);
+		QueryCache.FloorDist = result.FloorDist;
+	}
+
+	return QueryCache;
 }
 
 void UStealthPlayerMovement::Crouch(bool bClientSimulation) {
@@ -201,39 +961,88 @@ void UStealthPlayerMovement::UnCrouch(bool bClientSimulation) {
 void UStealthPlayerMovement::RequestCharacterResize(float NewSize, float Speed) {
 	NewCapsuleHeight = FMath::Floor(NewSize);
 	HeightTransitionSpeed = Speed;
+	if (MoverBatchSlot != INDEX_NONE) {
+		MoverBatch->SetTargetHeight(MoverBatchSlot, NewCapsuleHeight, HeightTransitionSpeed);
+	}
 }
 
 void UStealthPlayerMovement::RequestLean(float HorzOffsetAmount, float VertOffsetAmount, float CameraRotation, float TransitionSpeed) {
+	if (FMovementInputRecorder* Recorder = FMovementInputRecorder::GetActiveFor(PlayerRef)) {
+		Recorder->RecordLean(HorzOffsetAmount, VertOffsetAmount, CameraRotation, TransitionSpeed);
+	}
 	TargetLeanHorzOffset = HorzOffsetAmount;
 	TargetLeanVertOffset = VertOffsetAmount;
 	TargetLeanRot = CameraRotation;
 	LeanTransitionSpeed = TransitionSpeed;
+	bLeanClearanceCached = false;
+	bLeanTiltSettled = bNPCMode;
+	if (MoverBatchSlot != INDEX_NONE) {
+		MoverBatch->SetTargetLean(MoverBatchSlot, TargetLeanHorzOffset, TargetLeanVertOffset, LeanTransitionSpeed);
+	}
 }
 
 float UStealthPlayerMovement::CalculateLeanModifier() {
-	USpringArmComponent* cameraAnchor = PlayerRef->GetCameraAnchor();
-	FHitResult result;
-	FCollisionShape sphere = FCollisionShape::MakeSphere(25.0f);
-	if (GetWorld()->SweepSingleByChannel(result, cameraAnchor->GetComponentLocation(), ((cameraAnchor->GetRightVector() * (TargetLeanHorzOffset)) + cameraAnchor->GetComponentLocation()),
-		FQuat::Identity, ECollisionChannel::ECC_Visibility, sphere)) {
+	// Without a sideways lean there is nothing to collide with.
+	if (TargetLeanHorzOffset == 0.0f) {
+		return 1.0f;
+	}
+	const FMovementProbe Probe = MakeProbe(EMovementProbe::LeanClearance);
+	if (IsLeanClearanceCached(Probe)) {
+		INC_DWORD_STAT(STAT_StealthMovement_LeanClearanceReused);
+		return CachedLeanModifier;
+	}
+
+	const FMovementProbeResult& Result = RunProbe(EMovementProbe::LeanClearance);
+	if (Result.bBlockingHit) {
 		// Convert the distance to a normalized value between 0 and 1.
-		return FMath::Abs(result.Distance / (TargetLeanHorzOffset));
+		CachedLeanModifier = FMath::Abs(Result.Hits[0].Distance / (TargetLeanHorzOffset));
 	}
 	else {
 		// We have a full lean space, so theres no need to reduce the amount we actually lean.
-		return 1.0f;
+		CachedLeanModifier = 1.0f;
 	}
+	LeanClearanceStart = Probe.Start;
+	LeanClearanceEnd = Probe.End;
+	LeanClearanceTime = MovementTime;
+	bLeanClearanceCached = true;
+	return CachedLeanModifier;
 }
 
-void UStealthPlayerMovement::UpdateLeanState() {
-	USpringArmComponent* cameraAnchor = PlayerRef->GetCameraAnchor();
-	static float LastHorzLeanProgress = 0.0f;
-	static float LastVertLeanProgress = 0.0f;
+bool UStealthPlayerMovement::IsLeanClearanceCached(const FMovementProbe& Probe) const {
+	if (!bLeanClearanceCached) {
+		return false;
+	}
+	// Only the anchor is compared, so the clearance also has to expire for whatever moves into the lean on its own.
+	const float MaxAge = CVarLeanClearanceMaxAge->GetFloat();
+	if (MaxAge > 0.0f && MovementTime - LeanClearanceTime > MaxAge) {
+		return false;
+	}
+	// Comparing both ends catches the anchor turning as well as moving.
+	const float ToleranceSquared = FMath::Square(CVarLeanClearanceTolerance->GetFloat());
+	return FVector::DistSquared(Probe.Start, LeanClearanceStart) <= ToleranceSquared && FVector::DistSquared(Probe.End, LeanClearanceEnd) <= ToleranceSquared;
+}
 
+FStealthLeanState UStealthPlayerMovement::GetLeanState() const {
+	FStealthLeanState LeanState;
+	LeanState.TargetHorzOffset = FStealthMoveState::QuantizeLean(TargetLeanHorzOffset);
+	LeanState.TargetVertOffset = FStealthMoveState::QuantizeLean(TargetLeanVertOffset);
+	LeanState.TargetRoll = FStealthMoveState::QuantizeLean(TargetLeanRot);
+	LeanState.HorzOffset = FStealthMoveState::QuantizeLean(LastHorzLeanProgress);
+	LeanState.VertOffset = FStealthMoveState::QuantizeLean(LastVertLeanProgress);
+	LeanState.Clearance = FStealthMoveState::QuantizeProgress(LastLeanModifier);
+	return LeanState;
+}
+
+void UStealthPlayerMovement::UpdateLeanState() {
+	if (IsLeanIdle()) {
+		return;
+	}
+	STEALTH_BENCHMARK_SCOPE("UStealthPlayerMovement::UpdateLeanState");
+	SCOPE_CYCLE_COUNTER(STAT_StealthMovement_UpdateLeanState);
 	// If there isn't enough space to lean fully (eg, attempting to lean next to a wall) reduce the amount of lean distance appropriately. 
 	float LeanMod = CalculateLeanModifier();
-	float HorzLeanProgress = FMath::FInterpTo(LastHorzLeanProgress, LeanMod * TargetLeanHorzOffset, GetWorld()->GetDeltaSeconds(), LeanTransitionSpeed);
-	float VertLeanProgress = FMath::FInterpTo(LastVertLeanProgress, LeanMod * TargetLeanVertOffset, GetWorld()->GetDeltaSeconds(), LeanTransitionSpeed);
+	float HorzLeanProgress = FMath::FInterpTo(LastHorzLeanProgress, LeanMod * TargetLeanHorzOffset, MovementDeltaTime, LeanTransitionSpeed);
+	float VertLeanProgress = FMath::FInterpTo(LastVertLeanProgress, LeanMod * TargetLeanVertOffset, MovementDeltaTime, LeanTransitionSpeed);
 
 	float VertLeanDelta = 0.0f;
 	float HorzLeanDelta = 0.0f;
@@ -253,26 +1062,56 @@ void UStealthPlayerMovement::UpdateLeanState() {
 		HorzLeanDelta = HorzLeanProgress - LastHorzLeanProgress;
 	}
 
-	// TODO: This in-progress lean rotation breaks the strafe leaning. How to have them work together?
+	ApplyLeanState(MovementDeltaTime, LeanMod, HorzLeanProgress, VertLeanProgress, HorzLeanDelta, VertLeanDelta);
+}
+
+void UStealthPlayerMovement::ApplyLeanState(float DeltaTime, float LeanMod, float HorzLeanProgress, float VertLeanProgress, float HorzLeanDelta, float VertLeanDelta) {
 	UCameraFXHandler* cameraFX = PlayerRef->GetCameraFXHandler();
-	cameraFX->TiltPlayerCamera(GetWorld()->GetDeltaSeconds(), TargetLeanRot * LeanMod, LeanTransitionSpeed);
-	cameraAnchor->AddRelativeLocation(FVector(0.0f, HorzLeanDelta, VertLeanDelta));
+	cameraFX->GetCameraLayers().AddLocation(ECameraLayer::Lean, FVector(0.0f, HorzLeanDelta, VertLeanDelta));
+	if (!bNPCMode) {
+		cameraFX->TiltPlayerCamera(DeltaTime, ECameraLayer::LeanTilt, TargetLeanRot * LeanMod, LeanTransitionSpeed);
+		bLeanTiltSettled = cameraFX->GetCameraLayers().GetLayer(ECameraLayer::LeanTilt).Rotation.Roll == TargetLeanRot * LeanMod;
+	}
+	else {
+		// Nobody looks through an NPC's anchor, so its roll doesn't need easing.
+		cameraFX->GetCameraLayers().SetRotation(ECameraLayer::LeanTilt, FRotator(0.0f, 0.0f, TargetLeanRot * LeanMod));
+	}
 	LastHorzLeanProgress = HorzLeanProgress;
 	LastVertLeanProgress = VertLeanProgress;
+	LastLeanModifier = LeanMod;
 }
 
 void UStealthPlayerMovement::UpdateCharacterHeight() {
 	float currentHalfHeight = PlayerRef->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight();
-	float resizeProgress = FMath::FInterpTo(currentHalfHeight, NewCapsuleHeight, GetWorld()->GetDeltaSeconds(), HeightTransitionSpeed);
+	if (currentHalfHeight == NewCapsuleHeight) {
+		return;
+	}
+	STEALTH_BENCHMARK_SCOPE("UStealthPlayerMovement::UpdateCharacterHeight");
+	SCOPE_CYCLE_COUNTER(STAT_StealthMovement_UpdateCharacterHeight);
+	float resizeProgress = FMath::FInterpTo(currentHalfHeight, NewCapsuleHeight, MovementDeltaTime, HeightTransitionSpeed);
 	if (FMath::IsNearlyEqual(resizeProgress, NewCapsuleHeight, 0.1f)) {
 		resizeProgress = NewCapsuleHeight;
 	}
-	PlayerRef->GetCapsuleComponent()->SetCapsuleHalfHeight(resizeProgress);
-	USpringArmComponent* cameraAnchor = PlayerRef->GetCameraAnchor();
+	ApplyCharacterHeight(currentHalfHeight, resizeProgress);
+}
 
-	if (resizeProgress != NewCapsuleHeight) {
-		float cameraMoveAmount = currentHalfHeight - resizeProgress;
-		cameraAnchor->MoveComponent(FVector(0.0f, 0.0f, -cameraMoveAmount), cameraAnchor->GetRelativeRotation(), false);
+void UStealthPlayerMovement::ApplyCharacterHeight(float OldHalfHeight, float NewHalfHeight) {
+	if (NewHalfHeight == OldHalfHeight) {
+		return;
+	}
+	UCapsuleComponent* capsule = PlayerRef->GetCapsuleComponent();
+	capsule->SetCapsuleHalfHeight(NewHalfHeight);
+	InvalidateQueryCache();
+	// Inside of the deferred update of SimulateStep() the overlaps are only updated once the step is done.
+	if (capsule->IsDeferringMovementUpdates()) {
+		bResizeOverlapsDeferred = true;
+	}
+	else {
+		INC_DWORD_STAT(STAT_StealthMovement_ResizeOverlapUpdates);
+	}
+	if (NewHalfHeight != NewCapsuleHeight) {
+		float cameraMoveAmount = OldHalfHeight - NewHalfHeight;
+		PlayerRef->GetCameraFXHandler()->GetCameraLayers().AddLocation(ECameraLayer::CrouchHeight, FVector(0.0f, 0.0f, -cameraMoveAmount));
 	}
 }
 
@@ -283,6 +1122,7 @@ void UStealthPlayerMovement::PlayerSlideAlphaProgress() {
 void UStealthPlayerMovement::PlayerClimbAlphaProgress() {
 	float alpha = ClimbAlphaCurve->GetFloatValue(ClimbTimeline.GetPlaybackPosition());
 	PlayerRef->SetActorLocation(FMath::Lerp(StartClimbPos, EndClimbPos, alpha));
+	InvalidateQueryCache();
 }
 
 void UStealthPlayerMovement::OnFinishPlayerSlide() {
@@ -294,64 +1134,39 @@ void UStealthPlayerMovement::OnFinishedPlayerClimb() {
 }
 
 bool UStealthPlayerMovement::CheckNeedsVariableCrouch(float& OutCeilingDistance) {
-	FCollisionShape Box = FCollisionShape::MakeBox(FVector(30, 30, 0));
-	static float oldCeilingHeight = 0.0f;
-
-	FVector Start = GetCharacterOwner()->GetCapsuleComponent()->GetComponentLocation();
-	Start.Z -= GetFloorOffset();
-	FVector End = Start;
-	Start.Z = Start.Z - GetCharacterOwner()->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight() + 1;
-	End.Z = (End.Z - GetCharacterOwner()->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight()) + (CrouchedHalfHeight * 2);
-
-	FHitResult Result;
-	if (GetWorld()->SweepSingleByChannel(Result, Start, End, FQuat::Identity, ECollisionChannel::ECC_Visibility, Box)) {
-		OutCeilingDistance = Result.Distance;
+	const FMovementProbeResult& Result = RunProbe(EMovementProbe::NeedsVariableCrouch);
+	if (Result.bBlockingHit) {
+		OutCeilingDistance = Result.Hits[0].Distance;
 		// Don't allow crouching below the minimum allowed crouch size.
 		if (OutCeilingDistance < (28.0f * 2)) {
-			oldCeilingHeight = 0.0f;
 			OutCeilingDistance = 0.0f;
 			return false;
 		}
-		oldCeilingHeight = OutCeilingDistance;
 		return true;
 	}
 	else {
-		oldCeilingHeight = 0.0f;
 		OutCeilingDistance = 0.0f;
 		return false;
 	}
 }
 
 bool UStealthPlayerMovement::CheckCanExitVariableCrouch() {
-	FCollisionShape Box = FCollisionShape::MakeBox(FVector(30, 30, 0));
-
-	FVector Start = GetCharacterOwner()->GetCapsuleComponent()->GetComponentLocation();
-	FVector End = Start;
-	Start.Z = Start.Z - (GetCharacterOwner()->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight()) * GetWorld()->GetDeltaSeconds();
-	End.Z = (End.Z - (GetCharacterOwner()->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight()) * GetWorld()->GetDeltaSeconds()) + (CrouchedHalfHeight * 2);
-
-	FHitResult Result;
-	if (GetWorld()->SweepSingleByChannel(Result, Start, End, FQuat::Identity, ECollisionChannel::ECC_Visibility, Box)) {
-		return false;
-	}
-	else {
-		return true;
+	// A blocked result from last frame just keeps us in variable crouch for one more frame, which is harmless.
+	// A clear result has to be confirmed against the current position, since we are about to grow the capsule.
+	const FMovementProbeResult* Result = &RunProbe(EMovementProbe::CanExitVariableCrouch);
+	if (!Result->bBlockingHit && Result->bStale) {
+		Result = &RunProbe(EMovementProbe::CanExitVariableCrouch, true);
 	}
+
+	return !Result->bBlockingHit;
 }
 
 bool UStealthPlayerMovement::CanUncrouch() {
-	FCollisionShape Box = FCollisionShape::MakeBox(FVector(10, 10, 0));
-	
-	FVector Start = GetCharacterOwner()->GetCapsuleComponent()->GetComponentLocation();
-	Start.Z = Start.Z - GetCharacterOwner()->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight();
-	FVector End = Start;
-	End.Z = End.Z + (PlayerRef->StandingHeight * 2);
-
-	FHitResult discard;		// For now, we never actually need the hit result, so we are discarding it.
-	if (GetWorld()->SweepSingleByChannel(discard, Start, End, FQuat::Identity, ECollisionChannel::ECC_Visibility, Box)) {
-		return false;
-	}
-	else {
-		return true;
+	// Same as CheckCanExitVariableCrouch(), we can trust a stale block but never a stale all-clear.
+	const FMovementProbeResult* Result = &RunProbe(EMovementProbe::CanUncrouch);
+	if (!Result->bBlockingHit && Result->bStale) {
+		Result = &RunProbe(EMovementProbe::CanUncrouch, true);
 	}
+
+	return !Result->bBlockingHit;
 }
\ No newline at end of file
@@ -7,12 +7,39 @@
 #include "Character/PBPlayerMovement.h"
 #include "Components/TimelineComponent.h"
 #include "PlayerMovementStates.h"
+#include "MovementProbePipeline.h"
+#include "StealthNetworkMove.h"
+#include "StealthMovementStats.h"
+#include "../Climbing/LedgeJumpPrediction.h"
 #include "SequenceCameraShake.h"
 #include "StealthPlayerMovement.generated.h"
 
 class AStealthPlayerCharacter;
 class UCameraAnimationSequence;
+class ULedgeIndexSubsystem;
+class UStealthMovementSubsystem;
 
+/**
+* Snapshot of the capsule and floor values used by the movement probes.
+* 
+* Built at most once per frame by UStealthPlayerMovement::GetQueryCache(), so that every probe run during a tick
+* reads from the same values instead of querying the capsule and re-running FindFloor() on its own.
+*/
+struct FMovementQueryCache {
+	uint64 FrameNumber = 0;
+	bool bValid = false;
+
+	FVector CapsuleLocation = FVector::ZeroVector;
+	// The bottom of the capsule, which floats FloorDist units above the floor.
+	FVector CapsuleBase = FVector::ZeroVector;
+	float CapsuleHalfHeight = 0.0f;
+	float CapsuleRadius = 0.0f;
+	float FloorDist = 0.0f;
+};
+
+/** Broadcast once per tick in which the active movement states changed, with the StealthMovementStateBits before and after. */
+DECLARE_MULTICAST_DELEGATE_ThreeParams(FOnStealthMovementStateChangedNative, UStealthPlayerMovement* /*Component*/, uint32 /*PreviousStates*/, uint32 /*NewStates*/);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnStealthMovementStateChanged, int32, PreviousStates, int32, NewStates);
 
 UCLASS(BlueprintType)
 class CYBERSTEALTH2021_API UClimbShaker : public USequenceCameraShake
@@ -29,7 +56,8 @@ class CYBERSTEALTH2021_API UStealthPlayerMovement : public UPBPlayerMovement
 	GENERATED_BODY()
 private:
 	friend PlayerMovementStates;
-	hsm::StateMachine movementStates;
+	friend UStealthMovementSubsystem;
+	PlayerMovementStates::Machine movementStates;
 
 	AStealthPlayerCharacter *PlayerRef;
 
@@ -39,6 +67,22 @@ private:
 	UPROPERTY(EditAnywhere, Category = "Crouching")
 	float VariableCrouchTime = 15.0f;
 
+	FMovementProbePipeline ProbePipeline;
+	FMovementQueryCache QueryCache;
+	uint32 QueryCacheHits = 0;
+	uint32 QueryCacheMisses = 0;
+	// Where the capsule was, and how tall it was, when the base movement update last filled CurrentFloor.
+	FVector CurrentFloorLocation = FVector::ZeroVector;
+	float CurrentFloorHalfHeight = 0.0f;
+
+	UPROPERTY(Transient)
+	ULedgeIndexSubsystem* LedgeIndex = nullptr;
+
+	// The batch that interpolates our height and lean together with every other mover, and our slot in it.
+	UPROPERTY(Transient)
+	UStealthMovementSubsystem* MoverBatch = nullptr;
+	int32 MoverBatchSlot = INDEX_NONE;
+
 	float NewCapsuleHeight = 68.0f;
 	float HeightTransitionSpeed = 0.0f;
 
@@ -46,6 +90,49 @@ private:
 	float TargetLeanVertOffset = 0.0f;
 	float TargetLeanRot = 0.0f;
 	float LeanTransitionSpeed = 0.0f;
+	float LastHorzLeanProgress = 0.0f;
+	float LastVertLeanProgress = 0.0f;
+	float LastLeanModifier = 1.0f;
+	// Whether the lean tilt of the camera has reached its target too. Always true for NPCs, who have no camera to tilt.
+	bool bLeanTiltSettled = true;
+	// Start and end of the lean clearance probe that the cached modifier was found with, and the MovementTime it was found at. It is
+	// reused until the probe strays from them, or for stealth.LeanClearanceMaxAge at most.
+	FVector LeanClearanceStart = FVector::ZeroVector;
+	FVector LeanClearanceEnd = FVector::ZeroVector;
+	float LeanClearanceTime = 0.0f;
+	float CachedLeanModifier = 1.0f;
+	bool bLeanClearanceCached = false;
+
+	// Edge of the floor the flat base was last switched on at, and the horizontal direction from the capsule towards it at the time.
+	FVector FlatBaseEdge = FVector::ZeroVector;
+	FVector FlatBaseEdgeNormal = FVector::ZeroVector;
+	// Whether the derived flat base disagreed with the floor trace on the last grounded tick. Only updated with stealth.ValidateFlatBase.
+	bool bFlatBaseMismatch = false;
+
+
+	// Length of the step being simulated, from the movement clock. Everything in the movement stack measures time with this.
+	float MovementDeltaTime = 0.0f;
+	// Total time simulated by this component, advanced at the end of every step.
+	float MovementTime = 0.0f;
+	// Capsule location and height before the last fixed step, which the camera is interpolated from for rendering.
+	FVector LastStepLocation = FVector::ZeroVector;
+	float LastStepHalfHeight = 0.0f;
+	bool bRenderInterpolating = false;
+	// Whether the capsule was resized inside of the deferred update of this step, which updates its overlaps once at the end.
+	bool bResizeOverlapsDeferred = false;
+	bool bInMovementTick = false;
+
+	/**
+	* Runs this component as a crowd NPC rather than the local player. Set automatically when the owner is possessed by a non-player controller.
+	* 
+	* NPCs run the same states, but camera effects are skipped, with only the anchor following the crouch and lean, and the probes
+	* that only exist to keep the first-person camera smooth are replaced with cheaper ones: the flat base is always used instead of being toggled with a trace, and the lean clearance is a
+	* line trace from eye height instead of a sphere sweep from the camera. Each NPC is budgeted at NPCTickBudgetMicroseconds of
+	* average movement tick time, and at the memory for the whole character that UMovementBenchmarkCommandlet::NPCMemoryBudgetBytes
+	* records. The MovementBenchmark commandlet checks both when run with -NPC.
+	*/
+	UPROPERTY(EditAnywhere, Category = "NPC")
+	bool bNPCMode = false;
 
 	// Sliding
 	FTimeline SlideTimeline;
@@ -83,10 +170,84 @@ private:
 	float QuickClimbSpeed = 0.25f;
 	UPROPERTY(EditAnywhere, Category = "Climbing")
 	float SlowClimbSpeed = 0.5f;
+	// How much further than the ledge scan can reach the predicted jump volume extends, in units, so that small bumps along the arc
+	// don't need a new prediction.
+	UPROPERTY(EditAnywhere, Category = "Climbing")
+	float LedgePredictionMargin = 10.0f;
+	FLedgeJumpPrediction JumpPrediction;
+	// Set by RequestJumpPrediction() during the liftoff step, so that the arc is predicted once the step has moved the player.
+	bool bJumpPredictionPending = false;
+
+	// StealthMovementStateBits of the states that are active, kept up to date by the OnEnter() and OnExit() of every state.
+	uint32 ActiveStateBits = 0;
+	// StealthMovementStateBits that OnStateChanged was last broadcast with.
+	uint32 BroadcastStateBits = 0;
+	// StealthMovementStateBits of the states that were active when the last transition was traced.
+	uint32 TracedStateBits = 0;
+
+	/**
+	* Everything the state transitions are decided on: the input flags, the movement mode, the timeline finished flags, and the capsule
+	* pose while the active states test the world around it. Transitions are only evaluated on ticks where some of it changed.
+	*/
+	struct FStateTransitionInputs {
+		uint32 Flags = 0;
+		uint8 MovementMode = 0;
+		uint8 CustomMovementMode = 0;
+		FVector PoseLocation = FVector::ZeroVector;
+		float PoseHalfHeight = 0.0f;
+
+		bool operator==(const FStateTransitionInputs& Other) const {
+			return Flags == Other.Flags && MovementMode == Other.MovementMode && CustomMovementMode == Other.CustomMovementMode
+				&& PoseLocation == Other.PoseLocation && PoseHalfHeight == Other.PoseHalfHeight;
+		}
+		bool operator!=(const FStateTransitionInputs& Other) const { return !(*this == Other); }
+	};
+	FStateTransitionInputs LastTransitionInputs;
+	bool bTransitionInputsValid = false;
+	// Whether any active state does anything in Update(). Only Slide and VariableCrouch do.
+	bool bActiveStatesHaveUpdate = true;
+
+	// Carries the FStealthMoveState of each move to the server, see SetNetworkMoveDataContainer().
+	FStealthNetworkMoveDataContainer StealthMoveDataContainer;
+	// State of the move being replayed on the client or simulated for a remote client on the server, see SetNetworkMoveState().
+	FStealthMoveState NetworkMoveState;
+	bool bHasNetworkMoveState = false;
 
 public:
 	UStealthPlayerMovement();
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	/**
+	* Whether the player is holding sprint. Set by AStealthPlayerCharacter::Sprint() locally and from the compressed flags on the
+	* server, like bWantsToCrouch, and applied to the character's bIsSprinting before every move.
+	*/
+	bool bWantsToSprint = false;
+
+	/** Average UStealthPlayerMovement::TickComponent time allowed per NPC, measured with 200 NPCs by the MovementBenchmark commandlet. */
+	static constexpr float NPCTickBudgetMicroseconds = 25.0f;
+
+	/** Switch between player and NPC movement, see bNPCMode. Also turns the owner's camera components off or back on. */
+	UFUNCTION(BlueprintCallable)
+	void SetNPCMode(bool bEnable);
+	UFUNCTION(BlueprintCallable)
+	bool IsNPCMode() const { return bNPCMode; }
+	/** Length of the movement step being simulated, in seconds. Use this rather than the world or app delta time anywhere in the movement stack. */
+	float GetMovementDeltaTime() const { return MovementDeltaTime; }
+	/** True while the component is ticking. Input the owner is given then comes from the movement states, not the player. */
+	bool IsInMovementTick() const { return bInMovementTick; }
+	/** How far the character is currently leaning sideways, in units. */
+	UFUNCTION(BlueprintCallable)
+	float GetCurrentLeanOffset() const { return LastHorzLeanProgress; }
+	/** How much of the requested sideways lean there was room for last tick, between 0 and 1. */
+	UFUNCTION(BlueprintCallable)
+	float GetLeanClearance() const { return LastLeanModifier; }
+	/** Quantized lean target, progress and clearance, for replication and UI. */
+	FStealthLeanState GetLeanState() const;
+	/** Whether the lean offset and tilt have reached the requested lean. */
+	bool IsLeanSettled() const { return LastHorzLeanProgress == TargetLeanHorzOffset && LastVertLeanProgress == TargetLeanVertOffset && bLeanTiltSettled; }
+	/** Whether no lean is requested and the last one has settled completely, in which case the lean system does no work at all. */
+	bool IsLeanIdle() const { return TargetLeanHorzOffset == 0.0f && TargetLeanVertOffset == 0.0f && TargetLeanRot == 0.0f && IsLeanSettled(); }
 	virtual void OnMovementModeChanged(EMovementMode PreviousMovementMode, uint8 PreviousCustomMode);
 
 	/** The Crouch and UnCrouch functions are overridden but left empty in order to disable PBPlayerMovement crouching logic in favor of our own. */
@@ -117,6 +278,36 @@ public:
 	*/
 	float GetFloorOffset();
 	/**
+	* Get this frame's snapshot of the capsule and floor values, building it first if it is missing or stale.
+	* 
+	* The floor distance is taken from CurrentFloor when the capsule hasn't moved or been resized since the last 
+	* movement update, and only falls back to a new FindFloor() otherwise.
+	*/
+	const FMovementQueryCache& GetQueryCache();
+	/** Forces the next call to GetQueryCache() to rebuild the snapshot. Call this after moving or resizing the capsule mid-frame. */
+	void InvalidateQueryCache() { QueryCache.bValid = false; }
+	/** Makes the next tick evaluate the state transitions even if none of their inputs changed. */
+	void InvalidateStateTransitions() { bTransitionInputsValid = false; }
+
+	UFUNCTION(BlueprintCallable)
+	int32 GetQueryCacheHits() const { return QueryCacheHits; }
+	UFUNCTION(BlueprintCallable)
+	int32 GetQueryCacheMisses() const { return QueryCacheMisses; }
+	UFUNCTION(BlueprintCallable)
+	void ResetQueryCacheStats() { QueryCacheHits = 0; QueryCacheMisses = 0; }
+	/** Whether the flat base decided from the floor sweep differed from the floor trace on the last grounded tick. Requires stealth.ValidateFlatBase. */
+	UFUNCTION(BlueprintCallable)
+	bool GetFlatBaseMismatch() const { return bFlatBaseMismatch; }
+	/** Call at liftoff. Predicts the jump's arc with PredictJumpLedges() as soon as the step that lifts off has been simulated. */
+	void RequestJumpPrediction();
+	/**
+	* Predicts the arc of the jump from the current position and velocity, and gathers all of the static geometry the ledge scan
+	* could touch along it with a single overlap query. Called after the liftoff step, and again if the ledge scan leaves the predicted volume.
+	*/
+	void PredictJumpLedges();
+	/** Drops the current jump prediction, once ledges can no longer be grabbed. */
+	void ClearJumpPrediction() { JumpPrediction.Reset(); bJumpPredictionPending = false; }
+	/**
 	* Request a new capsule size for the character, for example when entering crouch or setting a new variable crouch height.
 	*
 	* @param NewSize - The new capsule size for the character, in half height units.
@@ -135,14 +326,43 @@ public:
 	UFUNCTION(BlueprintCallable)
 	void RequestLean(float HorzOffsetAmount, float VertOffsetAmount, float CameraRotation, float TransitionSpeed);
 
+	/** Snapshot of the state machine, timelines, capsule request and lean target, saved with every client move. */
+	FStealthMoveState CaptureMoveState() const;
+	/**
+	* Simulate the next moves as if in the given state, rather than in the state the local state machine is in. Used while the
+	* client replays its saved moves, and while the server simulates moves of a remote client.
+	* 
+	* @param bReconcile - Also move the timelines, capsule request and lean target to match the state. Only the server does this,
+	* so that it keeps simulating the same movement as the owning client.
+	*/
+	void SetNetworkMoveState(const FStealthMoveState& MoveState, bool bReconcile);
+	void ClearNetworkMoveState() { bHasNetworkMoveState = false; }
+
+	virtual FNetworkPredictionData_Client* GetPredictionData_Client() const override;
+	virtual void UpdateFromCompressedFlags(uint8 Flags) override;
+	virtual void UpdateCharacterStateBeforeMovement(float DeltaSeconds) override;
+	virtual void MoveAutonomous(float ClientTimeStamp, float DeltaTime, uint8 CompressedFlags, const FVector& NewAccel) override;
+	virtual bool ClientUpdatePositionAfterServerUpdate() override;
+
+	// Not const: a const BlueprintCallable becomes a pure node, and StealthPlayerCharacterBP calls these through exec pins.
 	UFUNCTION(BlueprintCallable)
-	bool GetInSlideState() { return movementStates.IsInState<PlayerMovementStates::Slide>(); }
+	bool GetInSlideState() { return IsInStates(StealthMovementStateBits::Slide); }
 	UFUNCTION(BlueprintCallable)
-	bool GetInSprintState() { return movementStates.IsInState<PlayerMovementStates::Sprint>(); }
+	bool GetInSprintState() { return IsInStates(StealthMovementStateBits::Sprint); }
 	UFUNCTION(BlueprintCallable)
-	bool GetInGenericLocomotionState() { return movementStates.IsInState<PlayerMovementStates::GenericLocomotion>(); }
+	bool GetInGenericLocomotionState() { return IsInStates(StealthMovementStateBits::GenericLocomotion); }
 	UFUNCTION(BlueprintCallable)
-	bool GetInClimbState() { return movementStates.IsInState<PlayerMovementStates::Climb>(); }
+	bool GetInClimbState() { return IsInStates(StealthMovementStateBits::Climb); }
+	/** True if any of the states in StateBits (StealthMovementStateBits) is active. */
+	bool IsInStates(uint32 StateBits) const { return (ActiveStateBits & StateBits) != 0; }
+	/** Get StealthMovementStateBits for every state that is currently active. */
+	uint32 GetActiveStateBits() const { return ActiveStateBits; }
+
+	/** Broadcast at the end of the state transitions of every tick in which the active states changed. */
+	FOnStealthMovementStateChangedNative OnStateChangedNative;
+	/** Same as OnStateChangedNative, for Blueprints. The states are StealthMovementStateBits. */
+	UPROPERTY(BlueprintAssignable, Category = "Movement States")
+	FOnStealthMovementStateChanged OnStateChanged;
 	FVector SlideStartCachedVector;
 	UPROPERTY(EditAnywhere, Category = "Sliding")
 	float SlideTurnReduction = 2.5f;
@@ -152,12 +372,30 @@ public:
 	float MaxClimbAngle = 35.0f;
 
 protected:
+	/**
+	* Runs one or more movement steps, as many as the movement clock has for this frame. With a fixed step, the camera is then drawn
+	* between the last two steps. The camera layers are applied once at the end, see UCameraFXHandler::TickCameraFX().
+	*/
 	void TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+	/**
+	* Simulates a single step of the base movement, the capsule and lean, the state machine and the timelines.
+	* 
+	* @param bTickComponent - Run the base movement through the full component tick. Otherwise only its move is simulated, with SimulateMovement().
+	*/
+	void SimulateStep(float StepDeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction, bool bBatched, bool bTickComponent);
+	/** Moves the character for one more fixed step, without ticking the component again. */
+	void SimulateMovement(float StepDeltaTime);
+	/** Sets the render interpolation camera layer to where the capsule is Alpha of the way from the last step to the current one. 0 removes the offset. */
+	void ApplyRenderInterpolation(float Alpha);
 
-	/** Called every tick to adjust the player height based on new requested height values from RequestCharacterResize() */
+	/** Called every tick to adjust the player height based on new requested height values from RequestCharacterResize(). Does nothing once it's reached. */
 	void UpdateCharacterHeight();
 	/** Called every tick to adjust the lean amount based on new lean values from RequestLean() */
 	void UpdateLeanState();
+	/** Resizes the capsule to the interpolated height, and moves the camera's crouch height layer along with it. Shared with UStealthMovementSubsystem. Does nothing if the height is unchanged. */
+	void ApplyCharacterHeight(float OldHalfHeight, float NewHalfHeight);
+	/** Tilts and offsets the camera for the interpolated lean, and remembers the progress for next frame. Shared with UStealthMovementSubsystem. */
+	void ApplyLeanState(float DeltaTime, float LeanMod, float HorzLeanProgress, float VertLeanProgress, float HorzLeanDelta, float VertLeanDelta);
 
 private:
 	/**
@@ -172,14 +410,67 @@ private:
 	* @return True if a valid ledge location was found, false otherwise. 
 	*/
 	bool TestForValidLedges(FVector& OutValidLedgeLocation);
+	/**
+	* Same as TestForValidLedges(), but looks the ledges up in the baked ledge index rather than sweeping for them.
+	* Only the best candidate is confirmed at runtime, with a line trace for headroom above the player and a capsule sweep from there
+	* onto the ledge.
+	* 
+	* @param bOutCovered - Set to false if no baked index covers the scan location, in which case the caller should fall back to tracing.
+	*/
+	bool TestForIndexedLedges(FVector& OutValidLedgeLocation, bool& bOutCovered);
+	/**
+	* Same as TestForValidLedges(), but runs the ledge scan against the components cached by PredictJumpLedges() instead of the whole scene.
+	* Re-predicts the jump first if the ledge scan has left the predicted volume.
+	*/
+	bool TestForPredictedLedges(FVector& OutValidLedgeLocation);
+	/**
+	* Runs the headroom and capsule checks from TestForValidLedges() on each potential ledge, in order.
+	* 
+	* @param LedgeHits - Hits of the ledge scan, in the order it found them.
+	*/
+	bool ValidateLedgeHits(TArrayView<const FHitResult> LedgeHits, FVector& OutValidLedgeLocation);
+
+	/** Builds the scene query for the given probe from this frame's query cache. */
+	FMovementProbe MakeProbe(EMovementProbe Type);
+	/** Builds the floor line trace used by TraceTestForFloor(), see there for the meaning of zOffset. */
+	FMovementProbe MakeFloorProbe(float zOffset);
+	/**
+	* Get the result of a probe for this frame.
+	* 
+	* When async probes are enabled (stealth.AsyncProbes), this returns the result that was queued at the end of the previous
+	* frame if there is one, and only runs the query synchronously otherwise. When the batch evaluates probes in parallel
+	* (stealth.ParallelProbes), the result it published at the start of this frame is returned instead.
+	* 
+	* @param bExact - Always run the query synchronously against the current capsule position. Use this for checks that would 
+	* move the player into geometry if they acted on a stale result.
+	*/
+	const FMovementProbeResult& RunProbe(EMovementProbe Type, bool bExact = false);
+	/** Queues the probes that the active states will ask for on the next frame as async scene queries. Called at the end of every tick. */
+	void QueueAsyncProbes();
+	/** Builds every probe that the active states are going to ask for on their next update. Shared with UStealthMovementSubsystem. */
+	void GatherUpcomingProbes(TArray<FMovementProbe, TInlineAllocator<8>>& OutProbes);
+	/** Runs the state transitions if any of their inputs changed since they last ran, then updates the states that need it. */
+	void ProcessStates();
+	FStateTransitionInputs CaptureTransitionInputs();
+	/** Called from the OnEnter() and OnExit() of every state with its StealthMovementStateBits. */
+	void SetStateActive(uint32 StateBit, bool bActive) { ActiveStateBits = bActive ? (ActiveStateBits | StateBit) : (ActiveStateBits & ~StateBit); }
+	/** Broadcasts OnStateChanged and traces the transition if the active states changed since the last call. */
+	void NotifyStateChanges();
+	/** Get the innermost state that is currently active. */
+	EStealthMoveState GetActiveMoveState() const;
 
 	/**
 	* Determines much of a requested lean can be performed without camera collisions with geometry.
+	*
+	* The result is reused until the anchor has moved or turned by more than stealth.LeanClearanceTolerance, the lean target changes,
+	* or it is older than stealth.LeanClearanceMaxAge.
 	* 
 	* @return An absolute value between 0.0 and 1.0. This value represents the amount of the originally requested lean that can be satisfied without collisions. 
 	* For example, if the function returns 0.75, then we can perform 75% of the requested lean amount without collisions.
 	*/
 	float CalculateLeanModifier();
+	/** Whether the clearance found for the last lean clearance probe still holds for Probe. */
+	bool IsLeanClearanceCached(const FMovementProbe& Probe) const;
 
 	/**
 	* Switches between flat vs rounded base for the player collision capsule based on whether the player is approaching a steep ledge.
@@ -188,8 +479,20 @@ private:
 	* bUseFlatBaseForFloorChecks to true. This allows the player to partially "step off" the ledge without sliding off.
 	* If the player is not near a steep ledge, the default behavior is to use a rounded base for their capsule collision,
 	* to allow smooth movement when stepping up on small ledges and climbing stairs.
+	* 
+	* With stealth.DeriveFlatBase, the ledge is found with IsNearLedge() from the floor the movement update just swept for. Otherwise,
+	* and alongside it with stealth.ValidateFlatBase, a line trace checks for floor within MaxStepHeight below the center of the capsule.
 	*/
 	void FlatBaseToggle();
+	/**
+	* Decides from a floor sweep whether the player is standing out over a ledge.
+	* 
+	* The rounded base is over a ledge when it touches the floor at an angle to the face it touches, which only happens on an edge.
+	* An edge only counts if ComputePerchResult() finds no floor within MaxStepHeight under the capsule's center, the same depth
+	* the floor trace checks, so stepping off a stair keeps the rounded base. That edge is remembered, and the flat base is kept
+	* until the capsule is back behind it or the floor under it changes height.
+	*/
+	bool IsNearLedge(const FFindFloorResult& Floor);
 
 	/**
 	* Tests for the presence of a floor below the player.
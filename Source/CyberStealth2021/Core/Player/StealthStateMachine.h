@@ -0,0 +1,285 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Tuple.h"
+#include "Templates/AndOrNot.h"
+#include "../Benchmark/MovementBenchmark.h"
+
+/**
+* A hierarchical state machine whose states are all known at compile time.
+*
+* Every state lives inline in the TStealthStateMachine that declares it, and is reset in place whenever it is entered, so entering,
+* leaving and updating states never touches the heap. States aren't polymorphic either: the machine builds a table of the hooks of
+* each state type, so a state only defines the hooks it needs and hides the defaults of TStealthState.
+*
+* The graph is declared with the Parent of each state. Root states have none, and a state can only be entered as the inner state of
+* its parent, which is checked whenever it is entered. Transitions work like the hsm library this replaces:
+*  - SiblingTransition<T>() leaves the current state and its inner states, and enters T in its place.
+*  - InnerTransition<T>() leaves the current inner state if there is one, and enters T as the inner state.
+*  - InnerEntryTransition<T>() enters T as the inner state only if there is no inner state yet.
+* Any arguments are stored in the transition itself, and passed on to the OnEnter() of the target state.
+*/
+namespace StealthStateMachine {
+	/** Unique address for every state type, which transitions use to name their target. */
+	template<typename TState>
+	struct TStateKey {
+		static const uint8 Key;
+	};
+	template<typename TState>
+	const uint8 TStateKey<TState>::Key = 0;
+
+	/** Calls OnEnter() of the state with the arguments the transition was created with. */
+	template<typename TState, typename... ArgTypes>
+	void EnterWithArgs(void* State, const void* Args) {
+		static_cast<const TTuple<ArgTypes...>*>(Args)->ApplyAfter([State](ArgTypes... InArgs) { static_cast<TState*>(State)->OnEnter(InArgs...); });
+	}
+}
+
+struct FStealthStateTransition {
+	enum class EType : uint8 {
+		None,
+		Sibling,
+		Inner,
+		InnerEntry
+	};
+
+	static constexpr int32 MaxArgsSize = 16;
+
+	EType Type = EType::None;
+	const void* Target = nullptr;
+	void (*Enter)(void* State, const void* Args) = nullptr;
+	alignas(8) uint8 Args[MaxArgsSize];
+
+	bool IsNone() const { return Type == EType::None; }
+
+	template<typename TState, typename... ArgTypes>
+	static FStealthStateTransition Make(EType Type, ArgTypes... InArgs) {
+		using FArgs = TTuple<ArgTypes...>;
+		static_assert(sizeof(FArgs) <= MaxArgsSize, "Too many arguments for a state transition");
+		static_assert(TAnd<TIsArithmetic<ArgTypes>...>::Value, "State transition arguments have to be numbers or bools, so they can be copied along with the transition");
+
+		FStealthStateTransition Transition;
+		Transition.Type = Type;
+		Transition.Target = &StealthStateMachine::TStateKey<TState>::Key;
+		Transition.Enter = &StealthStateMachine::EnterWithArgs<TState, ArgTypes...>;
+		new (Transition.Args) FArgs(InArgs...);
+		return Transition;
+	}
+};
+
+inline FStealthStateTransition NoTransition() {
+	return FStealthStateTransition();
+}
+
+template<typename TState, typename... ArgTypes>
+FStealthStateTransition SiblingTransition(ArgTypes... Args) {
+	return FStealthStateTransition::Make<TState>(FStealthStateTransition::EType::Sibling, Args...);
+}
+
+template<typename TState, typename... ArgTypes>
+FStealthStateTransition InnerTransition(ArgTypes... Args) {
+	return FStealthStateTransition::Make<TState>(FStealthStateTransition::EType::Inner, Args...);
+}
+
+template<typename TState, typename... ArgTypes>
+FStealthStateTransition InnerEntryTransition(ArgTypes... Args) {
+	return FStealthStateTransition::Make<TState>(FStealthStateTransition::EType::InnerEntry, Args...);
+}
+
+/** Base of every state. TParent is the state this one is an inner state of, or void for a root state. */
+template<typename TOwner, typename TParent = void>
+struct TStealthState {
+	using Parent = TParent;
+
+	TOwner& Owner() const { return *OwnerPtr; }
+
+	// Defaults for the hooks a state doesn't define. They are called on the concrete state type, so they aren't virtual.
+	void OnEnter() {}
+	void OnExit() {}
+	void Update() {}
+	FStealthStateTransition GetTransition() { return NoTransition(); }
+
+	TOwner* OwnerPtr = nullptr;
+};
+
+template<typename TOwner, typename... TStates>
+class TStealthStateMachine {
+public:
+	static constexpr int32 NumStates = sizeof...(TStates);
+	static constexpr int32 MaxDepth = 4;
+
+	/** Set the root state that is entered on the first ProcessStateTransitions(). */
+	template<typename TInitialState>
+	void Initialize(TOwner* InOwner) {
+		Owner = InOwner;
+		Depth = 0;
+		InitialTransition = SiblingTransition<TInitialState>();
+	}
+
+	/** Evaluates the transitions of the active states from the outermost in, until none of them transitions anymore. */
+	void ProcessStateTransitions() {
+		if (Depth == 0) {
+			EnterState(0, InitialTransition);
+		}
+
+		// Every change starts over from the outermost state, since entering a state can change what its outer states decide.
+		int32 Level = 0;
+		int32 NumChanges = 0;
+		while (Level < Depth) {
+			const FStealthStateTransition Transition = GetTransitionTable()[Stack[Level]](*this);
+			if (Transition.IsNone()) {
+				Level++;
+				continue;
+			}
+
+			STEALTH_BENCHMARK_SCOPE("StealthStateMachine::Transition");
+			bool bChanged = false;
+			switch (Transition.Type) {
+			case FStealthStateTransition::EType::Sibling:
+				ExitStates(Level);
+				EnterState(Level, Transition);
+				bChanged = true;
+				break;
+			case FStealthStateTransition::EType::Inner:
+				ExitStates(Level + 1);
+				EnterState(Level + 1, Transition);
+				bChanged = true;
+				break;
+			case FStealthStateTransition::EType::InnerEntry:
+				if (Depth == Level + 1) {
+					EnterState(Level + 1, Transition);
+					bChanged = true;
+				}
+				break;
+			default:
+				break;
+			}
+
+			if (bChanged) {
+				checkf(++NumChanges < 32, TEXT("State transitions aren't settling, two states keep transitioning to each other"));
+				Level = 0;
+			}
+			else {
+				Level++;
+			}
+		}
+	}
+
+	/** Calls Update() of every active state, from the outermost in. */
+	void UpdateStates() {
+		for (int32 Level = 0; Level < Depth; Level++) {
+			GetUpdateTable()[Stack[Level]](*this);
+		}
+	}
+
+	template<typename TState>
+	bool IsInState() const {
+		const int32 Index = FindState(&StealthStateMachine::TStateKey<TState>::Key);
+		for (int32 Level = 0; Level < Depth; Level++) {
+			if (Stack[Level] == Index) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	template<typename TState>
+	TState& GetState() { return static_cast<TSlot<TState>&>(Slots).State; }
+
+private:
+	template<typename TState>
+	struct TSlot {
+		TState State;
+	};
+	struct FSlots : TSlot<TStates>... {};
+
+	using FStateFunc = void (*)(TStealthStateMachine&);
+	using FTransitionFunc = FStealthStateTransition (*)(TStealthStateMachine&);
+
+	FSlots Slots;
+	TOwner* Owner = nullptr;
+	FStealthStateTransition InitialTransition;
+	// Indices of the active states, outermost first.
+	int8 Stack[MaxDepth];
+	int32 Depth = 0;
+
+	template<typename TState>
+	static void ResetState(TStealthStateMachine& Machine) {
+		TState& State = Machine.template GetState<TState>();
+		State = TState();
+		State.OwnerPtr = Machine.Owner;
+	}
+	template<typename TState>
+	static void ExitState(TStealthStateMachine& Machine) { Machine.template GetState<TState>().OnExit(); }
+	template<typename TState>
+	static void UpdateState(TStealthStateMachine& Machine) { Machine.template GetState<TState>().Update(); }
+	template<typename TState>
+	static FStealthStateTransition GetStateTransition(TStealthStateMachine& Machine) { return Machine.template GetState<TState>().GetTransition(); }
+	template<typename TState>
+	static void* GetStatePtr(TStealthStateMachine& Machine) { return &Machine.template GetState<TState>(); }
+
+	template<typename TState>
+	static int32 GetParentIndex() { return FindState(&StealthStateMachine::TStateKey<typename TState::Parent>::Key); }
+
+	static const void* const* GetKeys() {
+		static const void* const Keys[] = { &StealthStateMachine::TStateKey<TStates>::Key... };
+		return Keys;
+	}
+	static const int32* GetParents() {
+		static const int32 Parents[] = { GetParentIndex<TStates>()... };
+		return Parents;
+	}
+	static const FStateFunc* GetResetTable() {
+		static const FStateFunc Table[] = { &ResetState<TStates>... };
+		return Table;
+	}
+	static const FStateFunc* GetExitTable() {
+		static const FStateFunc Table[] = { &ExitState<TStates>... };
+		return Table;
+	}
+	static const FStateFunc* GetUpdateTable() {
+		static const FStateFunc Table[] = { &UpdateState<TStates>... };
+		return Table;
+	}
+	static const FTransitionFunc* GetTransitionTable() {
+		static const FTransitionFunc Table[] = { &GetStateTransition<TStates>... };
+		return Table;
+	}
+	static void* GetStatePtrAt(TStealthStateMachine& Machine, int32 Index) {
+		using FPtrFunc = void* (*)(TStealthStateMachine&);
+		static const FPtrFunc Table[] = { &GetStatePtr<TStates>... };
+		return Table[Index](Machine);
+	}
+
+	static int32 FindState(const void* Key) {
+		const void* const* Keys = GetKeys();
+		for (int32 Index = 0; Index < NumStates; Index++) {
+			if (Keys[Index] == Key) {
+				return Index;
+			}
+		}
+		return INDEX_NONE;
+	}
+
+	/** Leaves the state at Level and every state inside of it, innermost first. */
+	void ExitStates(int32 Level) {
+		while (Depth > Level) {
+			Depth--;
+			GetExitTable()[Stack[Depth]](*this);
+		}
+	}
+
+	void EnterState(int32 Level, const FStealthStateTransition& Transition) {
+		const int32 Index = FindState(Transition.Target);
+		checkf(Index != INDEX_NONE, TEXT("Transition to a state that isn't part of this state machine"));
+		checkf(Level < MaxDepth, TEXT("States are nested deeper than TStealthStateMachine::MaxDepth"));
+		checkf(GetParents()[Index] == (Level > 0 ? Stack[Level - 1] : INDEX_NONE), TEXT("Transition to a state that isn't an inner state of the current one"));
+
+		GetResetTable()[Index](*this);
+		Stack[Level] = (int8)Index;
+		Depth = Level + 1;
+		Transition.Enter(GetStatePtrAt(*this, Index), Transition.Args);
+	}
+};
@@ -0,0 +1,104 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "../HeadBobGenerator.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace {
+	/** Settings without any variation and with the same step rate at every speed, so that footfalls land at known times. */
+	FHeadBobSettings MakeSteadySettings() {
+		FHeadBobSettings Settings;
+		Settings.StepVariation = 0.0f;
+		Settings.ZHeightVariation = 0.0f;
+		Settings.SwayVariation = 0.0f;
+		Settings.RollVariation = 0.0f;
+		Settings.MinSpeedRate = 1.0f;
+		Settings.MaxSpeedRate = 1.0f;
+		return Settings;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FHeadBobFootfallPhaseTest, "CyberStealth.Movement.HeadBob.FootfallPhases",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FHeadBobFootfallPhaseTest::RunTest(const FString& Parameters) {
+	const FHeadBobSettings Settings = MakeSteadySettings();
+	// A foot lands at a quarter and at three quarters of every cycle, so half a cycle apart.
+	const float FirstFootfallTime = (0.5f * PI) / Settings.StepFrequency;
+	const float StepInterval = PI / Settings.StepFrequency;
+
+	// Frame by frame, each footfall has to be reported once, at the time its phase was reached.
+	FHeadBobGenerator Bob;
+	Bob.Initialize(Settings, 1234);
+	const float DeltaTime = 1.0f / 60.0f;
+	float Time = 0.0f;
+	TArray<float> FootfallTimes;
+	for (int32 Frame = 0; Frame < 120; Frame++) {
+		Time += DeltaTime;
+		Bob.Advance(DeltaTime, 300.0f, [&](float SecondsAgo) {
+			TestTrue(TEXT("Footfall happened within the frame"), SecondsAgo >= 0.0f && SecondsAgo <= DeltaTime);
+			FootfallTimes.Add(Time - SecondsAgo);
+		});
+	}
+	TestEqual(TEXT("Footfalls in two seconds"), FootfallTimes.Num(), FMath::FloorToInt((Time - FirstFootfallTime) / StepInterval) + 1);
+	for (int32 i = 0; i < FootfallTimes.Num(); i++) {
+		TestEqual(FString::Printf(TEXT("Time of footfall %d"), i), FootfallTimes[i], FirstFootfallTime + (i * StepInterval), 1.e-3f);
+	}
+
+	// A long hitch has to report every footfall it skipped over, oldest first.
+	FHeadBobGenerator HitchBob;
+	HitchBob.Initialize(Settings, 1234);
+	TArray<float> SecondsAgos;
+	HitchBob.Advance(1.0f, 300.0f, [&](float SecondsAgo) { SecondsAgos.Add(SecondsAgo); });
+	TestEqual(TEXT("Footfalls in a one second frame"), SecondsAgos.Num(), 2);
+	if (SecondsAgos.Num() == 2) {
+		TestEqual(TEXT("First footfall of the hitch"), SecondsAgos[0], 1.0f - FirstFootfallTime, 1.e-3f);
+		TestEqual(TEXT("Second footfall of the hitch"), SecondsAgos[1], 1.0f - (FirstFootfallTime + StepInterval), 1.e-3f);
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FHeadBobFadeToRestTest, "CyberStealth.Movement.HeadBob.FadesToRest",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FHeadBobFadeToRestTest::RunTest(const FString& Parameters) {
+	FHeadBobGenerator Bob;
+	Bob.Initialize(MakeSteadySettings(), 1234);
+	const float DeltaTime = 1.0f / 60.0f;
+	int32 NumSteps = 0;
+	// Stop a little past the first footfall, so the camera is still low when the bob starts fading.
+	for (int32 Frame = 0; Frame < 20; Frame++) {
+		Bob.Advance(DeltaTime, 300.0f, [&](float SecondsAgo) { NumSteps++; });
+	}
+	TestEqual(TEXT("Footfalls while walking"), NumSteps, 1);
+	TestFalse(TEXT("At rest while walking"), Bob.IsAtRest());
+
+	// Standing still freezes the cycle, so the bob only shrinks toward rest and never takes another step.
+	FHeadBobPose Pose = Bob.Advance(DeltaTime, 0.0f, [&](float SecondsAgo) { NumSteps++; });
+	const float StandingSway = Pose.Y;
+	int32 Frame = 0;
+	for (; Frame < 300 && !Bob.IsAtRest(); Frame++) {
+		const FHeadBobPose Next = Bob.Advance(DeltaTime, 0.0f, [&](float SecondsAgo) { NumSteps++; });
+		if (FMath::Abs(Next.Z) > FMath::Abs(Pose.Z) || FMath::Abs(Next.Roll) > FMath::Abs(Pose.Roll)) {
+			AddError(FString::Printf(TEXT("Bob grew from %f to %f while fading out on frame %d"), Pose.Z, Next.Z, Frame));
+			return false;
+		}
+		Pose = Next;
+	}
+	TestTrue(TEXT("Bob came to rest within five seconds of standing still"), Bob.IsAtRest());
+	TestEqual(TEXT("Footfalls while standing still"), NumSteps, 1);
+	TestEqual(TEXT("Height at rest"), Pose.Z, 0.0f);
+	TestEqual(TEXT("Roll at rest"), Pose.Roll, 0.0f);
+	TestEqual(TEXT("Sway isn't faded out"), Pose.Y, StandingSway);
+
+	// Once at rest the pose must not change anymore, which is what lets the camera FX handler sleep.
+	const FHeadBobPose Rested = Bob.Advance(DeltaTime, 0.0f, [&](float SecondsAgo) { NumSteps++; });
+	TestTrue(TEXT("Pose stays the same at rest"), Rested.Z == Pose.Z && Rested.Y == Pose.Y && Rested.Roll == Pose.Roll);
+	TestTrue(TEXT("Still at rest"), Bob.IsAtRest());
+	return true;
+}
+
+#endif
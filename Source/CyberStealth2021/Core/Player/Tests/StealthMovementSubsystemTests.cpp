@@ -0,0 +1,53 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "../StealthMovementSubsystem.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FStealthMovementSubsystemLeanSettlesTest, "CyberStealth.Movement.Batch.LeanSettles",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FStealthMovementSubsystemLeanSettlesTest::RunTest(const FString& Parameters) {
+	// Two movers leaning out and one standing still, stepped frame after frame with the same scratch arrays, the way the
+	// subsystem reuses them while the mover count stays the same.
+	const int32 Num = 3;
+	float Horz[Num] = { 0.0f, 0.0f, 0.0f };
+	float Vert[Num] = { 0.0f, 0.0f, 0.0f };
+	const float TargetHorz[Num] = { 30.0f, -30.0f, 0.0f };
+	const float TargetVert[Num] = { -5.0f, -5.0f, 0.0f };
+	const float Speed[Num] = { 10.0f, 10.0f, 10.0f };
+	const float Modifier[Num] = { 1.0f, 1.0f, 1.0f };
+	TArray<float> HorzDelta;
+	TArray<float> VertDelta;
+	TArray<bool> Changed;
+
+	const float StepDeltaTime = 1.0f / 60.0f;
+	float AppliedHorz[Num] = { 0.0f, 0.0f, 0.0f };
+	for (int32 Frame = 0; Frame < 120; Frame++) {
+		// Every few frames, run two fixed steps in one frame like the movement clock does when it catches up.
+		const int32 NumSteps = Frame % 4 == 3 ? 2 : 1;
+		UStealthMovementSubsystem::InterpolateLeans(Num, StepDeltaTime, NumSteps, Horz, Vert, TargetHorz, TargetVert, Speed, Modifier,
+			HorzDelta, VertDelta, Changed);
+		for (int32 i = 0; i < Num; i++) {
+			AppliedHorz[i] += HorzDelta[i];
+			if (FMath::Abs(AppliedHorz[i]) > FMath::Abs(TargetHorz[i]) + KINDA_SMALL_NUMBER) {
+				AddError(FString::Printf(TEXT("Mover %d was moved %f past its lean target %f on frame %d"), i, AppliedHorz[i], TargetHorz[i], Frame));
+				return false;
+			}
+		}
+	}
+
+	for (int32 i = 0; i < Num; i++) {
+		TestEqual(FString::Printf(TEXT("Mover %d settled on its horizontal target"), i), Horz[i], TargetHorz[i]);
+		TestEqual(FString::Printf(TEXT("Mover %d settled on its vertical target"), i), Vert[i], TargetVert[i]);
+		TestEqual(FString::Printf(TEXT("Mover %d horizontal delta once settled"), i), HorzDelta[i], 0.0f);
+		TestEqual(FString::Printf(TEXT("Mover %d vertical delta once settled"), i), VertDelta[i], 0.0f);
+		TestFalse(FString::Printf(TEXT("Mover %d still reports a lean change once settled"), i), Changed[i]);
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,74 @@
+// Copyright 2021 MatthewZelriche. Licensed under the MIT License. See the included LICENSE.md file for details.
+
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "Serialization/BitReader.h"
+#include "Serialization/BitWriter.h"
+#include "UObject/Package.h"
+#include "../StealthNetworkMove.h"
+#include "../StealthPlayerMovement.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace {
+	/** Writes the state the way FStealthNetworkMoveData does, and reads it back into a fresh one. */
+	FStealthMoveState RoundTrip(const FStealthMoveState& MoveState) {
+		FBitWriter Writer(0, true);
+		FStealthMoveState Written = MoveState;
+		Written.NetSerialize(Writer);
+
+		FBitReader Reader(Writer.GetData(), Writer.GetNumBits());
+		FStealthMoveState Read;
+		Read.NetSerialize(Reader);
+		return Read;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FStealthMoveStateRoundTripTest, "CyberStealth.Movement.Network.MoveStateRoundTrip",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FStealthMoveStateRoundTripTest::RunTest(const FString& Parameters) {
+	// A slide that crouches the capsule faster than a byte of tenths could hold, while leaning.
+	FStealthMoveState Sliding;
+	Sliding.State = EStealthMoveState::Slide;
+	Sliding.SlideProgress = FStealthMoveState::QuantizeProgress(0.4f);
+	Sliding.RequestedHalfHeight = FStealthMoveState::QuantizeHalfHeight(34.5f);
+	Sliding.HeightTransitionSpeed = FStealthMoveState::QuantizeSpeed(40.0f);
+	Sliding.LeanHorzOffset = FStealthMoveState::QuantizeLean(-30.0f);
+	Sliding.LeanRoll = FStealthMoveState::QuantizeLean(10.0f);
+	TestTrue(TEXT("Sliding state survives serialization"), RoundTrip(Sliding) == Sliding);
+	TestEqual(TEXT("Requested half height"), FStealthMoveState::DequantizeHalfHeight(RoundTrip(Sliding).RequestedHalfHeight), 34.5f);
+	TestEqual(TEXT("Height transition speed above 25.5"), FStealthMoveState::DequantizeSpeed(RoundTrip(Sliding).HeightTransitionSpeed), 40.0f);
+
+	// Progress and lean are only sent while they mean anything, so a standing move must come back without them.
+	FStealthMoveState Walking;
+	Walking.State = EStealthMoveState::Walk;
+	Walking.ClimbProgress = 100;
+	Walking.RequestedHalfHeight = FStealthMoveState::QuantizeHalfHeight(68.0f);
+	const FStealthMoveState WalkingRead = RoundTrip(Walking);
+	TestTrue(TEXT("Walking state"), WalkingRead.State == EStealthMoveState::Walk);
+	TestEqual(TEXT("Climb progress is dropped outside of a climb"), WalkingRead.ClimbProgress, (uint8)0);
+	TestFalse(TEXT("Walking move has no lean"), WalkingRead.HasLean());
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FStealthSprintFlagRoundTripTest, "CyberStealth.Movement.Network.SprintFlagRoundTrip",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FStealthSprintFlagRoundTripTest::RunTest(const FString& Parameters) {
+	// The flag a saved move sends has to be what the server's movement ends up wanting, without going through the character.
+	UStealthPlayerMovement* Movement = NewObject<UStealthPlayerMovement>(GetTransientPackage());
+	for (const bool bSprinting : { true, false }) {
+		FSavedMove_Stealth SavedMove;
+		SavedMove.Clear();
+		SavedMove.bSavedWantsToSprint = bSprinting;
+		Movement->bWantsToSprint = !bSprinting;
+		Movement->UpdateFromCompressedFlags(SavedMove.GetCompressedFlags());
+		TestEqual(FString::Printf(TEXT("Wants to sprint after restoring a move with sprint %s"), bSprinting ? TEXT("held") : TEXT("released")),
+			Movement->bWantsToSprint, bSprinting);
+	}
+	return true;
+}
+
+#endif
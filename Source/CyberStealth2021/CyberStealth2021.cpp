@@ -2,5 +2,16 @@
 
 #include "CyberStealth2021.h"
 #include "Modules/ModuleManager.h"
+#include "Core/Benchmark/MovementBenchmark.h"
 
-IMPLEMENT_PRIMARY_GAME_MODULE( FDefaultGameModuleImpl, CyberStealth2021, "CyberStealth2021" );
+class FCyberStealth2021Module : public FDefaultGameModuleImpl
+{
+public:
+	virtual void StartupModule() override
+	{
+		// GMalloc can only be swapped for the counting proxy this early, before the benchmark loads anything.
+		FMovementBenchmarkMalloc::InstallIfRequested();
+	}
+};
+
+IMPLEMENT_PRIMARY_GAME_MODULE( FCyberStealth2021Module, CyberStealth2021, "CyberStealth2021" );